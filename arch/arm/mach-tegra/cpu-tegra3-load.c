@@ -0,0 +1,91 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra3-load.c
+ *
+ * Load history hotplug policy for Tegra3 CPUs
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kernel.h>
+
+#include "cpu-tegra3-load.h"
+
+/*
+ * The load and runqueue depth are averaged over the last window samples,
+ * and the change of that average from one sample to the next is used as
+ * the trend.  A window average lags the signal by (window - 1) / 2
+ * samples, so the trend is extrapolated (window + 1) / 2 samples ahead
+ * to predict the load of the next period.
+ *
+ * A CPU is added when the predicted load or the runqueue depth does not
+ * fit the online CPUs, and dropped only when both the average and the
+ * predicted load, and the runqueue depth, would still fit one CPU less.
+ * down_load below up_load keeps the two decisions apart, and each one
+ * has to hold for a number of consecutive samples before it is taken,
+ * so short bursts don't make cores come and go.
+ */
+int tegra_hp_load_decide(struct tegra_hp_load_history *h,
+			 const struct tegra_hp_load_params *p,
+			 const struct tegra_hp_load_sample *s)
+{
+	unsigned int window = clamp_t(unsigned int, p->window, 1,
+				      TEGRA_HP_LOAD_HISTORY);
+	unsigned int load = 0, rq = 0, n, i, idx;
+	int trend, predicted;
+	bool up, down;
+
+	h->samples[h->head] = *s;
+	h->head = (h->head + 1) % TEGRA_HP_LOAD_HISTORY;
+	if (h->count < TEGRA_HP_LOAD_HISTORY)
+		h->count++;
+
+	n = min(window, h->count);
+	for (i = 1; i <= n; i++) {
+		idx = (h->head + TEGRA_HP_LOAD_HISTORY - i) %
+			TEGRA_HP_LOAD_HISTORY;
+		load += h->samples[idx].load;
+		rq += h->samples[idx].nr_running;
+	}
+	load /= n;
+	rq = rq * 100 / n;
+
+	trend = h->count > 1 ? (int)load - (int)h->avg_load : 0;
+	predicted = max((int)load + trend * (int)(n + 1) / 2, 0);
+	h->avg_load = load;
+	h->predicted = predicted;
+
+	up = s->nr_cpus < s->max_cpus &&
+		(predicted > p->up_load * s->nr_cpus ||
+		 rq > p->up_rq_depth * s->nr_cpus);
+	down = s->nr_cpus > 1 &&
+		max_t(unsigned int, load, predicted) <
+			p->down_load * (s->nr_cpus - 1) &&
+		rq <= p->up_rq_depth * (s->nr_cpus - 1);
+
+	h->up_hits = up ? h->up_hits + 1 : 0;
+	h->down_hits = down ? h->down_hits + 1 : 0;
+
+	if (up && h->up_hits >= p->up_count) {
+		h->up_hits = 0;
+		return 1;
+	}
+	if (down && h->down_hits >= p->down_count) {
+		h->down_hits = 0;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra3-load.h
+ *
+ * Load history hotplug policy for Tegra3 CPUs
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __MACH_TEGRA_CPU_TEGRA3_LOAD_H
+#define __MACH_TEGRA_CPU_TEGRA3_LOAD_H
+
+#define TEGRA_HP_LOAD_HISTORY	8
+
+/* one sampling period, as seen by the hotplug work */
+struct tegra_hp_load_sample {
+	unsigned int nr_cpus;		/* CPUs online */
+	unsigned int max_cpus;		/* CPUs allowed by PM QoS and EDP */
+	unsigned int load;		/* busy % summed over online CPUs */
+	unsigned int nr_running;	/* runnable tasks on online CPUs */
+};
+
+struct tegra_hp_load_params {
+	unsigned int window;		/* samples averaged, <= HISTORY */
+	unsigned int up_load;		/* busy % per CPU to add one */
+	unsigned int down_load;		/* busy % per remaining CPU to drop one */
+	unsigned int up_rq_depth;	/* runnable tasks x100 per CPU to add one */
+	unsigned int up_count;		/* consecutive samples before adding */
+	unsigned int down_count;	/* consecutive samples before dropping */
+};
+
+struct tegra_hp_load_history {
+	struct tegra_hp_load_sample samples[TEGRA_HP_LOAD_HISTORY];
+	unsigned int head;
+	unsigned int count;
+	unsigned int avg_load;		/* windowed load of the last sample */
+	unsigned int predicted;		/* expected load of the next period */
+	unsigned int up_hits;
+	unsigned int down_hits;
+};
+
+/*
+ * Record sample s in history h and decide on the core count for the next
+ * period: returns 1 to bring a CPU online, -1 to take one offline and 0
+ * to keep the current count.  Only depends on its arguments, so it can
+ * be replayed against recorded load traces outside of the kernel.
+ */
+int tegra_hp_load_decide(struct tegra_hp_load_history *h,
+			 const struct tegra_hp_load_params *p,
+			 const struct tegra_hp_load_sample *s);
+
+#endif
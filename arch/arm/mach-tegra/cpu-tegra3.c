@@ -33,15 +33,19 @@
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
 #include <linux/pm_qos_params.h>
+#include <linux/math64.h>
+#include <linux/tick.h>
 
 #include "pm.h"
 #include "cpu-tegra.h"
+#include "cpu-tegra3-load.h"
 #include "clock.h"
 
 #define INITIAL_STATE		TEGRA_HP_DISABLED
 #define UP2G0_DELAY_MS		200
 #define UP2Gn_DELAY_MS		1000
 #define DOWN_DELAY_MS		2000
+#define LOAD_SAMPLE_MS		50
 
 static struct mutex *tegra3_cpu_lock;
 
@@ -69,6 +73,32 @@ module_param(mp_overhead, int, 0644);
 static int balance_level = 75;
 module_param(balance_level, int, 0644);
 
+static unsigned long load_sample_delay;
+module_param(load_sample_delay, ulong, 0644);
+
+static struct tegra_hp_load_params hp_load_params = {
+	.window		= 4,
+	.up_load	= 80,
+	.down_load	= 50,
+	.up_rq_depth	= 200,
+	.up_count	= 2,
+	.down_count	= 20,
+};
+module_param_named(load_window, hp_load_params.window, uint, 0644);
+module_param_named(load_up, hp_load_params.up_load, uint, 0644);
+module_param_named(load_down, hp_load_params.down_load, uint, 0644);
+module_param_named(load_up_rq_depth, hp_load_params.up_rq_depth, uint, 0644);
+module_param_named(load_up_count, hp_load_params.up_count, uint, 0644);
+module_param_named(load_down_count, hp_load_params.down_count, uint, 0644);
+
+static struct tegra_hp_load_history hp_load_history;
+static cpumask_t hp_load_mask;	/* CPUs with a previous idle sample */
+static struct {
+	u64 idle_us;
+	u64 wall_us;
+	unsigned int load;
+} hp_load_cpu[CONFIG_NR_CPUS];
+
 static struct clk *cpu_clk;
 static struct clk *cpu_g_clk;
 static struct clk *cpu_lp_clk;
@@ -132,14 +162,36 @@ enum {
 };
 static int hp_state;
 
+/* how the core count is chosen on the G cluster, 1 or 2 in auto_hotplug */
+enum {
+	TEGRA_HP_POLICY_SPEED = 1,
+	TEGRA_HP_POLICY_LOAD,
+};
+static int hp_policy = TEGRA_HP_POLICY_SPEED;
+
+static void hp_load_reset(void)
+{
+	memset(&hp_load_history, 0, sizeof(hp_load_history));
+	cpumask_clear(&hp_load_mask);
+}
+
 static int hp_state_set(const char *arg, const struct kernel_param *kp)
 {
 	int ret = 0;
 	int old_state;
+	int policy = TEGRA_HP_POLICY_SPEED;
 
 	if (!tegra3_cpu_lock)
 		return ret;
 
+	/* "2" enables with the load history policy, it needs idle stats */
+	if (sysfs_streq(arg, "2")) {
+		if (get_cpu_idle_time_us(0, NULL) == -1ULL)
+			return -EINVAL;
+		policy = TEGRA_HP_POLICY_LOAD;
+		arg = "1";
+	}
+
 	mutex_lock(tegra3_cpu_lock);
 
 	old_state = hp_state;
@@ -154,6 +206,13 @@ static int hp_state_set(const char *arg, const struct kernel_param *kp)
 				pr_info("Tegra auto-hotplug enabled\n");
 				hp_init_stats();
 			}
+			if (policy != hp_policy) {
+				pr_info("Tegra auto-hotplug %s policy\n",
+					(policy == TEGRA_HP_POLICY_LOAD) ?
+					"load history" : "cpu speed");
+				hp_policy = policy;
+				hp_load_reset();
+			}
 			/* catch-up with governor target speed */
 			tegra_cpu_set_speed_cap(NULL);
 		}
@@ -165,9 +224,11 @@ static int hp_state_set(const char *arg, const struct kernel_param *kp)
 	return ret;
 }
 
+/* report the mode that was written: 0 off, 1 cpu speed, 2 load history */
 static int hp_state_get(char *buffer, const struct kernel_param *kp)
 {
-	return param_get_int(buffer, kp);
+	return sprintf(buffer, "%d",
+		       (hp_state == TEGRA_HP_DISABLED) ? 0 : hp_policy);
 }
 
 static struct kernel_param_ops tegra_hp_state_ops = {
@@ -207,13 +268,85 @@ static noinline int tegra_cpu_speed_balance(void)
 	return TEGRA_CPU_SPEED_BALANCED;
 }
 
+static void hp_load_sample(struct tegra_hp_load_sample *s)
+{
+	u64 idle_us, wall_us, delta_idle, delta_wall;
+	unsigned int load;
+	int cpu;
+
+	s->nr_cpus = num_online_cpus();
+	s->load = 0;
+	s->nr_running = 0;
+
+	for_each_online_cpu(cpu) {
+		idle_us = get_cpu_idle_time_us(cpu, &wall_us);
+		load = 0;
+		/* a CPU that just came online has nothing to compare with */
+		if (cpumask_test_cpu(cpu, &hp_load_mask) &&
+		    wall_us > hp_load_cpu[cpu].wall_us) {
+			delta_wall = wall_us - hp_load_cpu[cpu].wall_us;
+			delta_idle = idle_us - hp_load_cpu[cpu].idle_us;
+			if (delta_idle < delta_wall)
+				load = div64_u64(100 * (delta_wall - delta_idle),
+						 delta_wall);
+		}
+		hp_load_cpu[cpu].idle_us = idle_us;
+		hp_load_cpu[cpu].wall_us = wall_us;
+		hp_load_cpu[cpu].load = load;
+
+		s->load += load;
+		s->nr_running += nr_running_cpu(cpu);
+	}
+	cpumask_copy(&hp_load_mask, cpu_online_mask);
+}
+
+static unsigned int hp_load_idlest_cpu(void)
+{
+	unsigned int cpu = nr_cpu_ids;
+	unsigned int load = UINT_MAX;
+	int i;
+
+	for_each_online_cpu(i)
+		if ((i > 0) && (load > hp_load_cpu[i].load)) {
+			cpu = i;
+			load = hp_load_cpu[i].load;
+		}
+	return cpu;
+}
+
+/* same verdicts as tegra_cpu_speed_balance(), from the load history */
+static noinline int tegra_cpu_load_balance(void)
+{
+	struct tegra_hp_load_sample s;
+	unsigned int nr_cpus = num_online_cpus();
+	unsigned int max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
+	int decision;
+
+	hp_load_sample(&s);
+	s.max_cpus = tegra_cpu_edp_favor_up(nr_cpus, mp_overhead) ?
+		max_cpus : nr_cpus;
+	decision = tegra_hp_load_decide(&hp_load_history, &hp_load_params, &s);
+
+	if (tegra_cpu_edp_favor_down(nr_cpus, mp_overhead) ||
+	    (nr_cpus > max_cpus) || (decision < 0))
+		return TEGRA_CPU_SPEED_SKEWED;
+
+	if (decision > 0)
+		return TEGRA_CPU_SPEED_BALANCED;
+
+	return TEGRA_CPU_SPEED_BIASED;
+}
+
 static void tegra_auto_hotplug_work_func(struct work_struct *work)
 {
 	bool up = false;
+	bool load_policy;
 	unsigned int cpu = nr_cpu_ids;
 
 	mutex_lock(tegra3_cpu_lock);
 
+	load_policy = (hp_policy == TEGRA_HP_POLICY_LOAD);
+
 	switch (hp_state) {
 	case TEGRA_HP_DISABLED:
 	case TEGRA_HP_IDLE:
@@ -241,11 +374,13 @@ static void tegra_auto_hotplug_work_func(struct work_struct *work)
 			if(!clk_set_parent(cpu_clk, cpu_g_clk)) {
 				hp_stats_update(CONFIG_NR_CPUS, false);
 				hp_stats_update(0, true);
+				hp_load_reset();
 				/* catch-up with governor target speed */
 				tegra_cpu_set_speed_cap(NULL);
 			}
 		} else {
-			switch (tegra_cpu_speed_balance()) {
+			switch (load_policy ? tegra_cpu_load_balance() :
+				tegra_cpu_speed_balance()) {
 			/* cpu speed is up and balanced - one more on-line */
 			case TEGRA_CPU_SPEED_BALANCED:
 				cpu = cpumask_next_zero(0, cpu_online_mask);
@@ -256,7 +391,8 @@ static void tegra_auto_hotplug_work_func(struct work_struct *work)
 				break;
 			/* cpu speed is up, but skewed - remove one core */
 			case TEGRA_CPU_SPEED_SKEWED:
-				cpu = tegra_get_slowest_cpu_n();
+				cpu = load_policy ? hp_load_idlest_cpu() :
+					tegra_get_slowest_cpu_n();
 				if (cpu < nr_cpu_ids) {
 					up = false;
 					hp_stats_update(cpu, false);
@@ -268,8 +404,8 @@ static void tegra_auto_hotplug_work_func(struct work_struct *work)
 				break;
 			}
 		}
-		queue_delayed_work(
-			hotplug_wq, &hotplug_work, up2gn_delay);
+		queue_delayed_work(hotplug_wq, &hotplug_work,
+			load_policy ? load_sample_delay : up2gn_delay);
 		break;
 	default:
 		pr_err("%s: invalid tegra hotplug state %d\n",
@@ -370,6 +506,7 @@ int tegra_auto_hotplug_init(struct mutex *cpu_lock)
 	up2g0_delay = msecs_to_jiffies(UP2G0_DELAY_MS);
 	up2gn_delay = msecs_to_jiffies(UP2Gn_DELAY_MS);
 	down_delay = msecs_to_jiffies(DOWN_DELAY_MS);
+	load_sample_delay = msecs_to_jiffies(LOAD_SAMPLE_MS);
 
 	tegra3_cpu_lock = cpu_lock;
 	hp_state = INITIAL_STATE;
@@ -419,6 +556,12 @@ static int hp_stats_show(struct seq_file *s, void *data)
 	}
 	seq_printf(s, "\n");
 
+	seq_printf(s, "%-15s %s\n", "policy:",
+		   (hp_policy == TEGRA_HP_POLICY_LOAD) ? "load" : "speed");
+	if (hp_policy == TEGRA_HP_POLICY_LOAD)
+		seq_printf(s, "%-15s %u (predicted %u)\n", "load:",
+			   hp_load_history.avg_load, hp_load_history.predicted);
+
 	seq_printf(s, "%-15s %llu\n", "time-stamp:",
 		   cputime64_to_clock_t(cur_jiffies));
 
@@ -22,7 +22,9 @@
 
 #include <linux/ioctl.h>
 #include <linux/file.h>
+#include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 
 #if !defined(__KERNEL__)
 #define __user
@@ -97,8 +99,10 @@ struct nvmap_pinarray_elem {
 struct nvmap_handle_ref {
 	struct nvmap_handle *handle;
 	struct rb_node	node;
+	struct hlist_node hash_node;	/* entry on the client's ref_hash */
 	atomic_t	dupes;	/* number of times to free on file close */
 	atomic_t	pin;	/* number of times to unpin on free */
+	struct rcu_head	rcu;
 };
 #endif
 
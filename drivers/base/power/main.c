@@ -169,7 +169,8 @@ static ktime_t initcall_debug_start(struct device *dev)
 		pr_info("calling  %s+ @ %i\n",
 				dev_name(dev), task_pid_nr(current));
 		calltime = ktime_get();
-	}
+	} else if (suspend_profile_enabled)
+		calltime = ktime_get();
 
 	return calltime;
 }
@@ -185,6 +186,7 @@ static void initcall_debug_report(struct device *dev, ktime_t calltime,
 		pr_info("call %s+ returned %d after %Ld usecs\n", dev_name(dev),
 			error, (unsigned long long)ktime_to_ns(delta) >> 10);
 	}
+	suspend_profile_device(dev, calltime, error);
 }
 
 /**
@@ -300,7 +302,8 @@ static int pm_noirq_op(struct device *dev,
 				dev_name(dev), task_pid_nr(current),
 				dev->parent ? dev_name(dev->parent) : "none");
 		calltime = ktime_get();
-	}
+	} else if (suspend_profile_enabled)
+		calltime = ktime_get();
 
 	switch (state.event) {
 #ifdef CONFIG_SUSPEND
@@ -356,6 +359,7 @@ static int pm_noirq_op(struct device *dev,
 			dev_name(dev), error,
 			(unsigned long long)ktime_to_ns(delta) >> 10);
 	}
+	suspend_profile_device(dev, calltime, error);
 
 	return error;
 }
@@ -890,6 +894,7 @@ static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 		goto Unlock;
 
 	if (pm_wakeup_pending()) {
+		suspend_profile_abort("wakeup event");
 		async_error = -EBUSY;
 		goto Unlock;
 	}
@@ -25,6 +25,13 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
+#include <linux/log2.h>
+#include <linux/lzo.h>
+#include <linux/err.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,18 +40,75 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers never sleep on a lock. Each one reserves space by advancing
+ * 'w_reserve' with cmpxchg, pushes 'head' past whatever the reservation
+ * will overwrite, copies its entry in and then publishes it by advancing
+ * 'w_off', in reservation order. The offsets are free-running byte counts
+ * reduced with logger_offset() when the buffer is accessed; readers find
+ * out they were lapped by comparing their offset against 'head'.
+ *
+ * The mutex 'mutex' protects the list of readers and their offsets. The
+ * buffer, its size and the compressed tier only change with 'mutex' held
+ * and the writers frozen out, see freeze_writers().
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	struct mutex		mutex;	/* mutex protecting readers */
+	size_t			w_off;	/* end of the committed entries */
+	size_t			w_reserve; /* end of the reserved entries */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	int			frozen;	/* writers must wait on frozen_wq */
+	wait_queue_head_t	frozen_wq; /* writers waiting for a resize */
+	atomic_t		mapped;	/* number of mmaps of 'buffer' */
+	struct logger_tier	*tier;	/* compressed history, if any */
+	spinlock_t		tier_lock; /* lock protecting 'tier' */
+};
+
+/* bounds on the sizes that can be set at runtime */
+#define LOGGER_MIN_SIZE		(64 * 1024)
+#define LOGGER_MAX_SIZE		(16 * 1024 * 1024)
+#define LOGGER_TIER_MAX_SIZE	(64 * 1024 * 1024)
+
+/* entries pushed out of a log are compressed this many bytes at a time */
+#define LOGGER_TIER_CHUNK	(16 * 1024)
+
+/*
+ * struct logger_tier - compressed history behind a log
+ *
+ * Entries that writers push out of the ring are gathered in 'stage' and
+ * compressed LOGGER_TIER_CHUNK bytes at a time into 'buffer', itself a ring
+ * of chunks running from 'start' to 'end'. The staged entries always end at
+ * log->head, so the tier and the ring together hold one unbroken stretch
+ * of the log. The structure is protected by log->tier_lock.
+ */
+struct logger_tier {
+	unsigned char		*buffer; /* ring of compressed chunks */
+	size_t			size;	/* size of 'buffer', a power of two */
+	size_t			start;	/* offset of the oldest chunk */
+	size_t			end;	/* offset of the next chunk */
+	unsigned char		*stage;	/* entries not yet compressed */
+	size_t			stage_pos; /* log offset of the staged entries */
+	size_t			stage_len; /* length of the staged entries */
+	unsigned char		*cbuf;	/* compressor output */
+	void			*wrkmem; /* compressor scratch memory */
+};
+
+/*
+ * struct logger_tier_chunk - header of each chunk in a tier's buffer
+ *
+ * Chunks never wrap around the end of the buffer; a header with a zero
+ * 'ulen', or too little room left for a header, pads to the end instead.
+ */
+struct logger_tier_chunk {
+	size_t			pos;	/* log offset of the first entry */
+	__u32			ulen;	/* uncompressed length */
+	__u32			clen;	/* compressed length */
 };
 
 /*
@@ -57,11 +121,30 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			mode;	/* LOGGER_READ_ENTRY or _BATCH */
+	unsigned char		*tier_buf; /* chunk copied out of the tier */
+	size_t			tier_pos; /* log offset of 'tier_buf' */
+	size_t			tier_len; /* valid bytes in 'tier_buf' */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* tier_offset - returns index 'n' into the tier's buffer */
+#define tier_offset(n)		((n) & (tier->size - 1))
+
+/*
+ * struct logger_staging - per-cpu copy of a payload on its way into a log
+ *
+ * Payloads are pulled in from user-space before any space is reserved, so
+ * that the window between reserving and committing an entry never faults.
+ */
+struct logger_staging {
+	unsigned char		payload[LOGGER_ENTRY_MAX_PAYLOAD];
+};
+
+static DEFINE_PER_CPU(struct logger_staging, logger_staging);
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -89,12 +172,15 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * The entry may be overwritten while we look at it; callers must check
+ * reader_lapped() before trusting the result.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
+	off = logger_offset(off);
+
 	switch (log->size - off) {
 	case 1:
 		memcpy(&val, log->buffer + off, 1);
@@ -108,25 +194,278 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * reader_lapped - has a writer reserved the space at 'off' since the caller
+ * started looking at it?
+ *
+ * Writers move log->head past everything they are about to overwrite
+ * before they write, so anything read from 'off' is intact as long as
+ * 'head' has not passed it afterwards.
+ */
+static inline int reader_lapped(struct logger_log *log, size_t off)
+{
+	smp_rmb();
+	return (long)(ACCESS_ONCE(log->head) - off) > 0;
+}
+
+/*
+ * get_flat_entry_len - the length of the entry at 'p' in a linear buffer
+ */
+static inline __u32 get_flat_entry_len(const unsigned char *p)
+{
+	__u16 val;
+
+	memcpy(&val, p, 2);
+
+	return sizeof(struct logger_entry) + val;
+}
+
+/* tier_chunk - the chunk at offset 'p', or NULL if 'p' is padding */
+static struct logger_tier_chunk *tier_chunk(struct logger_tier *tier,
+					    size_t p)
+{
+	struct logger_tier_chunk *chunk;
+
+	if (tier->size - tier_offset(p) < sizeof(*chunk))
+		return NULL;
+	chunk = (void *)tier->buffer + tier_offset(p);
+	if (!chunk->ulen)
+		return NULL;
+
+	return chunk;
+}
+
+/* tier_next - the offset of whatever follows the chunk at offset 'p' */
+static size_t tier_next(struct logger_tier *tier, size_t p)
+{
+	struct logger_tier_chunk *chunk = tier_chunk(tier, p);
+
+	if (!chunk)
+		return p + tier->size - tier_offset(p);
+
+	return p + ALIGN(sizeof(*chunk) + chunk->clen, sizeof(size_t));
+}
+
+/*
+ * tier_oldest - the log offset of the oldest entry held by the tier
+ *
+ * Caller must hold log->tier_lock.
+ */
+static size_t tier_oldest(struct logger_tier *tier)
+{
+	struct logger_tier_chunk *chunk;
+	size_t p;
+
+	for (p = tier->start; p != tier->end; p = tier_next(tier, p)) {
+		chunk = tier_chunk(tier, p);
+		if (chunk)
+			return chunk->pos;
+	}
+
+	return tier->stage_pos;
+}
+
+/*
+ * tier_append - add the 'clen' bytes of compressed entries in tier->cbuf,
+ * which start at log offset 'pos', dropping the oldest chunks to make room.
+ *
+ * Caller must hold log->tier_lock.
+ */
+static void tier_append(struct logger_tier *tier, size_t pos, size_t ulen,
+			size_t clen)
+{
+	struct logger_tier_chunk *chunk;
+	size_t need = ALIGN(sizeof(*chunk) + clen, sizeof(size_t));
+	size_t room = tier->size - tier_offset(tier->end);
+	size_t pad = room < need ? room : 0;
+
+	while (tier->start != tier->end &&
+	       tier->end + pad + need - tier->start > tier->size)
+		tier->start = tier_next(tier, tier->start);
+
+	if (pad) {
+		if (pad >= sizeof(*chunk)) {
+			chunk = (void *)tier->buffer + tier_offset(tier->end);
+			chunk->ulen = 0;
+		}
+		tier->end += pad;
+		if (tier->start + pad == tier->end)
+			tier->start = tier->end;
+	}
+
+	chunk = (void *)tier->buffer + tier_offset(tier->end);
+	chunk->pos = pos;
+	chunk->ulen = ulen;
+	chunk->clen = clen;
+	memcpy(chunk + 1, tier->cbuf, clen);
+	tier->end += need;
+}
+
+/*
+ * tier_compress - compress the staged entries into a new chunk
+ *
+ * Caller must hold log->tier_lock.
+ */
+static void tier_compress(struct logger_tier *tier)
+{
+	size_t clen;
+	int ret;
+
+	if (!tier->stage_len)
+		return;
+
+	ret = lzo1x_1_compress(tier->stage, tier->stage_len, tier->cbuf,
+			       &clen, tier->wrkmem);
+	if (likely(ret == LZO_E_OK))
+		tier_append(tier, tier->stage_pos, tier->stage_len, clen);
+
+	tier->stage_pos += tier->stage_len;
+	tier->stage_len = 0;
+}
+
+/*
+ * tier_evict - stage the 'len' byte entry at 'off', which the ring is
+ * about to lose. 'off' must be log->head.
+ *
+ * Caller must hold log->tier_lock.
+ */
+static void tier_evict(struct logger_log *log, size_t off, size_t len)
+{
+	struct logger_tier *tier = log->tier;
+	size_t n;
+
+	if (tier->stage_len + len > LOGGER_TIER_CHUNK)
+		tier_compress(tier);
+
+	off = logger_offset(off);
+	n = min(len, log->size - off);
+	memcpy(tier->stage + tier->stage_len, log->buffer + off, n);
+	if (n != len)
+		memcpy(tier->stage + tier->stage_len + n, log->buffer, len - n);
+	tier->stage_len += len;
+}
+
+/*
+ * tier_fill - copy the chunk holding the entry at reader->r_off, or the
+ * first one after it, into the reader's buffer.
+ *
+ * Caller must hold log->tier_lock.
+ */
+static void tier_fill(struct logger_tier *tier, struct logger_reader *reader)
+{
+	struct logger_tier_chunk *chunk;
+	size_t p, ulen;
+
+	for (p = tier->start; p != tier->end; p = tier_next(tier, p)) {
+		chunk = tier_chunk(tier, p);
+		if (!chunk)
+			continue;
+		if ((long)(chunk->pos + chunk->ulen - reader->r_off) <= 0)
+			continue;
+
+		ulen = LOGGER_TIER_CHUNK;
+		if (lzo1x_decompress_safe((void *)(chunk + 1), chunk->clen,
+					  reader->tier_buf, &ulen) != LZO_E_OK
+		    || ulen != chunk->ulen)
+			continue;
+		reader->tier_pos = chunk->pos;
+		reader->tier_len = ulen;
+		return;
+	}
+
+	memcpy(reader->tier_buf, tier->stage, tier->stage_len);
+	reader->tier_pos = tier->stage_pos;
+	reader->tier_len = tier->stage_len;
+}
+
+/*
+ * tier_entry - returns the entry at reader->r_off, which the ring has
+ * already lost, out of the reader's copy of the tier chunk holding it.
+ * The reader is moved forward if that entry is gone from the tier too.
+ * Returns NULL if the tier has nothing from there on.
+ *
+ * Caller must hold log->mutex.
+ */
+static unsigned char *tier_entry(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	if (!reader->tier_buf) {
+		reader->tier_buf = vmalloc(LOGGER_TIER_CHUNK);
+		if (!reader->tier_buf)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	if (reader->r_off - reader->tier_pos >= reader->tier_len) {
+		spin_lock(&log->tier_lock);
+		tier_fill(log->tier, reader);
+		spin_unlock(&log->tier_lock);
+
+		if ((long)(reader->tier_pos - reader->r_off) > 0)
+			reader->r_off = reader->tier_pos;
+		if (reader->r_off - reader->tier_pos >= reader->tier_len)
+			return NULL;
+	}
+
+	return reader->tier_buf + (reader->r_off - reader->tier_pos);
+}
+
+/*
+ * reader_catch_up - move a reader that was lapped by the writers to the
+ * oldest entry still in the log, or in its compressed tier if it has one.
+ *
+ * Caller must hold log->mutex.
+ */
+static void reader_catch_up(struct logger_log *log,
+			    struct logger_reader *reader)
+{
+	size_t oldest;
+
+	if (!reader_lapped(log, reader->r_off))
+		return;
+
+	if (log->tier) {
+		spin_lock(&log->tier_lock);
+		oldest = tier_oldest(log->tier);
+		spin_unlock(&log->tier_lock);
+		if ((long)(oldest - reader->r_off) > 0)
+			reader->r_off = oldest;
+	} else
+		reader->r_off = ACCESS_ONCE(log->head);
+}
+
+/*
+ * reader_catch_up_ring - like reader_catch_up(), but skipping the tier, for
+ * those interfaces that only deal in the ring.
  *
  * Caller must hold log->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
+static void reader_catch_up_ring(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	if (reader_lapped(log, reader->r_off))
+		reader->r_off = ACCESS_ONCE(log->head);
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes at 'off' from 'log' into
+ * the user-space buffer 'buf'. Returns 'count' on success.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t off,
 				   char __user *buf,
 				   size_t count)
 {
 	size_t len;
 
+	off = logger_offset(off);
+
 	/*
 	 * We read from the log in two disjoint operations. First, we read from
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +476,72 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
+/*
+ * get_batch_len - returns the length of the run of whole entries starting
+ * with the 'len' byte entry at 'off' that fits in 'count' bytes and ends
+ * no later than 'w_off'.
+ *
+ * The lengths are only trustworthy if the caller finds the reader was not
+ * lapped after copying the run out.
+ */
+static size_t get_batch_len(struct logger_log *log, size_t off, size_t w_off,
+			    size_t len, size_t count)
+{
+	size_t next;
+
+	while ((long)(w_off - (off + len)) > 0) {
+		next = get_entry_len(log, off + len);
+		if (len + next > count)
+			break;
+		len += next;
+	}
+
+	return len;
+}
+
+/*
+ * read_tier_to_user - reads the entry, or in batch mode the entries, at the
+ * reader's offset from the compressed tier into the user-space buffer 'buf'.
+ * Returns zero if the tier holds nothing at that offset any more.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t read_tier_to_user(struct logger_log *log,
+				 struct logger_reader *reader,
+				 char __user *buf, size_t count)
+{
+	unsigned char *entry;
+	size_t left, len, next;
+
+	entry = tier_entry(log, reader);
+	if (IS_ERR_OR_NULL(entry))
+		return PTR_ERR(entry);
+
+	left = reader->tier_len - (reader->r_off - reader->tier_pos);
+	len = get_flat_entry_len(entry);
+	if (count < len)
+		return -EINVAL;
+
+	if (reader->mode == LOGGER_READ_BATCH) {
+		while (len < left) {
+			next = get_flat_entry_len(entry + len);
+			if (len + next > count)
+				break;
+			len += next;
+		}
+	}
+
+	if (copy_to_user(buf, entry, len))
+		return -EFAULT;
+
+	reader->r_off += len;
+
+	return len;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -149,7 +549,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in LOGGER_READ_BATCH mode
+ * 	  as many whole entries as fit in the buffer
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -160,6 +561,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
 	ssize_t ret;
+	size_t len, w_off;
 	DEFINE_WAIT(wait);
 
 start:
@@ -167,7 +569,8 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
+		reader_catch_up(log, reader);
+		ret = (ACCESS_ONCE(log->w_off) == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -191,21 +594,47 @@ start:
 
 	mutex_lock(&log->mutex);
 
+retry:
+	reader_catch_up(log, reader);
+
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	w_off = ACCESS_ONCE(log->w_off);
+	if (unlikely(w_off == reader->r_off)) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
+	/* the ring no longer has it, but the compressed tier does */
+	if (log->tier && reader_lapped(log, reader->r_off)) {
+		ret = read_tier_to_user(log, reader, buf, count);
+		if (!ret)
+			goto retry;
+		goto out;
+	}
+	smp_rmb();
+
 	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
+	len = get_entry_len(log, reader->r_off);
+	if (reader_lapped(log, reader->r_off))
+		goto retry;
+	if (count < len) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* entries are contiguous, so a batch is a single larger copy */
+	if (reader->mode == LOGGER_READ_BATCH)
+		len = get_batch_len(log, reader->r_off, w_off, len, count);
+
+	/* get exactly 'len' bytes worth of entries from the log */
+	ret = do_read_log_to_user(log, reader->r_off, buf, len);
+	if (ret < 0)
+		goto out;
+
+	/* a writer lapped us while we were copying, so the copy is torn */
+	if (reader_lapped(log, reader->r_off))
+		goto retry;
+	reader->r_off += len;
 
 out:
 	mutex_unlock(&log->mutex);
@@ -214,106 +643,96 @@ out:
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * advance_head - pull log->head forward past everything a writer is about
+ * to overwrite when it fills the log up to 'end'.
  *
- * Caller must hold log->mutex.
- */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
-{
-	size_t count = 0;
-
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
-
-	return 0;
-}
-
-/*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * Writers race here, so the entry at 'head' may be overwritten by the
+ * time we read its length; the cmpxchg then fails against the head moved
+ * by the writer that got there first and we look again.
  *
- * The caller needs to hold log->mutex.
+ * Entries between reservation and commit are never more than one per cpu
+ * and LOGGER_ENTRY_MAX_LEN each, so everything walked here is committed as
+ * long as the log is comfortably larger than that.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void advance_head(struct logger_log *log, size_t end)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	size_t head, len;
+
+	if (!log->tier) {
+		while (1) {
+			head = ACCESS_ONCE(log->head);
+			if (end - head <= log->size)
+				break;
+			cmpxchg(&log->head, head,
+				head + get_entry_len(log, head));
+		}
+		return;
+	}
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	/*
+	 * With a tier, each entry has to be staged before head moves past
+	 * it and anyone writes over it, and in order, so writers take turns.
+	 */
+	if (end - ACCESS_ONCE(log->head) <= log->size)
+		return;
+
+	spin_lock(&log->tier_lock);
+	while (end - log->head > log->size) {
+		head = log->head;
+		len = get_entry_len(log, head);
+		tier_evict(log, head, len);
+		smp_wmb();
+		ACCESS_ONCE(log->head) = head + len;
+	}
+	spin_unlock(&log->tier_lock);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at 'pos'
  *
- * The caller needs to hold log->mutex.
+ * The caller must have reserved the space.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t pos,
+			 const void *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * copy_payload_from_user - gathers 'count' bytes of payload from the
+ * vector 'iov' into 'buf'. With 'atomic' set this must not sleep and fails
+ * with -EFAULT if any of the user pages is not resident.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int copy_payload_from_user(void *buf, const struct iovec *iov,
+				  unsigned long nr_segs, size_t count,
+				  int atomic)
 {
-	size_t len;
+	size_t done = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	while (nr_segs-- > 0 && done < count) {
+		size_t len = min_t(size_t, iov->iov_len, count - done);
+		unsigned long left;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (atomic)
+			left = __copy_from_user_inatomic(buf + done,
+							 iov->iov_base, len);
+		else
+			left = copy_from_user(buf + done, iov->iov_base, len);
+		if (left)
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
+		iov++;
+		done += len;
+	}
 
-	return count;
+	return 0;
 }
 
 /*
@@ -325,10 +744,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	void *payload;
+	void *bounce = NULL;
+	size_t pos, len;
+	int ret;
 
 	now = current_kernel_time();
 
@@ -337,48 +758,82 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * Stage the payload on this cpu. Preemption stays off from here until
+	 * the entry is committed, so that writers waiting to commit behind us
+	 * only ever spin for the length of a memcpy.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+again:
+	preempt_disable();
+	if (likely(!bounce)) {
+		payload = __get_cpu_var(logger_staging).payload;
+		pagefault_disable();
+		ret = copy_payload_from_user(payload, iov, nr_segs,
+					     header.len, 1);
+		pagefault_enable();
+		if (unlikely(ret)) {
+			/* the payload is not resident, fault it in the slow way */
+			preempt_enable();
+			bounce = kmalloc(header.len, GFP_KERNEL);
+			if (!bounce)
+				return -ENOMEM;
+			ret = copy_payload_from_user(bounce, iov, nr_segs,
+						     header.len, 0);
+			if (ret) {
+				kfree(bounce);
+				return ret;
+			}
+			goto again;
+		}
+	} else
+		payload = bounce;
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	/* the log is being resized, wait until it is done */
+	if (unlikely(ACCESS_ONCE(log->frozen))) {
+		preempt_enable();
+		wait_event(log->frozen_wq, !ACCESS_ONCE(log->frozen));
+		goto again;
+	}
+	smp_rmb();
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	/* reserve */
+	len = sizeof(struct logger_entry) + header.len;
+	do {
+		pos = ACCESS_ONCE(log->w_reserve);
+	} while (cmpxchg(&log->w_reserve, pos, pos + len) != pos);
 
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+	/*
+	 * Move the start head, and with it any reader, off the entries we
+	 * are about to clobber before clobbering them.
+	 */
+	advance_head(log, pos + len);
+	smp_wmb();
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos + sizeof(struct logger_entry), payload,
+		     header.len);
 
-		iov++;
-		ret += nr;
-	}
+	/* commit, in reservation order */
+	while (ACCESS_ONCE(log->w_off) != pos)
+		cpu_relax();
+	smp_wmb();
+	log->w_off = pos + len;
 
-	mutex_unlock(&log->mutex);
+	preempt_enable();
+	kfree(bounce);
 
 	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
-	return ret;
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -409,10 +864,19 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
+		reader->mode = LOGGER_READ_ENTRY;
+		reader->tier_buf = NULL;
+		reader->tier_pos = 0;
+		reader->tier_len = 0;
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
 		reader->r_off = log->head;
+		if (log->tier) {
+			spin_lock(&log->tier_lock);
+			reader->r_off = tier_oldest(log->tier);
+			spin_unlock(&log->tier_lock);
+		}
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -432,7 +896,12 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		mutex_lock(&log->mutex);
 		list_del(&reader->list);
+		mutex_unlock(&log->mutex);
+		vfree(reader->tier_buf);
 		kfree(reader);
 	}
 
@@ -463,17 +932,234 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	reader_catch_up(log, reader);
+	if (ACCESS_ONCE(log->w_off) != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the ring buffer read-only for readers. Where to read from it is
+ * handed out by LOGGER_GET_CURSOR and LOGGER_ADVANCE_CURSOR.
+ */
+static void logger_vma_open(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_inc(&log->mapped);
+}
+
+static void logger_vma_close(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_dec(&log->mapped);
+}
+
+static const struct vm_operations_struct logger_vm_ops = {
+	.open = logger_vma_open,
+	.close = logger_vma_close,
+};
+
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	/*
+	 * log->mutex cannot be taken under mmap_sem, so keep out of the way
+	 * of a resize by hand: it freezes the writers and then checks for
+	 * mappings, we register the mapping and then check for a freeze.
+	 */
+	atomic_inc(&log->mapped);
+	smp_mb__after_atomic_inc();
+	if (ACCESS_ONCE(log->frozen)) {
+		ret = -EBUSY;
+		goto err;
+	}
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != log->size) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = remap_vmalloc_range(vma, log->buffer, 0);
+	if (ret)
+		goto err;
+
+	vma->vm_ops = &logger_vm_ops;
+	vma->vm_private_data = log;
+
+	return 0;
+
+err:
+	atomic_dec(&log->mapped);
+	return ret;
+}
+
+/*
+ * freeze_writers - keep new writers out of the log and wait for those
+ * already in it to finish. Writers only touch the log with preemption
+ * disabled, so a sched RCU grace period covers them.
+ *
+ * Caller must hold log->mutex, which keeps the readers out.
+ */
+static void freeze_writers(struct logger_log *log)
+{
+	log->frozen = 1;
+	synchronize_sched();
+}
+
+static void thaw_writers(struct logger_log *log)
+{
+	smp_wmb();
+	log->frozen = 0;
+	wake_up_all(&log->frozen_wq);
+}
+
+/*
+ * logger_resize - move 'log' to a new buffer of 'size' bytes, keeping as
+ * many of the newest entries as fit. Entries that do not fit go to the
+ * compressed tier, if there is one.
+ *
+ * Caller must hold log->mutex.
+ */
+static int logger_resize(struct logger_log *log, size_t size)
+{
+	unsigned char *buffer, *old;
+	size_t pos, off, n;
+
+	if (size < LOGGER_MIN_SIZE || size > LOGGER_MAX_SIZE ||
+	    !is_power_of_2(size))
+		return -EINVAL;
+
+	if (size == log->size)
+		return 0;
+
+	buffer = vmalloc_user(size);
+	if (!buffer)
+		return -ENOMEM;
+
+	freeze_writers(log);
+	if (atomic_read(&log->mapped)) {
+		thaw_writers(log);
+		vfree(buffer);
+		return -EBUSY;
+	}
+
+	if (size < log->size)
+		advance_head(log, log->w_off + log->size - size);
+
+	/* offsets carry on where they were; only their place in memory moves */
+	for (pos = log->head; pos != log->w_off; pos += n) {
+		off = logger_offset(pos);
+		n = min(log->w_off - pos, log->size - off);
+		n = min(n, size - (pos & (size - 1)));
+		memcpy(buffer + (pos & (size - 1)), log->buffer + off, n);
+	}
+
+	old = log->buffer;
+	log->buffer = buffer;
+	log->size = size;
+	thaw_writers(log);
+
+	vfree(old);
+
+	printk(KERN_INFO "logger: resized log '%s' to %luK\n",
+	       log->misc.name, (unsigned long) size >> 10);
+
+	return 0;
+}
+
+static void tier_free(struct logger_tier *tier)
+{
+	if (!tier)
+		return;
+
+	vfree(tier->wrkmem);
+	vfree(tier->cbuf);
+	vfree(tier->stage);
+	vfree(tier->buffer);
+	kfree(tier);
+}
+
+static struct logger_tier *tier_alloc(size_t size)
+{
+	struct logger_tier *tier;
+
+	tier = kzalloc(sizeof(*tier), GFP_KERNEL);
+	if (!tier)
+		return NULL;
+
+	tier->size = size;
+	tier->buffer = vmalloc(size);
+	tier->stage = vmalloc(LOGGER_TIER_CHUNK);
+	tier->cbuf = vmalloc(lzo1x_worst_compress(LOGGER_TIER_CHUNK));
+	tier->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!tier->buffer || !tier->stage || !tier->cbuf || !tier->wrkmem) {
+		tier_free(tier);
+		return NULL;
+	}
+
+	return tier;
+}
+
+/*
+ * logger_set_tier - give 'log' a compressed tier of 'size' bytes, or take
+ * it away if 'size' is zero. Any history in the old tier is dropped.
+ *
+ * Caller must hold log->mutex.
+ */
+static int logger_set_tier(struct logger_log *log, size_t size)
+{
+	struct logger_tier *tier = NULL;
+	struct logger_tier *old;
+	struct logger_reader *reader;
+
+	if (size) {
+		if (size < LOGGER_MIN_SIZE || size > LOGGER_TIER_MAX_SIZE ||
+		    !is_power_of_2(size))
+			return -EINVAL;
+
+		tier = tier_alloc(size);
+		if (!tier)
+			return -ENOMEM;
+	}
+
+	freeze_writers(log);
+	spin_lock(&log->tier_lock);
+	old = log->tier;
+	if (tier)
+		tier->stage_pos = log->head;
+	log->tier = tier;
+	spin_unlock(&log->tier_lock);
+	thaw_writers(log);
+
+	list_for_each_entry(reader, &log->readers, list)
+		reader->tier_len = 0;
+	tier_free(old);
+
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_cursor cursor;
+	unsigned char *entry;
+	size_t w_off, head, len;
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
@@ -488,10 +1174,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		reader_catch_up(log, reader);
+		ret = ACCESS_ONCE(log->w_off) - reader->r_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,21 +1183,132 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
+		do {
+			reader_catch_up(log, reader);
+			if (ACCESS_ONCE(log->w_off) == reader->r_off) {
+				ret = 0;
+				break;
+			}
+			if (log->tier && reader_lapped(log, reader->r_off)) {
+				entry = tier_entry(log, reader);
+				if (IS_ERR(entry)) {
+					ret = PTR_ERR(entry);
+					break;
+				}
+				if (entry) {
+					ret = get_flat_entry_len(entry);
+					break;
+				}
+				continue;
+			}
+			smp_rmb();
 			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		} while (reader_lapped(log, reader->r_off));
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
+		w_off = ACCESS_ONCE(log->w_off);
+		spin_lock(&log->tier_lock);
+		do {
+			head = ACCESS_ONCE(log->head);
+			if ((long)(w_off - head) <= 0)
+				break;
+		} while (cmpxchg(&log->head, head, w_off) != head);
+		if (log->tier) {
+			log->tier->start = log->tier->end;
+			log->tier->stage_pos = ACCESS_ONCE(log->head);
+			log->tier->stage_len = 0;
+		}
+		spin_unlock(&log->tier_lock);
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			reader->r_off = w_off;
 		ret = 0;
 		break;
+	case LOGGER_SET_READ_MODE:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		if (arg != LOGGER_READ_ENTRY && arg != LOGGER_READ_BATCH) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		reader->mode = arg;
+		ret = 0;
+		break;
+	case LOGGER_GET_CURSOR:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader_catch_up_ring(log, reader);
+		cursor.off = logger_offset(reader->r_off);
+		cursor.len = ACCESS_ONCE(log->w_off) - reader->r_off;
+		ret = 0;
+		if (copy_to_user((void __user *)arg, &cursor, sizeof(cursor)))
+			ret = -EFAULT;
+		break;
+	case LOGGER_ADVANCE_CURSOR:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		if (reader_lapped(log, reader->r_off)) {
+			reader_catch_up_ring(log, reader);
+			ret = -EAGAIN;
+			break;
+		}
+		w_off = ACCESS_ONCE(log->w_off);
+		if (arg > w_off - reader->r_off) {
+			ret = -EINVAL;
+			break;
+		}
+		/* only whole entries can be consumed; the lengths walked
+		 * only count if the reader was not lapped meanwhile */
+		len = get_batch_len(log, reader->r_off, w_off, 0, arg);
+		if (reader_lapped(log, reader->r_off)) {
+			reader_catch_up_ring(log, reader);
+			ret = -EAGAIN;
+			break;
+		}
+		if (len != arg) {
+			ret = -EINVAL;
+			break;
+		}
+		reader->r_off += arg;
+		ret = 0;
+		break;
+	case LOGGER_SET_LOG_BUF_SIZE:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		ret = logger_resize(log, arg);
+		break;
+	case LOGGER_GET_TIER_SIZE:
+		ret = log->tier ? log->tier->size : 0;
+		break;
+	case LOGGER_SET_TIER_SIZE:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		ret = logger_set_tier(log, arg);
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -526,6 +1321,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -533,14 +1329,15 @@ static const struct file_operations logger_fops = {
 };
 
 /*
- * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * Defines a log structure with name 'NAME' and an initial size of 'SIZE'
+ * bytes, which must be a power of two, greater than LOGGER_ENTRY_MAX_LEN
+ * times the number of cpus that can be writing at once, and less than
+ * LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is allocated at init time
+ * and can be resized with LOGGER_SET_LOG_BUF_SIZE.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
+	.buffer = NULL, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -551,8 +1348,14 @@ static struct logger_log VAR = { \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
 	.w_off = 0, \
+	.w_reserve = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.frozen = 0, \
+	.frozen_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .frozen_wq), \
+	.mapped = ATOMIC_INIT(0), \
+	.tier = NULL, \
+	.tier_lock = __SPIN_LOCK_UNLOCKED(VAR .tier_lock), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -577,10 +1380,19 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->buffer = vmalloc_user(log->size);
+	if (unlikely(!log->buffer)) {
+		printk(KERN_ERR "logger: failed to allocate buffer "
+		       "for log '%s'!\n", log->misc.name);
+		return -ENOMEM;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(log->buffer);
+		log->buffer = NULL;
 		return ret;
 	}
 
@@ -30,6 +30,21 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_cursor - where a reader stands in the mmap view of a log
+ *
+ * The view is the log's ring buffer, mapped read-only at offset zero. The
+ * 'len' bytes of whole entries starting at 'off' may wrap around its end.
+ * Hand the number of bytes consumed to LOGGER_ADVANCE_CURSOR; it fails
+ * with EINVAL unless they end on an entry boundary. If it fails with
+ * EAGAIN the writers lapped the reader while it was looking and what it
+ * read must be thrown away.
+ */
+struct logger_cursor {
+	__u32		off;	/* offset of the next entry in the view */
+	__u32		len;	/* bytes available from 'off' */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +60,15 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 5) /* read() mode */
+#define LOGGER_GET_CURSOR		_IOR(__LOGGERIO, 6, struct logger_cursor)
+#define LOGGER_ADVANCE_CURSOR		_IO(__LOGGERIO, 7) /* consume bytes */
+#define LOGGER_SET_LOG_BUF_SIZE		_IO(__LOGGERIO, 8) /* resize log */
+#define LOGGER_GET_TIER_SIZE		_IO(__LOGGERIO, 9) /* compressed tier */
+#define LOGGER_SET_TIER_SIZE		_IO(__LOGGERIO, 10) /* 0 disables */
+
+/* read() modes for LOGGER_SET_READ_MODE */
+#define LOGGER_READ_ENTRY		0	/* one entry per read() */
+#define LOGGER_READ_BATCH		1	/* as many entries as fit */
 
 #endif /* _LINUX_LOGGER_H */
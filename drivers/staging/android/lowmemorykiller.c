@@ -16,6 +16,20 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Rather than walking every process each time it is asked to shrink, the
+ * driver keeps processes in one bucket per oom_adj value, each sorted by
+ * the rss last seen for the process, and kills the head of the highest
+ * non-empty bucket at or above the threshold.
+ *
+ * Setting /sys/module/lowmemorykiller/parameters/pressure to 1 makes the
+ * driver look ahead. Each call from vmscan, at most once every sample_ms,
+ * folds the change in free pages, file pages and pages reclaimed into
+ * moving averages. Thresholds are then checked against the free and file
+ * counts projected predict_ms ahead. A dip below a threshold is left alone
+ * if reclaim at its current rate would refill it within predict_ms. When
+ * a threshold is crossed, up to 'batch' processes are killed in one pass,
+ * enough to cover the projected shortfall.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +49,14 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/vmstat.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/lowmemorykiller.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,9 +74,46 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
-static struct task_struct *lowmem_deathpending;
+static uint32_t lowmem_pressure;
+static uint32_t lowmem_sample_ms = 20;
+static uint32_t lowmem_predict_ms = 500;
+static uint32_t lowmem_batch = 4;
+
+#define LOWMEM_BATCH_MAX	8
+
+/*
+ * Only one shrinker call selects and kills at a time, the others (kswapd
+ * and direct reclaimers on other CPUs) back off while it does.
+ */
+static DEFINE_MUTEX(lowmem_kill_lock);
+
+/* protected by lowmem_bucket_lock */
+static struct task_struct *lowmem_deathpending[LOWMEM_BATCH_MAX];
+static int lowmem_deathpending_count;
 static unsigned long lowmem_deathpending_timeout;
 
+/* moving averages in pages per second, updated by lowmem_sample() */
+static DEFINE_SPINLOCK(lowmem_sample_lock);
+static bool lowmem_sample_valid;
+static unsigned long lowmem_sample_stamp;
+static int lowmem_last_free;
+static int lowmem_last_file;
+static unsigned long lowmem_last_reclaimed;
+static long lowmem_free_slope;
+static long lowmem_file_slope;
+static long lowmem_reclaim_rate;
+
+/*
+ * Thread group leaders by oom_adj, each bucket sorted by descending
+ * task->lowmem_rss. A leader is taken off its bucket from do_exit(), once
+ * PF_EXITING is set, so a task found on a bucket still holds its own
+ * reference and its signal_struct. The irqsave locking is kept for the
+ * oom_adj notifier callers.
+ */
+#define LOWMEM_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -62,38 +121,307 @@ static unsigned long lowmem_deathpending_timeout;
 	} while (0)
 
 static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
-static struct notifier_block task_nb = {
-	.notifier_call	= task_notify_func,
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
 };
 
+/* caller holds lowmem_bucket_lock */
+static void lowmem_bucket_add(struct task_struct *p, int oom_adj)
+{
+	struct list_head *bucket = &lowmem_buckets[oom_adj - OOM_DISABLE];
+	struct task_struct *t;
+
+	list_for_each_entry(t, bucket, lowmem_node)
+		if (t->lowmem_rss <= p->lowmem_rss)
+			break;
+	list_add_tail(&p->lowmem_node, &t->lowmem_node);
+}
+
+/*
+ * Put the thread group leader of 'p' in the bucket for its current
+ * oom_adj, with 'rss' as its size. Called with the task or its mm pinned.
+ * A leader that is exiting is left out, checking PF_EXITING under the
+ * lock orders this against lowmem_task_exit().
+ */
+static void lowmem_bucket_update(struct task_struct *p, unsigned long rss)
+{
+	struct task_struct *leader = p->group_leader;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	list_del_init(&leader->lowmem_node);
+	if (!(leader->flags & PF_EXITING)) {
+		leader->lowmem_rss = rss;
+		lowmem_bucket_add(leader, leader->signal->oom_adj);
+	}
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+/* a thread group leader has released its mm in do_exit() */
+static void lowmem_task_exit(struct task_struct *task)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	for (i = 0; i < lowmem_deathpending_count; i++) {
+		if (lowmem_deathpending[i] == task) {
+			lowmem_deathpending[i] =
+				lowmem_deathpending[--lowmem_deathpending_count];
+			break;
+		}
+	}
+	list_del_init(&task->lowmem_node);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+/*
+ * Called when a process is created, when its oom_adj is written, when
+ * a thread other than the leader execs and when a leader exits. 'task'
+ * is pinned by the caller and so is its mm, if it has one.
+ */
 static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
 
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
+	if (val == OOM_ADJ_NOTIFY_EXIT) {
+		lowmem_task_exit(task);
+		return NOTIFY_OK;
+	}
+
+	/* already killed, keep it out of the way of the next selection */
+	if (fatal_signal_pending(task))
+		return NOTIFY_OK;
+
+	lowmem_bucket_update(task, task->mm ? get_mm_rss(task->mm) : 0);
 
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+/*
+ * lowmem_select - pick the process to kill for 'min_adj'
+ *
+ * Takes the head of the highest non-empty bucket, measures its rss again
+ * and puts it back in place. Returns it with a reference held if it still
+ * has memory to give back, or looks again if not. A process found empty
+ * sinks to the tail of its bucket, so the search ends once the head of
+ * each bucket has nothing left.
+ */
+static struct task_struct *lowmem_select(int min_adj, int *oom_adj,
+					 int *tasksize)
 {
+	struct list_head *bucket;
 	struct task_struct *p;
-	struct task_struct *selected = NULL;
+	unsigned long flags;
+	unsigned long rss;
+	int adj;
+
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj; adj--) {
+		bucket = &lowmem_buckets[adj - OOM_DISABLE];
+		while (1) {
+			spin_lock_irqsave(&lowmem_bucket_lock, flags);
+			if (list_empty(bucket)) {
+				spin_unlock_irqrestore(&lowmem_bucket_lock,
+						       flags);
+				break;
+			}
+			p = list_first_entry(bucket, struct task_struct,
+					     lowmem_node);
+			if (!p->lowmem_rss) {
+				spin_unlock_irqrestore(&lowmem_bucket_lock,
+						       flags);
+				break;
+			}
+			/* can't happen while exits unlink first, but be safe */
+			if (WARN_ON(!atomic_inc_not_zero(&p->usage))) {
+				list_del_init(&p->lowmem_node);
+				spin_unlock_irqrestore(&lowmem_bucket_lock,
+						       flags);
+				continue;
+			}
+			spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+			task_lock(p);
+			rss = p->mm ? get_mm_rss(p->mm) : 0;
+			task_unlock(p);
+
+			/* off the bucket means it exited meanwhile, skip it */
+			spin_lock_irqsave(&lowmem_bucket_lock, flags);
+			if (list_empty(&p->lowmem_node)) {
+				spin_unlock_irqrestore(&lowmem_bucket_lock,
+						       flags);
+				put_task_struct(p);
+				continue;
+			}
+			*oom_adj = p->signal->oom_adj;
+			list_del(&p->lowmem_node);
+			p->lowmem_rss = rss;
+			lowmem_bucket_add(p, *oom_adj);
+			spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+			if (rss > 0 && *oom_adj >= min_adj) {
+				*tasksize = rss;
+				return p;
+			}
+			put_task_struct(p);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Record 'p' as killed and take it off its bucket so the rest of the
+ * batch goes to other processes. 'first' starts a new batch.
+ */
+static void lowmem_mark_dying(struct task_struct *p, bool first)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	if (first)
+		lowmem_deathpending_count = 0;
+	if (lowmem_deathpending_count < LOWMEM_BATCH_MAX)
+		lowmem_deathpending[lowmem_deathpending_count++] = p;
+	list_del_init(&p->lowmem_node);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+static unsigned long lowmem_reclaimed(void)
+{
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	unsigned long sum = 0;
+	int cpu;
+	int i;
+
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = 0; i < MAX_NR_ZONES; i++)
+			sum += this->event[PGSTEAL_NORMAL - ZONE_NORMAL + i];
+	}
+	return sum;
+#else
+	return 0;
+#endif
+}
+
+static long lowmem_ewma(long avg, long sample)
+{
+	return (avg * 3 + sample) / 4;
+}
+
+/*
+ * Fold the change since the last sample into the moving averages. A gap
+ * of more than a second means vmscan has left us alone for a while, so
+ * start over rather than average in a stale slope.
+ */
+static void lowmem_sample(int other_free, int other_file)
+{
+	unsigned long now = jiffies;
+	unsigned long reclaimed;
+	long dt;
+
+	if (!spin_trylock(&lowmem_sample_lock))
+		return;
+
+	dt = now - lowmem_sample_stamp;
+	if (lowmem_sample_valid &&
+	    (dt <= 0 || dt < msecs_to_jiffies(lowmem_sample_ms)))
+		goto out;
+
+	reclaimed = lowmem_reclaimed();
+	if (lowmem_sample_valid && dt <= HZ) {
+		lowmem_free_slope = lowmem_ewma(lowmem_free_slope,
+			(long)(other_free - lowmem_last_free) * HZ / dt);
+		lowmem_file_slope = lowmem_ewma(lowmem_file_slope,
+			(long)(other_file - lowmem_last_file) * HZ / dt);
+		lowmem_reclaim_rate = lowmem_ewma(lowmem_reclaim_rate,
+			max(0L, (long)(reclaimed - lowmem_last_reclaimed)) *
+			HZ / dt);
+	} else {
+		lowmem_free_slope = 0;
+		lowmem_file_slope = 0;
+		lowmem_reclaim_rate = 0;
+	}
+	lowmem_last_free = other_free;
+	lowmem_last_file = other_file;
+	lowmem_last_reclaimed = reclaimed;
+	lowmem_sample_stamp = now;
+	lowmem_sample_valid = true;
+out:
+	spin_unlock(&lowmem_sample_lock);
+}
+
+/* pages expected to change in predict_ms at 'rate' pages per second */
+static long lowmem_ahead(long rate)
+{
+	return div_s64((s64)rate * lowmem_predict_ms, MSEC_PER_SEC);
+}
+
+/*
+ * Pressure mode version of the threshold check. Returns the min_adj to
+ * kill at, or OOM_ADJUST_MAX + 1, and in 'need' the number of pages the
+ * kills should give back to get above the threshold that was crossed.
+ */
+static int lowmem_predict(int array_size, int other_free, int other_file,
+			  int *need)
+{
+	long free_slope = lowmem_free_slope;
+	long file_slope = lowmem_file_slope;
+	long reclaim_rate = lowmem_reclaim_rate;
+	long proj_free = max(0L, other_free + lowmem_ahead(free_slope));
+	long proj_file = max(0L, other_file + lowmem_ahead(file_slope));
+	long refill = lowmem_ahead(reclaim_rate);
+	int min_adj = OOM_ADJUST_MAX + 1;
+	long minfree;
+	int i;
+
+	for (i = 0; i < array_size; i++) {
+		minfree = lowmem_minfree[i];
+		if (proj_free < minfree && proj_file < minfree) {
+			min_adj = lowmem_adj[i];
+			*need = minfree - proj_free;
+			break;
+		}
+		if (other_free < minfree && other_file < minfree &&
+		    refill < minfree - other_free) {
+			min_adj = lowmem_adj[i];
+			*need = minfree - other_free;
+			break;
+		}
+	}
+	if (min_adj != OOM_ADJUST_MAX + 1)
+		trace_lowmemory_pressure(other_free, other_file, free_slope,
+					 file_slope, reclaim_rate, min_adj,
+					 *need);
+	return min_adj;
+}
+
+static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
+	int need = 0;
+	int freed = 0;
+	int batch = 1;
+	int killed = 0;
+	ktime_t start;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
+	if (lowmem_pressure)
+		lowmem_sample(other_free, other_file);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -101,7 +429,7 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
+	if (lowmem_deathpending_count &&
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
@@ -109,11 +437,17 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
+	if (lowmem_pressure) {
+		min_adj = lowmem_predict(array_size, other_free, other_file,
+					 &need);
+		batch = clamp_t(int, lowmem_batch, 1, LOWMEM_BATCH_MAX);
+	} else {
+		for (i = 0; i < array_size; i++) {
+			if (other_free < lowmem_minfree[i] &&
+			    other_file < lowmem_minfree[i]) {
+				min_adj = lowmem_adj[i];
+				break;
+			}
 		}
 	}
 	if (nr_to_scan > 0)
@@ -129,55 +463,43 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+	if (!mutex_trylock(&lowmem_kill_lock))
+		return 0;
+	/* whoever held the lock may have just killed for us */
+	if (lowmem_deathpending_count &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		mutex_unlock(&lowmem_kill_lock);
+		return 0;
 	}
-	if (selected) {
+	while (killed < batch) {
+		start = ktime_get();
+		selected = lowmem_select(min_adj, &selected_oom_adj,
+					 &selected_tasksize);
+		if (!selected)
+			break;
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
+		trace_lowmemory_kill(selected, selected_oom_adj,
+				     selected_tasksize, min_adj, other_free,
+				     other_file, ktime_to_ns(ktime_sub(ktime_get(),
+								      start)));
+		lowmem_mark_dying(selected, !killed);
 		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
+		send_sig(SIGKILL, selected, 0);
 		rem -= selected_tasksize;
+		freed += selected_tasksize;
+		put_task_struct(selected);
+		killed++;
+		if (freed >= need)
+			break;
 	}
+	mutex_unlock(&lowmem_kill_lock);
+	if (killed > 1)
+		lowmem_print(2, "killed %d processes, size %d, need %d\n",
+			     killed, freed, need);
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,7 +510,23 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
-	task_free_register(&task_nb);
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	register_oom_adj_notifier(&oom_adj_nb);
+
+	/* pick up whatever was started before us, once */
+	read_lock(&tasklist_lock);
+	for_each_process(p) {
+		task_lock(p);
+		lowmem_bucket_update(p, p->mm ? get_mm_rss(p->mm) : 0);
+		task_unlock(p);
+	}
+	read_unlock(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -196,7 +534,7 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
-	task_free_unregister(&task_nb);
+	unregister_oom_adj_notifier(&oom_adj_nb);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +543,10 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure, lowmem_pressure, uint, S_IRUGO | S_IWUSR);
+module_param_named(sample_ms, lowmem_sample_ms, uint, S_IRUGO | S_IWUSR);
+module_param_named(predict_ms, lowmem_predict_ms, uint, S_IRUGO | S_IWUSR);
+module_param_named(batch, lowmem_batch, uint, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
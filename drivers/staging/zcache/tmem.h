@@ -63,7 +63,7 @@
 struct tmem_hashbucket {
 	struct rb_root obj_rb_root;
 	spinlock_t lock;
-};
+} ____cacheline_aligned_in_smp;
 
 struct tmem_pool {
 	void *client; /* "up" for some clients, avoids table lookup */
@@ -8,9 +8,10 @@
  * and, thus indirectly, for cleancache and frontswap.  Zcache includes two
  * page-accessible memory [1] interfaces, both utilizing lzo1x compression:
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
- * 2) xvmalloc is used for persistent pages.
- * Xvmalloc (based on the TLSF allocator) has very low fragmentation
- * so maximizes space efficiency, while zbud allows pairs (and potentially,
+ * 2) zsmalloc is used for persistent pages.
+ * Zsmalloc packs objects of similar size across page boundaries and can
+ * compact its pools, so maximizes space efficiency, while zbud allows
+ * pairs (and potentially,
  * in the future, more than a pair of) compressed pages to be closely linked
  * so that reclaiming can be done via the kernel's physical-page-oriented
  * "shrinker" interface.
@@ -23,13 +24,15 @@
 #include <linux/highmem.h>
 #include <linux/list.h>
 #include <linux/lzo.h>
+#include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include "tmem.h"
+#include "zcache.h"
 
-#include "../zram/xvmalloc.h" /* if built in drivers/staging */
+#include "../zsmalloc/zsmalloc.h" /* if built in drivers/staging */
 
 #if (!defined(CONFIG_CLEANCACHE) && !defined(CONFIG_FRONTSWAP))
 #error "zcache is useless without CONFIG_CLEANCACHE or CONFIG_FRONTSWAP"
@@ -64,6 +67,10 @@
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * The lists are per-cpu, so puts on different cpus don't contend for a
+ * lock: a zbpg is listed on the cpu that took it into use, and goes back
+ * to that cpu's unused list when it empties.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -82,6 +89,7 @@ struct zbud_hdr {
 struct zbud_page {
 	struct list_head bud_list;
 	spinlock_t lock;
+	int cpu; /* whose lists bud_list is on */
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
 	/* followed by NUM_CHUNK aligned CHUNK_SIZE-byte chunks */
@@ -94,25 +102,23 @@ struct zbud_page {
 				CHUNK_MASK) >> CHUNK_SHIFT)
 #define MAX_CHUNK	(NCHUNKS-1)
 
-static struct {
-	struct list_head list;
-	unsigned count;
-} zbud_unbuddied[NCHUNKS];
-/* list N contains pages with N chunks USED and NCHUNKS-N unused */
-/* element 0 is never used but optimizing that isn't worth it */
-static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
-
-struct list_head zbud_buddied_list;
-static unsigned long zcache_zbud_buddied_count;
-
-/* protects the buddied list and all unbuddied lists */
-static DEFINE_SPINLOCK(zbud_budlists_spinlock);
-
-static LIST_HEAD(zbpg_unused_list);
-static unsigned long zcache_zbpg_unused_list_count;
+struct zbud_cpu {
+	/* protects all the lists below */
+	spinlock_t lock;
+	struct {
+		struct list_head list;
+		unsigned long count;
+	} unbuddied[NCHUNKS];
+	/* list N contains pages with N chunks USED and NCHUNKS-N unused */
+	/* element 0 is never used but optimizing that isn't worth it */
+	struct list_head buddied_list;
+	unsigned long buddied_count;
+	struct list_head unused_list;
+	unsigned long unused_count;
+};
+static DEFINE_PER_CPU(struct zbud_cpu, zbud_cpu);
 
-/* protects the unused page list */
-static DEFINE_SPINLOCK(zbpg_unused_list_spinlock);
+static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 
 static atomic_t zcache_zbud_curr_raw_pages;
 static atomic_t zcache_zbud_curr_zpages;
@@ -182,20 +188,21 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 
 static struct zbud_page *zbud_alloc_raw_page(void)
 {
+	struct zbud_cpu *zc = &__get_cpu_var(zbud_cpu);
 	struct zbud_page *zbpg = NULL;
 	struct zbud_hdr *zh0, *zh1;
 	bool recycled = 0;
 
-	/* if any pages on the zbpg list, use one */
-	spin_lock(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		zbpg = list_first_entry(&zbpg_unused_list,
+	/* if any pages on this cpu's zbpg list, use one */
+	spin_lock(&zc->lock);
+	if (!list_empty(&zc->unused_list)) {
+		zbpg = list_first_entry(&zc->unused_list,
 				struct zbud_page, bud_list);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
+		zc->unused_count--;
 		recycled = 1;
 	}
-	spin_unlock(&zbpg_unused_list_spinlock);
+	spin_unlock(&zc->lock);
 	if (zbpg == NULL)
 		/* none on zbpg list, try to get a kernel page */
 		zbpg = zcache_get_free_page();
@@ -203,6 +210,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 		INIT_LIST_HEAD(&zbpg->bud_list);
 		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
 		spin_lock_init(&zbpg->lock);
+		zbpg->cpu = smp_processor_id();
 		if (recycled) {
 			ASSERT_INVERTED_SENTINEL(zbpg, ZBPG);
 			SET_SENTINEL(zbpg, ZBPG);
@@ -222,6 +230,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 
 static void zbud_free_raw_page(struct zbud_page *zbpg)
 {
+	struct zbud_cpu *zc = &per_cpu(zbud_cpu, zbpg->cpu);
 	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
@@ -231,10 +240,10 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
 	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
 	INVERT_SENTINEL(zbpg, ZBPG);
 	spin_unlock(&zbpg->lock);
-	spin_lock(&zbpg_unused_list_spinlock);
-	list_add(&zbpg->bud_list, &zbpg_unused_list);
-	zcache_zbpg_unused_list_count++;
-	spin_unlock(&zbpg_unused_list_spinlock);
+	spin_lock(&zc->lock);
+	list_add(&zbpg->bud_list, &zc->unused_list);
+	zc->unused_count++;
+	spin_unlock(&zc->lock);
 }
 
 /*
@@ -264,6 +273,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	unsigned budnum = zbud_budnum(zh), size;
 	struct zbud_page *zbpg =
 		container_of(zh, struct zbud_page, buddy[budnum]);
+	struct zbud_cpu *zc;
 
 	spin_lock(&zbpg->lock);
 	if (list_empty(&zbpg->bud_list)) {
@@ -273,60 +283,90 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	}
 	size = zbud_free(zh);
 	ASSERT_SPINLOCK(&zbpg->lock);
+	zc = &per_cpu(zbud_cpu, zbpg->cpu);
 	zh_other = &zbpg->buddy[(budnum == 0) ? 1 : 0];
 	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
 		chunks = zbud_size_to_chunks(size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
+		spin_lock(&zc->lock);
+		BUG_ON(list_empty(&zc->unbuddied[chunks].list));
 		list_del_init(&zbpg->bud_list);
-		zbud_unbuddied[chunks].count--;
-		spin_unlock(&zbud_budlists_spinlock);
+		zc->unbuddied[chunks].count--;
+		spin_unlock(&zc->lock);
 		zbud_free_raw_page(zbpg);
 	} else { /* was buddied: move remaining buddy to unbuddied list */
 		chunks = zbud_size_to_chunks(zh_other->size) ;
-		spin_lock(&zbud_budlists_spinlock);
+		spin_lock(&zc->lock);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
-		zbud_unbuddied[chunks].count++;
-		spin_unlock(&zbud_budlists_spinlock);
+		zc->buddied_count--;
+		list_add_tail(&zbpg->bud_list, &zc->unbuddied[chunks].list);
+		zc->unbuddied[chunks].count++;
+		spin_unlock(&zc->lock);
 		spin_unlock(&zbpg->lock);
 	}
 }
 
+/*
+ * Find a zbpg on zc's unbuddied lists with room for nchunks. Caller holds
+ * zc->lock; the zbpg is returned locked, and the list it was on in *found.
+ */
+static struct zbud_page *zbud_find_unbuddied(struct zbud_cpu *zc,
+					unsigned nchunks, int *found)
+{
+	struct zbud_page *zbpg;
+	int i;
+
+	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
+		list_for_each_entry(zbpg, &zc->unbuddied[i].list, bud_list) {
+			if (spin_trylock(&zbpg->lock)) {
+				*found = i;
+				return zbpg;
+			}
+		}
+	}
+	return NULL;
+}
+
 static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 					uint32_t index, struct page *page,
 					void *cdata, unsigned size)
 {
 	struct zbud_hdr *zh0, *zh1, *zh = NULL;
-	struct zbud_page *zbpg = NULL, *ztmp;
+	struct zbud_page *zbpg = NULL;
+	struct zbud_cpu *zc;
 	unsigned nchunks;
 	char *to;
-	int i, found_good_buddy = 0;
+	int cpu = smp_processor_id(), other, found_good_buddy = 0;
 
 	nchunks = zbud_size_to_chunks(size) ;
-	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
-		spin_lock(&zbud_budlists_spinlock);
-		if (!list_empty(&zbud_unbuddied[i].list)) {
-			list_for_each_entry_safe(zbpg, ztmp,
-				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
-					goto found_unbuddied;
-				}
-			}
-		}
-		spin_unlock(&zbud_budlists_spinlock);
+	zc = &per_cpu(zbud_cpu, cpu);
+	spin_lock(&zc->lock);
+	zbpg = zbud_find_unbuddied(zc, nchunks, &found_good_buddy);
+	if (zbpg != NULL)
+		goto found_unbuddied;
+	spin_unlock(&zc->lock);
+
+	/* look at other cpus' lists too, but don't wait for them */
+	for_each_online_cpu(other) {
+		if (other == cpu)
+			continue;
+		zc = &per_cpu(zbud_cpu, other);
+		if (!spin_trylock(&zc->lock))
+			continue;
+		zbpg = zbud_find_unbuddied(zc, nchunks, &found_good_buddy);
+		if (zbpg != NULL)
+			goto found_unbuddied;
+		spin_unlock(&zc->lock);
 	}
+
 	/* didn't find a good buddy, try allocating a new page */
 	zbpg = zbud_alloc_raw_page();
 	if (unlikely(zbpg == NULL))
 		goto out;
-	/* ok, have a page, now compress the data before taking locks */
+	zc = &per_cpu(zbud_cpu, zbpg->cpu);
 	spin_lock(&zbpg->lock);
-	spin_lock(&zbud_budlists_spinlock);
-	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
-	zbud_unbuddied[nchunks].count++;
+	spin_lock(&zc->lock);
+	list_add_tail(&zbpg->bud_list, &zc->unbuddied[nchunks].list);
+	zc->unbuddied[nchunks].count++;
 	zh = &zbpg->buddy[0];
 	goto init_zh;
 
@@ -343,9 +383,9 @@ found_unbuddied:
 	} else
 		BUG();
 	list_del_init(&zbpg->bud_list);
-	zbud_unbuddied[found_good_buddy].count--;
-	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
-	zcache_zbud_buddied_count++;
+	zc->unbuddied[found_good_buddy].count--;
+	list_add_tail(&zbpg->bud_list, &zc->buddied_list);
+	zc->buddied_count++;
 
 init_zh:
 	SET_SENTINEL(zh, ZBH);
@@ -354,7 +394,7 @@ init_zh:
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
 	/* can wait to copy the data until the list locks are dropped */
-	spin_unlock(&zbud_budlists_spinlock);
+	spin_unlock(&zc->lock);
 
 	to = zbud_data(zh, size);
 	memcpy(to, cdata, size);
@@ -446,98 +486,119 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	zbud_free_raw_page(zbpg);
 }
 
-/*
- * Free nr pages.  This code is funky because we want to hold the locks
- * protecting various lists for as short a time as possible, and in some
- * circumstances the list may change asynchronously when the list lock is
- * not held.  In some cases we also trylock not only to avoid waiting on a
- * page in use by another cpu, but also to avoid potential deadlock due to
- * lock inversion.
- */
-static void zbud_evict_pages(int nr)
+/* Free up to nr pages on zc's unused list, returns how many are still wanted */
+static int zbud_evict_unused(struct zbud_cpu *zc, int nr)
 {
 	struct zbud_page *zbpg;
-	int i;
 
-	/* first try freeing any pages on unused list */
-retry_unused_list:
-	spin_lock_bh(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
+	while (nr > 0) {
+		spin_lock_bh(&zc->lock);
+		if (list_empty(&zc->unused_list)) {
+			spin_unlock_bh(&zc->lock);
+			break;
+		}
 		/* can't walk list here, since it may change when unlocked */
-		zbpg = list_first_entry(&zbpg_unused_list,
+		zbpg = list_first_entry(&zc->unused_list,
 				struct zbud_page, bud_list);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
+		zc->unused_count--;
 		atomic_dec(&zcache_zbud_curr_raw_pages);
-		spin_unlock_bh(&zbpg_unused_list_spinlock);
+		spin_unlock_bh(&zc->lock);
 		zcache_free_page(zbpg);
 		zcache_evicted_raw_pages++;
-		if (--nr <= 0)
-			goto out;
-		goto retry_unused_list;
+		nr--;
 	}
-	spin_unlock_bh(&zbpg_unused_list_spinlock);
+	return nr;
+}
 
-	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
-retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
-		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
-			if (unlikely(!spin_trylock(&zbpg->lock)))
-				continue;
-			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
-			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
-		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
-	}
+/*
+ * Evict up to nr zbpgs from one of zc's unbuddied or buddied lists,
+ * returns how many are still wanted
+ */
+static int zbud_evict_list(struct zbud_cpu *zc, struct list_head *list,
+			unsigned long *count, unsigned long *evicted, int nr)
+{
+	struct zbud_page *zbpg;
 
-	/* as a last resort, free buddied pages */
-retry_bud_list:
-	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
+retry:
+	spin_lock_bh(&zc->lock);
+	list_for_each_entry(zbpg, list, bud_list) {
 		if (unlikely(!spin_trylock(&zbpg->lock)))
 			continue;
 		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
+		(*count)--;
+		spin_unlock(&zc->lock);
+		(*evicted)++;
 		/* want budlists unlocked when doing zbpg eviction */
 		zbud_evict_zbpg(zbpg);
 		local_bh_enable();
 		if (--nr <= 0)
-			goto out;
-		goto retry_bud_list;
+			return nr;
+		goto retry;
 	}
-	spin_unlock_bh(&zbud_budlists_spinlock);
-out:
-	return;
+	spin_unlock_bh(&zc->lock);
+	return nr;
 }
 
-static void zbud_init(void)
+/*
+ * Free nr pages.  This code is funky because we want to hold the locks
+ * protecting various lists for as short a time as possible, and in some
+ * circumstances the list may change asynchronously when the list lock is
+ * not held.  In some cases we also trylock not only to avoid waiting on a
+ * page in use by another cpu, but also to avoid potential deadlock due to
+ * lock inversion.
+ */
+static void zbud_evict_pages(int nr)
 {
-	int i;
+	struct zbud_cpu *zc;
+	int cpu, i;
+
+	/* first try freeing any pages on unused lists */
+	for_each_possible_cpu(cpu) {
+		nr = zbud_evict_unused(&per_cpu(zbud_cpu, cpu), nr);
+		if (nr <= 0)
+			return;
+	}
 
-	INIT_LIST_HEAD(&zbud_buddied_list);
-	zcache_zbud_buddied_count = 0;
-	for (i = 0; i < NCHUNKS; i++) {
-		INIT_LIST_HEAD(&zbud_unbuddied[i].list);
-		zbud_unbuddied[i].count = 0;
+	/* now try freeing unbuddied pages, starting with least space avail */
+	for (i = 0; i < MAX_CHUNK; i++) {
+		for_each_possible_cpu(cpu) {
+			zc = &per_cpu(zbud_cpu, cpu);
+			nr = zbud_evict_list(zc, &zc->unbuddied[i].list,
+					&zc->unbuddied[i].count,
+					&zcache_evicted_unbuddied_pages, nr);
+			if (nr <= 0)
+				return;
+		}
+	}
+
+	/* as a last resort, free buddied pages */
+	for_each_possible_cpu(cpu) {
+		zc = &per_cpu(zbud_cpu, cpu);
+		nr = zbud_evict_list(zc, &zc->buddied_list,
+				&zc->buddied_count,
+				&zcache_evicted_buddied_pages, nr);
+		if (nr <= 0)
+			return;
+	}
+}
+
+static void zbud_init(void)
+{
+	struct zbud_cpu *zc;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		zc = &per_cpu(zbud_cpu, cpu);
+		spin_lock_init(&zc->lock);
+		INIT_LIST_HEAD(&zc->buddied_list);
+		zc->buddied_count = 0;
+		INIT_LIST_HEAD(&zc->unused_list);
+		zc->unused_count = 0;
+		for (i = 0; i < NCHUNKS; i++) {
+			INIT_LIST_HEAD(&zc->unbuddied[i].list);
+			zc->unbuddied[i].count = 0;
+		}
 	}
 }
 
@@ -549,15 +610,39 @@ static void zbud_init(void)
  */
 static int zbud_show_unbuddied_list_counts(char *buf)
 {
-	int i;
+	unsigned long count;
+	int cpu, i;
 	char *p = buf;
 
-	for (i = 0; i < NCHUNKS - 1; i++)
-		p += sprintf(p, "%u ", zbud_unbuddied[i].count);
-	p += sprintf(p, "%d\n", zbud_unbuddied[i].count);
+	for (i = 0; i < NCHUNKS; i++) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu(zbud_cpu, cpu).unbuddied[i].count;
+		p += sprintf(p, i < NCHUNKS - 1 ? "%lu " : "%lu\n", count);
+	}
 	return p - buf;
 }
 
+static int zbud_show_buddied_count(char *buf)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu(zbud_cpu, cpu).buddied_count;
+	return sprintf(buf, "%lu\n", count);
+}
+
+static int zbud_show_unused_list_count(char *buf)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu(zbud_cpu, cpu).unused_count;
+	return sprintf(buf, "%lu\n", count);
+}
+
 static int zbud_show_cumul_chunk_counts(char *buf)
 {
 	unsigned long i, chunks = 0, total_chunks = 0, sum_total_chunks = 0;
@@ -585,12 +670,13 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 #endif
 
 /**********
- * This "zv" PAM implementation combines the TLSF-based xvMalloc
- * with lzo1x compression to maximize the amount of data that can
- * be packed into a physical page.
+ * This "zv" PAM implementation combines zsmalloc with lzo1x compression
+ * to maximize the amount of data that can be packed into a physical page.
  *
  * Zv represents a PAM page with the index and object (plus a "size" value
  * necessary for decompression) immediately preceding the compressed data.
+ * The pampd is the zsmalloc handle, the object has to be mapped to be
+ * looked at.
  */
 
 #define ZVH_SENTINEL  0x43214321
@@ -599,68 +685,75 @@ struct zv_hdr {
 	uint32_t pool_id;
 	struct tmem_oid oid;
 	uint32_t index;
+	uint16_t size;
 	DECL_SENTINEL
 };
 
 static const int zv_max_page_size = (PAGE_SIZE / 8) * 7;
 
-static struct zv_hdr *zv_create(struct xv_pool *xvpool, uint32_t pool_id,
+/* compressed bytes held by zv, headers excluded */
+static atomic_long_t zv_curr_stored_bytes = ATOMIC_LONG_INIT(0);
+
+static unsigned long zv_create(struct zs_pool *zspool, uint32_t pool_id,
 				struct tmem_oid *oid, uint32_t index,
 				void *cdata, unsigned clen)
 {
-	struct page *page;
-	struct zv_hdr *zv = NULL;
-	uint32_t offset;
-	int ret;
+	struct zv_hdr *zv;
+	unsigned long handle;
 
 	BUG_ON(!irqs_disabled());
-	ret = xv_malloc(xvpool, clen + sizeof(struct zv_hdr),
-			&page, &offset, ZCACHE_GFP_MASK);
-	if (unlikely(ret))
+	handle = zs_malloc(zspool, clen + sizeof(struct zv_hdr));
+	if (unlikely(!handle))
 		goto out;
-	zv = kmap_atomic(page, KM_USER0) + offset;
+	zv = zs_map_object(zspool, handle, ZS_MM_WO);
 	zv->index = index;
 	zv->oid = *oid;
 	zv->pool_id = pool_id;
+	zv->size = clen;
 	SET_SENTINEL(zv, ZVH);
 	memcpy((char *)zv + sizeof(struct zv_hdr), cdata, clen);
-	kunmap_atomic(zv, KM_USER0);
+	zs_unmap_object(zspool, handle);
+	atomic_long_add(clen, &zv_curr_stored_bytes);
 out:
-	return zv;
+	return handle;
 }
 
-static void zv_free(struct xv_pool *xvpool, struct zv_hdr *zv)
+static void zv_free(struct zs_pool *zspool, unsigned long handle)
 {
 	unsigned long flags;
-	struct page *page;
-	uint32_t offset;
+	struct zv_hdr *zv;
 	uint16_t size;
 
+	zv = zs_map_object(zspool, handle, ZS_MM_RW);
 	ASSERT_SENTINEL(zv, ZVH);
-	size = xv_get_object_size(zv) - sizeof(*zv);
+	size = zv->size;
 	BUG_ON(size == 0 || size > zv_max_page_size);
 	INVERT_SENTINEL(zv, ZVH);
-	page = virt_to_page(zv);
-	offset = (unsigned long)zv & ~PAGE_MASK;
+	zs_unmap_object(zspool, handle);
+	atomic_long_sub(size, &zv_curr_stored_bytes);
 	local_irq_save(flags);
-	xv_free(xvpool, page, offset);
+	zs_free(zspool, handle);
 	local_irq_restore(flags);
 }
 
-static void zv_decompress(struct page *page, struct zv_hdr *zv)
+static void zv_decompress(struct zs_pool *zspool, struct page *page,
+				unsigned long handle)
 {
 	size_t clen = PAGE_SIZE;
+	struct zv_hdr *zv;
 	char *to_va;
 	unsigned size;
 	int ret;
 
+	zv = zs_map_object(zspool, handle, ZS_MM_RO);
 	ASSERT_SENTINEL(zv, ZVH);
-	size = xv_get_object_size(zv) - sizeof(*zv);
+	size = zv->size;
 	BUG_ON(size == 0 || size > zv_max_page_size);
 	to_va = kmap_atomic(page, KM_USER0);
 	ret = lzo1x_decompress_safe((char *)zv + sizeof(*zv),
 					size, to_va, &clen);
 	kunmap_atomic(to_va, KM_USER0);
+	zs_unmap_object(zspool, handle);
 	BUG_ON(ret != LZO_E_OK);
 	BUG_ON(clen != PAGE_SIZE);
 }
@@ -681,7 +774,7 @@ static unsigned long zcache_failed_pers_puts;
 
 static struct {
 	struct tmem_pool *tmem_pools[MAX_POOLS_PER_CLIENT];
-	struct xv_pool *xvpool;
+	struct zs_pool *zspool;
 } zcache_client;
 
 /*
@@ -719,9 +812,14 @@ static unsigned long zcache_aborted_shrink;
 /*
  * Ensure that memory allocation requests in zcache don't result
  * in direct reclaim requests via the shrinker, which would cause
- * an infinite loop.  Maybe a GFP flag would be better?
+ * an infinite loop.  Maybe a GFP flag would be better?  Puts run with
+ * irqs disabled, so a per-cpu flag is enough to catch the recursion and
+ * puts on different cpus no longer serialize on a global lock.
  */
-static DEFINE_SPINLOCK(zcache_direct_reclaim_lock);
+static DEFINE_PER_CPU(int, zcache_preloading);
+
+/* only one shrinker at a time walks the zbud lists */
+static DEFINE_SPINLOCK(zcache_shrink_lock);
 
 /*
  * for now, used named slabs so can easily track usage; later can
@@ -745,6 +843,9 @@ struct zcache_preload {
 	struct tmem_obj *obj;
 	int nr;
 	struct tmem_objnode *objnodes[OBJNODE_TREE_MAX_PATH];
+	/* page compressed by zcache_put_page before taking tmem locks */
+	void *cdata;
+	size_t clen;
 };
 static DEFINE_PER_CPU(struct zcache_preload, zcache_preloads) = { 0, };
 
@@ -760,10 +861,11 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		goto out;
 	if (unlikely(zcache_obj_cache == NULL))
 		goto out;
-	if (!spin_trylock(&zcache_direct_reclaim_lock)) {
+	if (__get_cpu_var(zcache_preloading)) {
 		zcache_aborted_preload++;
 		goto out;
 	}
+	__get_cpu_var(zcache_preloading) = 1;
 	preempt_disable();
 	kp = &__get_cpu_var(zcache_preloads);
 	while (kp->nr < ARRAY_SIZE(kp->objnodes)) {
@@ -805,7 +907,7 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		free_page((unsigned long)page);
 	ret = 0;
 unlock_out:
-	spin_unlock(&zcache_direct_reclaim_lock);
+	__get_cpu_var(zcache_preloading) = 0;
 out:
 	return ret;
 }
@@ -901,6 +1003,22 @@ static unsigned long zcache_curr_pers_pampd_count_max;
 /* forward reference */
 static int zcache_compress(struct page *from, void **out_va, size_t *out_len);
 
+/*
+ * Use the data zcache_put_page compressed before tmem took its locks;
+ * only compress here if that wasn't done.
+ */
+static int zcache_get_cdata(struct page *page, void **cdata, size_t *clen)
+{
+	struct zcache_preload *kp = &__get_cpu_var(zcache_preloads);
+
+	if (kp->cdata == NULL)
+		return zcache_compress(page, cdata, clen);
+	*cdata = kp->cdata;
+	*clen = kp->clen;
+	kp->cdata = NULL;
+	return 1;
+}
+
 static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 				 uint32_t index, struct page *page)
 {
@@ -911,7 +1029,7 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 	unsigned long count;
 
 	if (ephemeral) {
-		ret = zcache_compress(page, &cdata, &clen);
+		ret = zcache_get_cdata(page, &cdata, &clen);
 		if (ret == 0)
 
 			goto out;
@@ -935,14 +1053,14 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 		if (atomic_read(&zcache_curr_pers_pampd_count) >
 							3 * totalram_pages / 4)
 			goto out;
-		ret = zcache_compress(page, &cdata, &clen);
+		ret = zcache_get_cdata(page, &cdata, &clen);
 		if (ret == 0)
 			goto out;
 		if (clen > zv_max_page_size) {
 			zcache_compress_poor++;
 			goto out;
 		}
-		pampd = (void *)zv_create(zcache_client.xvpool, pool->pool_id,
+		pampd = (void *)zv_create(zcache_client.zspool, pool->pool_id,
 						oid, index, cdata, clen);
 		if (pampd == NULL)
 			goto out;
@@ -966,7 +1084,8 @@ static int zcache_pampd_get_data(struct page *page, void *pampd,
 	if (is_ephemeral(pool))
 		ret = zbud_decompress(page, pampd);
 	else
-		zv_decompress(page, pampd);
+		zv_decompress(zcache_client.zspool, page,
+				(unsigned long)pampd);
 	return ret;
 }
 
@@ -981,7 +1100,7 @@ static void zcache_pampd_free(void *pampd, struct tmem_pool *pool)
 		atomic_dec(&zcache_curr_eph_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_eph_pampd_count) < 0);
 	} else {
-		zv_free(zcache_client.xvpool, (struct zv_hdr *)pampd);
+		zv_free(zcache_client.zspool, (unsigned long)pampd);
 		atomic_dec(&zcache_curr_pers_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_pers_pampd_count) < 0);
 	}
@@ -1111,8 +1230,8 @@ ZCACHE_SYSFS_RO(failed_pers_puts);
 ZCACHE_SYSFS_RO(zbud_curr_zbytes);
 ZCACHE_SYSFS_RO(zbud_cumul_zpages);
 ZCACHE_SYSFS_RO(zbud_cumul_zbytes);
-ZCACHE_SYSFS_RO(zbud_buddied_count);
-ZCACHE_SYSFS_RO(zbpg_unused_list_count);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_buddied_count, zbud_show_buddied_count);
+ZCACHE_SYSFS_RO_CUSTOM(zbpg_unused_list_count, zbud_show_unused_list_count);
 ZCACHE_SYSFS_RO(evicted_raw_pages);
 ZCACHE_SYSFS_RO(evicted_unbuddied_pages);
 ZCACHE_SYSFS_RO(evicted_buddied_pages);
@@ -1131,6 +1250,23 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
 
+static int zv_show_curr_pool_pages(char *buf)
+{
+	u64 bytes = 0;
+
+	if (zcache_client.zspool)
+		bytes = zs_get_total_size_bytes(zcache_client.zspool);
+	return sprintf(buf, "%llu\n", bytes >> PAGE_SHIFT);
+}
+
+static int zv_show_curr_stored_bytes(char *buf)
+{
+	return sprintf(buf, "%ld\n", atomic_long_read(&zv_curr_stored_bytes));
+}
+
+ZCACHE_SYSFS_RO_CUSTOM(zv_curr_pool_pages, zv_show_curr_pool_pages);
+ZCACHE_SYSFS_RO_CUSTOM(zv_curr_stored_bytes, zv_show_curr_stored_bytes);
+
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
 	&zcache_curr_obj_count_max_attr.attr,
@@ -1160,6 +1296,8 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_zv_curr_pool_pages_attr.attr,
+	&zcache_zv_curr_stored_bytes_attr.attr,
 	NULL,
 };
 
@@ -1178,6 +1316,9 @@ static struct attribute_group zcache_attr_group = {
  */
 static bool zcache_freeze;
 
+/* set by the "zcache" boot parameter, see zcache initialization below */
+static int zcache_enabled;
+
 /*
  * zcache shrinker interface (only useful for ephemeral pages, so zbud only)
  */
@@ -1189,9 +1330,10 @@ static int shrink_zcache_memory(struct shrinker *shrink, int nr, gfp_t gfp_mask)
 		if (!(gfp_mask & __GFP_FS))
 			/* does this case really need to be skipped? */
 			goto out;
-		if (spin_trylock(&zcache_direct_reclaim_lock)) {
+		if (!this_cpu_read(zcache_preloading) &&
+		    spin_trylock(&zcache_shrink_lock)) {
 			zbud_evict_pages(nr);
-			spin_unlock(&zcache_direct_reclaim_lock);
+			spin_unlock(&zcache_shrink_lock);
 		} else
 			zcache_aborted_shrink++;
 	}
@@ -1209,10 +1351,11 @@ static struct shrinker zcache_shrinker = {
  * zcache shims between cleancache/frontswap ops and tmem
  */
 
-static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
+int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	struct zcache_preload *kp;
 	int ret = -1;
 
 	BUG_ON(!irqs_disabled());
@@ -1221,7 +1364,16 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 		goto out;
 	if (!zcache_freeze && zcache_do_preload(pool) == 0) {
 		/* preload does preempt_disable on success */
+		kp = &__get_cpu_var(zcache_preloads);
+		/*
+		 * Compress now, so the tmem hashbucket lock is held only
+		 * for the tree update and the zbud/zsmalloc allocation.
+		 */
+		if (!zcache_compress(page, &kp->cdata, &kp->clen))
+			kp->cdata = NULL;
 		ret = tmem_put(pool, oidp, index, page);
+		/* tmem_put may not have got as far as pampd_create */
+		kp->cdata = NULL;
 		if (ret < 0) {
 			if (is_ephemeral(pool))
 				zcache_failed_eph_puts++;
@@ -1240,8 +1392,9 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 out:
 	return ret;
 }
+EXPORT_SYMBOL_GPL(zcache_put_page);
 
-static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
+int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
@@ -1258,8 +1411,9 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 	local_irq_restore(flags);
 	return ret;
 }
+EXPORT_SYMBOL_GPL(zcache_get_page);
 
-static int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index)
+int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index)
 {
 	struct tmem_pool *pool;
 	int ret = -1;
@@ -1278,6 +1432,7 @@ static int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index)
 	local_irq_restore(flags);
 	return ret;
 }
+EXPORT_SYMBOL_GPL(zcache_flush_page);
 
 static int zcache_flush_object(int pool_id, struct tmem_oid *oidp)
 {
@@ -1299,7 +1454,7 @@ static int zcache_flush_object(int pool_id, struct tmem_oid *oidp)
 	return ret;
 }
 
-static int zcache_destroy_pool(int pool_id)
+int zcache_destroy_pool(int pool_id)
 {
 	struct tmem_pool *pool = NULL;
 	int ret = -1;
@@ -1321,12 +1476,17 @@ static int zcache_destroy_pool(int pool_id)
 out:
 	return ret;
 }
+EXPORT_SYMBOL_GPL(zcache_destroy_pool);
 
-static int zcache_new_pool(uint32_t flags)
+int zcache_new_pool(uint32_t flags)
 {
 	int poolid = -1;
 	struct tmem_pool *pool;
 
+	if (!zcache_enabled) {
+		pr_info("zcache: pool creation failed: zcache not enabled\n");
+		goto out;
+	}
 	pool = kmalloc(sizeof(struct tmem_pool), GFP_KERNEL);
 	if (pool == NULL) {
 		pr_info("zcache: pool creation failed: out of memory\n");
@@ -1353,6 +1513,7 @@ static int zcache_new_pool(uint32_t flags)
 out:
 	return poolid;
 }
+EXPORT_SYMBOL_GPL(zcache_new_pool);
 
 /**********
  * Two kernel functionalities currently can be layered on top of tmem.
@@ -1558,8 +1719,6 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
  * NOTHING HAPPENS!
  */
 
-static int zcache_enabled;
-
 static int __init enable_zcache(char *s)
 {
 	zcache_enabled = 1;
@@ -1621,12 +1780,12 @@ static int __init zcache_init(void)
 				sizeof(struct tmem_objnode), 0, 0, NULL);
 	zcache_obj_cache = kmem_cache_create("zcache_obj",
 				sizeof(struct tmem_obj), 0, 0, NULL);
+	zbud_init();
 #endif
 #ifdef CONFIG_CLEANCACHE
 	if (zcache_enabled && use_cleancache) {
 		struct cleancache_ops old_ops;
 
-		zbud_init();
 		register_shrinker(&zcache_shrinker);
 		old_ops = zcache_cleancache_register_ops();
 		pr_info("zcache: cleancache enabled using kernel "
@@ -1639,14 +1798,15 @@ static int __init zcache_init(void)
 	if (zcache_enabled && use_frontswap) {
 		struct frontswap_ops old_ops;
 
-		zcache_client.xvpool = xv_create_pool();
-		if (zcache_client.xvpool == NULL) {
-			pr_err("zcache: can't create xvpool\n");
+		zcache_client.zspool = zs_create_pool("zcache",
+							ZCACHE_GFP_MASK);
+		if (zcache_client.zspool == NULL) {
+			pr_err("zcache: can't create zspool\n");
 			goto out;
 		}
 		old_ops = zcache_frontswap_register_ops();
 		pr_info("zcache: frontswap enabled using kernel "
-			"transcendent memory and xvmalloc\n");
+			"transcendent memory and zsmalloc\n");
 		if (old_ops.init != NULL)
 			pr_warning("ktmem: frontswap_ops overridden");
 	}
@@ -0,0 +1,186 @@
+/*
+ * zcache-stress.c
+ *
+ * Concurrency stress test for zcache.  On load, a thread bound to each
+ * online cpu puts a set of pages into an ephemeral zcache pool, gets them
+ * back (checking the contents of every page that is still there) and
+ * flushes what is left, over and over for the requested number of seconds.
+ * The number of operations each cpu completed is then reported.
+ *
+ * Each thread works on its own object, so the threads only contend inside
+ * zcache itself: on tmem hashbuckets, zbud lists and the allocators.
+ *
+ * Usage: modprobe zcache-stress [seconds=N] [pages=N]
+ * The module load always fails with -EAGAIN once the test has run, so it
+ * can simply be loaded again.  zcache must have been enabled at boot.
+ */
+
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/jiffies.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "zcache.h"
+
+static unsigned int seconds = 10;
+module_param(seconds, uint, 0);
+MODULE_PARM_DESC(seconds, "How long to run the test for");
+
+static unsigned int pages = 1024;
+module_param(pages, uint, 0);
+MODULE_PARM_DESC(pages, "Number of pages each cpu keeps in zcache");
+
+struct zcache_stress {
+	struct task_struct *task;
+	struct completion done;
+	int cpu;
+	int pool_id;
+	unsigned long deadline;
+	struct page *src;
+	struct page *dst;
+	unsigned long puts, gets, misses, flushes, errors;
+};
+
+static int zcache_stress_pool;
+
+/* half the page is a pattern unique to (cpu, index, pass), half zeroes */
+static void zcache_stress_fill(struct page *page, int cpu,
+				uint32_t index, unsigned long pass)
+{
+	uint32_t *p = kmap_atomic(page, KM_USER0);
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*p); i++)
+		p[i] = (i & 1) ? 0 : (cpu << 24) ^ (index << 8) ^ pass ^ i;
+	kunmap_atomic(p, KM_USER0);
+}
+
+static bool zcache_stress_same(struct page *a, struct page *b)
+{
+	char *va = kmap_atomic(a, KM_USER0);
+	char *vb = kmap_atomic(b, KM_USER1);
+	bool same = !memcmp(va, vb, PAGE_SIZE);
+
+	kunmap_atomic(vb, KM_USER1);
+	kunmap_atomic(va, KM_USER0);
+	return same;
+}
+
+static int zcache_stress_thread(void *data)
+{
+	struct zcache_stress *zs = data;
+	struct tmem_oid oid = { .oid = { zs->cpu + 1, 0, 0 } };
+	unsigned long flags, pass = 0;
+	uint32_t index;
+
+	while (time_before(jiffies, zs->deadline)) {
+		for (index = 0; index < pages; index++) {
+			zcache_stress_fill(zs->src, zs->cpu, index, pass);
+			local_irq_save(flags);
+			(void)zcache_put_page(zs->pool_id, &oid, index, zs->src);
+			local_irq_restore(flags);
+			zs->puts++;
+		}
+		/* get every other page back, eviction may have taken some */
+		for (index = 0; index < pages; index += 2) {
+			zs->gets++;
+			if (zcache_get_page(zs->pool_id, &oid, index,
+						zs->dst) < 0) {
+				zs->misses++;
+				continue;
+			}
+			zcache_stress_fill(zs->src, zs->cpu, index, pass);
+			if (!zcache_stress_same(zs->src, zs->dst))
+				zs->errors++;
+		}
+		/* and drop the rest */
+		for (index = 1; index < pages; index += 2) {
+			(void)zcache_flush_page(zs->pool_id, &oid, index);
+			zs->flushes++;
+		}
+		pass++;
+		cond_resched();
+	}
+	/* init frees the module as soon as all threads are done */
+	complete_and_exit(&zs->done, 0);
+}
+
+static int __init zcache_stress_init(void)
+{
+	struct zcache_stress *zs;
+	unsigned long total = 0, errors = 0;
+	int cpu, ret = -ENOMEM;
+
+	zs = kcalloc(nr_cpu_ids, sizeof(*zs), GFP_KERNEL);
+	if (zs == NULL)
+		return -ENOMEM;
+	zcache_stress_pool = zcache_new_pool(0);
+	if (zcache_stress_pool < 0) {
+		ret = -ENODEV;
+		goto out_free;
+	}
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		zs[cpu].src = alloc_page(GFP_KERNEL);
+		zs[cpu].dst = alloc_page(GFP_KERNEL);
+		if (zs[cpu].src == NULL || zs[cpu].dst == NULL)
+			goto out_pages;
+	}
+	ret = 0;
+	for_each_online_cpu(cpu) {
+		zs[cpu].cpu = cpu;
+		zs[cpu].pool_id = zcache_stress_pool;
+		zs[cpu].deadline = jiffies + seconds * HZ;
+		init_completion(&zs[cpu].done);
+		zs[cpu].task = kthread_create(zcache_stress_thread, &zs[cpu],
+					"zcache-stress/%d", cpu);
+		if (IS_ERR(zs[cpu].task)) {
+			ret = PTR_ERR(zs[cpu].task);
+			zs[cpu].task = NULL;
+			/* threads already started stop at the deadline */
+			break;
+		}
+		kthread_bind(zs[cpu].task, cpu);
+	}
+	for_each_online_cpu(cpu)
+		if (zs[cpu].task != NULL)
+			wake_up_process(zs[cpu].task);
+	for_each_online_cpu(cpu) {
+		if (zs[cpu].task == NULL)
+			continue;
+		wait_for_completion(&zs[cpu].done);
+		pr_info("zcache-stress: cpu%d: %lu ops/s (%lu puts, %lu gets, "
+			"%lu misses, %lu flushes, %lu errors)\n", cpu,
+			(zs[cpu].puts + zs[cpu].gets + zs[cpu].flushes) /
+			max(seconds, 1U), zs[cpu].puts, zs[cpu].gets,
+			zs[cpu].misses, zs[cpu].flushes, zs[cpu].errors);
+		total += zs[cpu].puts + zs[cpu].gets + zs[cpu].flushes;
+		errors += zs[cpu].errors;
+	}
+	pr_info("zcache-stress: total: %lu ops/s on %d cpus, %lu errors\n",
+		total / max(seconds, 1U), num_online_cpus(), errors);
+	if (ret == 0)
+		ret = errors ? -EIO : -EAGAIN;
+
+out_pages:
+	for_each_online_cpu(cpu) {
+		if (zs[cpu].src != NULL)
+			__free_page(zs[cpu].src);
+		if (zs[cpu].dst != NULL)
+			__free_page(zs[cpu].dst);
+	}
+	put_online_cpus();
+	zcache_destroy_pool(zcache_stress_pool);
+out_free:
+	kfree(zs);
+	return ret;
+}
+
+module_init(zcache_stress_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("zcache concurrency stress test");
@@ -0,0 +1,22 @@
+/*
+ * zcache.h
+ *
+ * Entry points into zcache for in-kernel users other than the
+ * cleancache and frontswap shims, such as the zcache stress module.
+ * Puts must be done with irqs disabled, like cleancache and frontswap do.
+ */
+
+#ifndef _ZCACHE_H_
+#define _ZCACHE_H_
+
+#include "tmem.h"
+
+int zcache_new_pool(uint32_t flags);
+int zcache_destroy_pool(int pool_id);
+int zcache_put_page(int pool_id, struct tmem_oid *oidp,
+			uint32_t index, struct page *page);
+int zcache_get_page(int pool_id, struct tmem_oid *oidp,
+			uint32_t index, struct page *page);
+int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index);
+
+#endif /* _ZCACHE_H_ */
@@ -0,0 +1,196 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/lz4.h>
+#include <linux/lzo.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_comp.h"
+
+/*
+ * lzo and lz4 call lib/ directly: they are what zram is normally used
+ * with, and this saves the crypto layer's indirection on every page.
+ * Any other compressor registered with the crypto API is reached
+ * through zram_crypto.
+ */
+
+static void *zram_lzo_create(const char *name, int decompress)
+{
+	void *workmem;
+
+	if (decompress)
+		return NULL;
+
+	workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	return workmem ? workmem : ERR_PTR(-ENOMEM);
+}
+
+static int zram_lzo_compress(void *private, const unsigned char *src,
+			     unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, private);
+	return ret == LZO_E_OK ? 0 : -EINVAL;
+}
+
+static int zram_lzo_decompress(void *private, const unsigned char *src,
+			       size_t src_len, unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+	return ret == LZO_E_OK && dst_len == PAGE_SIZE ? 0 : -EINVAL;
+}
+
+static void zram_workmem_destroy(void *private)
+{
+	kfree(private);
+}
+
+static void *zram_lz4_create(const char *name, int decompress)
+{
+	void *workmem;
+
+	if (decompress)
+		return NULL;
+
+	workmem = kzalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+	return workmem ? workmem : ERR_PTR(-ENOMEM);
+}
+
+static int zram_lz4_compress(void *private, const unsigned char *src,
+			     unsigned char *dst, size_t *dst_len)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, private) ?
+		-EINVAL : 0;
+}
+
+static int zram_lz4_decompress(void *private, const unsigned char *src,
+			       size_t src_len, unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = lz4_decompress_unknownoutputsize(src, src_len, dst, &dst_len);
+	return !ret && dst_len == PAGE_SIZE ? 0 : -EINVAL;
+}
+
+static const struct zram_backend zram_backends[] = {
+	{
+		.name		= "lzo",
+		.create		= zram_lzo_create,
+		.destroy	= zram_workmem_destroy,
+		.compress	= zram_lzo_compress,
+		.decompress	= zram_lzo_decompress,
+	},
+	{
+		.name		= "lz4",
+		.create		= zram_lz4_create,
+		.destroy	= zram_workmem_destroy,
+		.compress	= zram_lz4_compress,
+		.decompress	= zram_lz4_decompress,
+	},
+};
+
+#ifdef CONFIG_CRYPTO
+static void *zram_crypto_create(const char *name, int decompress)
+{
+	struct crypto_comp *tfm;
+
+	tfm = crypto_alloc_comp(name, 0, 0);
+	return IS_ERR(tfm) ? ERR_CAST(tfm) : tfm;
+}
+
+static void zram_crypto_destroy(void *private)
+{
+	if (private)
+		crypto_free_comp(private);
+}
+
+static int zram_crypto_compress(void *private, const unsigned char *src,
+				unsigned char *dst, size_t *dst_len)
+{
+	unsigned int len = 2 * PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_compress(private, src, PAGE_SIZE, dst, &len);
+	*dst_len = len;
+	return ret;
+}
+
+static int zram_crypto_decompress(void *private, const unsigned char *src,
+				  size_t src_len, unsigned char *dst)
+{
+	unsigned int len = PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_decompress(private, src, src_len, dst, &len);
+	return !ret && len == PAGE_SIZE ? 0 : -EINVAL;
+}
+
+static const struct zram_backend zram_crypto = {
+	.name		= "crypto",
+	.create		= zram_crypto_create,
+	.destroy	= zram_crypto_destroy,
+	.compress	= zram_crypto_compress,
+	.decompress	= zram_crypto_decompress,
+};
+#endif
+
+const struct zram_backend *zram_find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zram_backends); i++)
+		if (!strcmp(zram_backends[i].name, name))
+			return &zram_backends[i];
+
+#ifdef CONFIG_CRYPTO
+	if (crypto_has_comp(name, 0, 0))
+		return &zram_crypto;
+#endif
+
+	return NULL;
+}
+
+/*
+ * List the built in backends with 'cur' in brackets, followed by 'cur'
+ * itself if it is a crypto API compressor.
+ */
+ssize_t zram_show_backends(const char *cur, char *buf)
+{
+	ssize_t sz = 0;
+	int found = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zram_backends); i++) {
+		if (!strcmp(zram_backends[i].name, cur)) {
+			sz += sprintf(buf + sz, "[%s] ", cur);
+			found = 1;
+		} else
+			sz += sprintf(buf + sz, "%s ", zram_backends[i].name);
+	}
+	if (!found)
+		sz += sprintf(buf + sz, "[%s] ", cur);
+
+	buf[sz - 1] = '\n';
+	return sz;
+}
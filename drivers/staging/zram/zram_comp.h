@@ -0,0 +1,43 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#define ZRAM_COMP_NAME_LEN	32
+
+/*
+ * A compression backend. Each compression stream gets a context from
+ * create(name, 0) and each cpu a separate decompression context from
+ * create(name, 1); either may be NULL if the backend needs none. create()
+ * returns an ERR_PTR on failure.
+ *
+ * compress() takes a page and writes at most two pages to 'dst'.
+ * decompress() writes exactly one page to 'dst' and is called from atomic
+ * context. Both return 0 or a negative errno.
+ */
+struct zram_backend {
+	const char *name;
+	void *(*create)(const char *name, int decompress);
+	void (*destroy)(void *private);
+	int (*compress)(void *private, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len);
+	int (*decompress)(void *private, const unsigned char *src,
+			  size_t src_len, unsigned char *dst);
+};
+
+extern const struct zram_backend *zram_find_backend(const char *name);
+extern ssize_t zram_show_backends(const char *cur, char *buf);
+
+#endif
@@ -23,13 +23,18 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/workqueue.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/err.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -38,18 +43,19 @@
 /* Globals */
 static int zram_major;
 struct zram *devices;
+static struct kmem_cache *zram_entry_cache;
 
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,6 +95,197 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+/*
+ * A table entry is only looked at or changed with its slot locked. The
+ * lock is held across decompression on read and across freeing the old
+ * object and installing the new one on write, but not across compression
+ * or allocation, which happen before a writer takes it.
+ */
+static void zram_lock_slot(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_unlock_slot(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Caller holds the slot lock */
+static void zram_touch_slot(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = get_seconds();
+}
+
+/* Block 0 is never handed out, so 0 means the device is full */
+static unsigned long zram_bd_alloc_block(struct zram *zram)
+{
+	unsigned long block;
+
+	spin_lock(&zram->bitmap_lock);
+	block = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (block < zram->nr_blocks)
+		__set_bit(block, zram->bitmap);
+	else
+		block = 0;
+	spin_unlock(&zram->bitmap_lock);
+
+	return block;
+}
+
+static void zram_bd_free_block(struct zram *zram, unsigned long block)
+{
+	spin_lock(&zram->bitmap_lock);
+	__clear_bit(block, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+/* Bios in flight to or from the backing device */
+struct zram_bd_io {
+	atomic_t pending;	/* biased by one until zram_bd_wait() */
+	int error;
+	struct completion done;
+};
+
+static void zram_bd_io_init(struct zram_bd_io *io)
+{
+	atomic_set(&io->pending, 1);
+	io->error = 0;
+	init_completion(&io->done);
+}
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_io *io = bio->bi_private;
+
+	if (err)
+		io->error = err;
+	if (atomic_dec_and_test(&io->pending))
+		complete(&io->done);
+	bio_put(bio);
+}
+
+static struct bio *zram_bd_bio(struct zram *zram, struct zram_bd_io *io,
+				unsigned long block, int nr_pages)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, nr_pages);
+	if (!bio)
+		return NULL;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = (sector_t)block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = io;
+
+	return bio;
+}
+
+static void zram_bd_submit(struct zram_bd_io *io, int rw, struct bio *bio)
+{
+	atomic_inc(&io->pending);
+	submit_bio(rw, bio);
+}
+
+static int zram_bd_wait(struct zram_bd_io *io)
+{
+	if (!atomic_dec_and_test(&io->pending))
+		wait_for_completion(&io->done);
+
+	return io->error;
+}
+
+struct zram_bd_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int error;
+};
+
+static void zram_bd_read_fn(struct work_struct *work)
+{
+	struct zram_bd_read_work *rw;
+	struct zram_bd_io io;
+	struct bio *bio;
+
+	rw = container_of(work, struct zram_bd_read_work, work);
+
+	zram_bd_io_init(&io);
+	bio = zram_bd_bio(rw->zram, &io, rw->block, 1);
+	if (!bio) {
+		rw->error = -ENOMEM;
+		return;
+	}
+	bio_add_page(bio, rw->page, PAGE_SIZE, 0);
+	zram_bd_submit(&io, READ, bio);
+	rw->error = zram_bd_wait(&io);
+}
+
+/*
+ * Bios submitted from within zram_make_request() are only dispatched
+ * after it returns, so waiting on one there would never finish. The
+ * read is issued and waited for by a worker instead.
+ */
+static int zram_bd_read(struct zram *zram, struct page *page,
+			unsigned long block)
+{
+	struct zram_bd_read_work rw = {
+		.zram = zram,
+		.page = page,
+		.block = block,
+	};
+
+	INIT_WORK_ONSTACK(&rw.work, zram_bd_read_fn);
+	queue_work(system_unbound_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	if (rw.error) {
+		pr_err("Backing device read failed! err=%d, block=%lu\n",
+			rw.error, block);
+		return -EIO;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	flush_dcache_page(page);
+	return 0;
+}
+#else
+static inline void zram_touch_slot(struct zram *zram, u32 index) { }
+static inline void zram_bd_free_block(struct zram *zram,
+				unsigned long block) { }
+static inline int zram_bd_read(struct zram *zram, struct page *page,
+				unsigned long block)
+{
+	return -EIO;
+}
+#endif
+
+static void zram_hist_add(unsigned long *hist, u64 start)
+{
+	u64 ns = local_clock() - start;
+
+	hist[ns ? min_t(int, ilog2(ns), ZRAM_HIST_BUCKETS - 1) : 0]++;
+}
+
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *stream;
+
+	stream = per_cpu_ptr(zram->streams, raw_smp_processor_id());
+	mutex_lock(&stream->lock);
+
+	return stream;
+}
+
+static void zram_stream_put(struct zram_stream *stream)
+{
+	mutex_unlock(&stream->lock);
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,15 +330,148 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static u32 zram_checksum(void *mem)
+{
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_hash_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t size)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, size);
+	if (!entry->handle) {
+		kmem_cache_free(zram_entry_cache, entry);
+		return NULL;
+	}
+
+	INIT_HLIST_NODE(&entry->node);
+	entry->refcount = 1;
+	entry->size = size;
+
+	return entry;
+}
+
+/*
+ * Drop a reference to 'entry', freeing it with the last one. Returns
+ * the number of references left.
+ */
+static unsigned int zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, entry->checksum);
+	unsigned int refcount;
+
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		hlist_del_init(&entry->node);
+	spin_unlock(&hash->lock);
+
+	if (!refcount) {
+		zs_free(zram->mem_pool, entry->handle);
+		zram_stat64_sub(zram, &zram->stats.compr_size, entry->size);
+		kmem_cache_free(zram_entry_cache, entry);
+	}
+
+	return refcount;
+}
+
+/* Make a newly written entry findable by pages with the same contents */
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+				u32 checksum)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, checksum);
+
+	entry->checksum = checksum;
+	spin_lock(&hash->lock);
+	hlist_add_head(&entry->node, &hash->head);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Check that 'entry' really holds the contents of 'page'. Compressed
+ * objects are decompressed into 'buffer' to be compared; the output of a
+ * given backend is not relied on to be the same for the same input.
+ */
+static int zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+				struct page *page, void *buffer)
+{
+	int ret = 0, match = 0;
+	unsigned char *user_mem, *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->size != PAGE_SIZE) {
+		/* the mapping keeps us on this cpu */
+		ret = zram->backend->decompress(
+				this_cpu_ptr(zram->streams)->dprivate,
+				cmem, entry->size, buffer);
+		cmem = buffer;
+	}
+
+	if (!ret) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		match = !memcmp(cmem, user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER0);
+	}
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for a stored object with the contents of 'page' and take a
+ * reference to it. Only the first entry with a matching checksum is
+ * compared; a checksum collision costs a missed dedup, not a wrong one.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+				struct page *page, u32 checksum, void *buffer)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, checksum);
+	struct zram_entry *entry, *found = NULL;
+	struct hlist_node *pos;
+
+	spin_lock(&hash->lock);
+	hlist_for_each_entry(entry, pos, &hash->head, node) {
+		if (entry->checksum != checksum)
+			continue;
+		if (zram_dedup_match(zram, entry, page, buffer)) {
+			entry->refcount++;
+			found = entry;
+		}
+		break;
+	}
+	spin_unlock(&hash->lock);
+
+	return found;
+}
+
+/* Caller holds the slot lock */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry = zram->table[index].entry;
+	u16 size;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* a pending writeback of the old contents is dropped */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_bd_free_block(zram, zram->table[index].block);
+		atomic_dec(&zram->stats.bd_count);
+		zram->table[index].entry = NULL;
+		return;
+	}
 
-	if (unlikely(!page)) {
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -154,27 +484,19 @@ static void zram_free_page(struct zram *zram, size_t index)
 	}
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
-	}
-
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
+	} else if (entry->size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	/* once our reference is gone another writer may free the entry */
+	size = entry->size;
+	if (zram_entry_put(zram, entry))
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, size);
+
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].entry = NULL;
 }
 
 static void handle_zero_page(struct page *page)
@@ -191,17 +513,69 @@ static void handle_zero_page(struct page *page)
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
+	unsigned long handle = zram->table[index].entry->handle;
 	unsigned char *user_mem, *cmem;
 
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	flush_dcache_page(page);
+}
+
+/* Caller holds the slot lock */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	u64 start;
+	struct zram_entry *entry = zram->table[index].entry;
+	struct zram_stream *stream;
+	unsigned char *user_mem, *cmem;
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		handle_zero_page(page);
+		return 0;
+	}
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!entry)) {
+		pr_debug("Read before write: index=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		return 0;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	user_mem = kmap_atomic(page, KM_USER0);
+
+	/* the slot lock keeps us on this cpu */
+	stream = this_cpu_ptr(zram->streams);
+	start = local_clock();
+	ret = zram->backend->decompress(stream->dprivate, cmem,
+					entry->size, user_mem);
+	zram_hist_add(stream->decomp_hist, start);
+
+	kunmap_atomic(user_mem, KM_USER0);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
 
 	flush_dcache_page(page);
+	return 0;
 }
 
 static void zram_read(struct zram *zram, struct bio *bio)
@@ -215,68 +589,140 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+		int ret = 0;
+		unsigned long block = 0;
 
-		page = bvec->bv_page;
+		zram_lock_slot(zram, index);
+		zram_touch_slot(zram, index);
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+			block = zram->table[index].block;
+		else
+			ret = zram_read_page(zram, bvec->bv_page, index);
+		zram_unlock_slot(zram, index);
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+		/* the block stays ours until the slot is written or freed */
+		if (block)
+			ret = zram_bd_read(zram, bvec->bv_page, block);
+		if (ret)
+			goto out;
+		index++;
+	}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+out:
+	bio_io_error(bio);
+}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+/*
+ * Find the contents of 'page' already stored, or compress it with this
+ * cpu's stream and copy the result to newly allocated storage, then swap
+ * it into the slot. Only the last step is done with the slot locked, so
+ * writers to different slots proceed in parallel and a writer never
+ * sleeps holding a slot.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	u64 start;
+	u32 checksum;
+	size_t clen;
+	struct zram_entry *entry;
+	struct zram_stream *stream;
+	unsigned char *user_mem, *cmem;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_lock_slot(zram, index);
+		zram_free_page(zram, index);
+		zram_stat_inc(&zram->stats.pages_zero);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		zram_touch_slot(zram, index);
+		zram_unlock_slot(zram, index);
+		return 0;
+	}
+	checksum = zram_checksum(user_mem);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	stream = zram_stream_get(zram);
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	entry = zram_dedup_find(zram, page, checksum, stream->buffer);
+	if (entry) {
+		zram_stream_put(stream);
+		zram_stat64_inc(zram, &zram->stats.dedup_hits);
+		zram_stat64_add(zram, &zram->stats.dedup_saved, entry->size);
+		goto install;
+	}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	start = local_clock();
+	ret = zram->backend->compress(stream->private, user_mem,
+				      stream->buffer, &clen);
+	zram_hist_add(stream->comp_hist, start);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		flush_dcache_page(page);
-		index++;
+	if (unlikely(ret)) {
+		zram_stream_put(stream);
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size))
+		clen = PAGE_SIZE;
 
-out:
-	bio_io_error(bio);
+	entry = zram_entry_alloc(zram, clen);
+	if (!entry) {
+		zram_stream_put(stream);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		return -ENOMEM;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+	if (unlikely(clen == PAGE_SIZE)) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		memcpy(cmem, user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER0);
+	} else
+		memcpy(cmem, stream->buffer, clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	zram_stream_put(stream);
+
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_dedup_insert(zram, entry, checksum);
+
+install:
+	zram_lock_slot(zram, index);
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
+
+	zram->table[index].entry = entry;
+	zram_touch_slot(zram, index);
+	if (unlikely(entry->size == PAGE_SIZE)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	} else if (entry->size <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+
+	/* Update stats */
+	zram_stat_inc(&zram->stats.pages_stored);
+
+	zram_unlock_slot(zram, index);
+
+	return 0;
 }
 
 static void zram_write(struct zram *zram, struct bio *bio)
@@ -289,121 +735,225 @@ static void zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		if (zram_write_page(zram, bvec->bv_page, index)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
+		index++;
+	}
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+out:
+	bio_io_error(bio);
+}
 
-		mutex_lock(&zram->lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+#define ZRAM_WB_BATCH	32
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
+/* Caller holds the slot lock */
+static int zram_wb_candidate(struct zram *zram, u32 index,
+				enum zram_wb_mode mode, u32 now)
+{
+	if (zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+	    zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    !zram->table[index].entry)
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return now - zram->table[index].ac_time >= zram->idle_age;
+}
+
+/*
+ * Write 'pages', the contents of 'slots', to the backing device, one bio
+ * per run of consecutive blocks, and then point the slots at the blocks.
+ * Slots written or freed meanwhile have lost ZRAM_UNDER_WB and keep their
+ * new contents. Returns the number of pages written back, -ENOSPC if the
+ * device filled up, or another error if the writes failed.
+ */
+static int zram_wb_batch(struct zram *zram, struct page **pages,
+				u32 *slots, int nr)
+{
+	unsigned long blocks[ZRAM_WB_BATCH] = { 0 };
+	struct zram_bd_io io;
+	struct bio *bio = NULL;
+	int i, ret, written = 0, full = 0;
+
+	zram_bd_io_init(&io);
+	for (i = 0; i < nr; i++) {
+		blocks[i] = zram_bd_alloc_block(zram);
+		if (!blocks[i]) {
+			full = 1;
+			break;
+		}
+
+		/* extend the current bio while the blocks are consecutive */
+		if (bio && blocks[i] == blocks[i - 1] + 1 &&
+		    bio_add_page(bio, pages[i], PAGE_SIZE, 0) == PAGE_SIZE)
 			continue;
+		if (bio)
+			zram_bd_submit(&io, WRITE, bio);
+
+		bio = zram_bd_bio(zram, &io, blocks[i], nr - i);
+		if (!bio) {
+			zram_bd_free_block(zram, blocks[i]);
+			blocks[i] = 0;
+			break;
 		}
+		bio_add_page(bio, pages[i], PAGE_SIZE, 0);
+	}
+	if (bio)
+		zram_bd_submit(&io, WRITE, bio);
+	ret = zram_bd_wait(&io);
+
+	for (i = 0; i < nr; i++) {
+		zram_lock_slot(zram, slots[i]);
+		if (blocks[i] && !ret &&
+		    zram_test_flag(zram, slots[i], ZRAM_UNDER_WB)) {
+			zram_free_page(zram, slots[i]);
+			zram->table[slots[i]].block = blocks[i];
+			zram_set_flag(zram, slots[i], ZRAM_WB);
+			atomic_inc(&zram->stats.bd_count);
+			blocks[i] = 0;
+			written++;
+		} else
+			zram_clear_flag(zram, slots[i], ZRAM_UNDER_WB);
+		zram_unlock_slot(zram, slots[i]);
+
+		if (blocks[i])
+			zram_bd_free_block(zram, blocks[i]);
+	}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	zram_stat64_add(zram, &zram->stats.bd_writes, written);
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (ret) {
+		pr_err("Backing device write failed! err=%d\n", ret);
+		return -EIO;
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
+	return full ? -ENOSPC : written;
+}
+
+/*
+ * Move the pages selected by 'mode' to the backing device, in batches.
+ * Caller holds init_lock, and the device is initialized with a backing
+ * device attached. I/O to the device carries on meanwhile.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 slots[ZRAM_WB_BATCH];
+	size_t index, num_pages = zram->disksize >> PAGE_SHIFT;
+	u32 now = get_seconds();
+	int i, nr = 0, ret = 0;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
 			goto out;
 		}
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+	for (index = 0; index < num_pages && ret >= 0; index++) {
+		zram_lock_slot(zram, index);
+		if (!zram_wb_candidate(zram, index, mode, now) ||
+		    zram_read_page(zram, pages[nr], index)) {
+			zram_unlock_slot(zram, index);
+			continue;
 		}
-
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_unlock_slot(zram, index);
+
+		slots[nr++] = index;
+		if (nr == ZRAM_WB_BATCH) {
+			ret = zram_wb_batch(zram, pages, slots, nr);
+			nr = 0;
+			cond_resched();
 		}
+	}
 
-memstore:
-		zram->table[index].offset = offset;
+	if (nr)
+		ret = zram_wb_batch(zram, pages, slots, nr);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+out:
+	while (i--)
+		__free_page(pages[i]);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	return ret < 0 ? ret : 0;
+}
 
-		memcpy(cmem, src, clen);
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
 
-		mutex_unlock(&zram->lock);
-		index++;
+	kfree(zram->backing_dev);
+	zram->backing_dev = NULL;
+}
+
+/*
+ * Attach the block device at 'path', or detach the current one if 'path'
+ * is empty or "none". Caller holds init_lock and the device is not
+ * initialized.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_blocks;
+	int ret;
+
+	zram_reset_backing_dev(zram);
+	if (!*path || !strcmp(path, "none"))
+		return 0;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto fail;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	ret = -ENOMEM;
+	zram->bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!zram->bitmap)
+		goto fail;
+	zram->backing_dev = kstrdup(path, GFP_KERNEL);
+	if (!zram->backing_dev)
+		goto fail;
 
-out:
-	bio_io_error(bio);
+	__set_bit(0, zram->bitmap);
+	zram->nr_blocks = nr_blocks;
+	zram->bdev = bdev;
+
+	pr_info("Using %s as backing device, %lu pages\n", path, nr_blocks);
+	return 0;
+
+fail:
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
 }
+#else
+static inline void zram_reset_backing_dev(struct zram *zram) { }
+#endif
 
 /*
  * Check if request is within bounds and page aligned.
@@ -453,41 +1003,131 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
-void zram_reset_device(struct zram *zram)
+static void zram_free_streams(struct zram *zram)
 {
-	size_t index;
+	struct zram_stream *stream;
+	int cpu;
 
-	mutex_lock(&zram->init_lock);
-	zram->init_done = 0;
+	if (!zram->streams)
+		return;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(zram->streams, cpu);
+		if (stream->private)
+			zram->backend->destroy(stream->private);
+		if (stream->dprivate)
+			zram->backend->destroy(stream->dprivate);
+		free_pages((unsigned long)stream->buffer, 1);
+	}
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	free_percpu(zram->streams);
+	zram->streams = NULL;
+}
 
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+static int zram_alloc_streams(struct zram *zram)
+{
+	struct zram_stream *stream;
+	void *private;
+	int cpu;
+
+	zram->backend = zram_find_backend(zram->compressor);
+	if (!zram->backend) {
+		pr_err("Compression backend %s not available\n",
+			zram->compressor);
+		return -EINVAL;
+	}
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+	zram->streams = alloc_percpu(struct zram_stream);
+	if (!zram->streams) {
+		pr_err("Error allocating compression streams\n");
+		return -ENOMEM;
+	}
 
-		if (!page)
-			continue;
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(zram->streams, cpu);
+		mutex_init(&stream->lock);
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		private = zram->backend->create(zram->compressor, 0);
+		if (IS_ERR(private)) {
+			pr_err("Error allocating compressor working memory!\n");
+			return PTR_ERR(private);
+		}
+		stream->private = private;
+
+		private = zram->backend->create(zram->compressor, 1);
+		if (IS_ERR(private)) {
+			pr_err("Error allocating decompressor context!\n");
+			return PTR_ERR(private);
+		}
+		stream->dprivate = private;
+
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!stream->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/* Free the entries, but not the objects they point to */
+static void zram_free_hash(struct zram *zram)
+{
+	struct zram_entry *entry;
+	struct hlist_node *pos, *n;
+	size_t i;
+
+	if (!zram->hash)
+		return;
+
+	for (i = 0; i < zram->hash_size; i++) {
+		hlist_for_each_entry_safe(entry, pos, n,
+					  &zram->hash[i].head, node)
+			kmem_cache_free(zram_entry_cache, entry);
 	}
 
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
+
+static int zram_alloc_hash(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	zram->hash_size = roundup_pow_of_two(max_t(size_t,
+				num_pages / dedup_pages_per_bucket, 1));
+	zram->hash = vmalloc(zram->hash_size * sizeof(*zram->hash));
+	if (!zram->hash) {
+		zram->hash_size = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		INIT_HLIST_HEAD(&zram->hash[i].head);
+	}
+
+	return 0;
+}
+
+void zram_reset_device(struct zram *zram)
+{
+	mutex_lock(&zram->init_lock);
+	zram->init_done = 0;
+
+	zram_free_streams(zram);
+
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_free_hash(zram);
+	zram_reset_backing_dev(zram);
+
+	/* Frees all objects still in this zram device */
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,19 +1151,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_streams(zram);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +1165,18 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	ret = zram_alloc_hash(zram, num_pages);
+	if (ret) {
+		pr_err("Error allocating dedup hash\n");
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1202,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_lock_slot(zram, index);
 	zram_free_page(zram, index);
+	zram_unlock_slot(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1217,13 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	strlcpy(zram->compressor, "lzo", sizeof(zram->compressor));
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+	zram->idle_age = default_idle_age;
+#endif
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -641,6 +1283,8 @@ out:
 
 static void destroy_device(struct zram *zram)
 {
+	zram_reset_backing_dev(zram);
+
 	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
 			&zram_disk_attr_group);
 
@@ -664,11 +1308,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1348,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -718,6 +1370,7 @@ static void __exit zram_exit(void)
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
@@ -15,10 +15,12 @@
 #ifndef _ZRAM_DRV_H_
 #define _ZRAM_DRV_H_
 
+#include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zram_comp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +28,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -50,10 +40,13 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * Stored pages per dedup hash bucket, for a disk full of pages that
+ * all differ.
  */
+static const unsigned dedup_pages_per_bucket = 4;
+
+/* Default for how long a page must go unused to be idle, in seconds */
+static const unsigned default_idle_age = 3600;
 
 /*-- End of configurable params */
 
@@ -71,41 +64,102 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Slot is locked, see zram_lock_slot() */
+	ZRAM_ACCESS,
+
+	/* Page is stored on the backing device */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A compressed object in the pool. Pages with the same contents share
+ * one, so it is refcounted by the table entries pointing at it, and
+ * hashed on a checksum of the uncompressed page to be found again.
+ */
+struct zram_entry {
+	struct hlist_node node;	/* in zram->hash, by checksum */
+	u32 checksum;
+	unsigned int refcount;	/* protected by the hash bucket lock */
+	unsigned long handle;	/* zsmalloc handle */
+	u16 size;		/* object size in the pool */
+};
+
+/* One bucket of the dedup hash */
+struct zram_hash {
+	spinlock_t lock;
+	struct hlist_head head;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	union {
+		struct zram_entry *entry;	/* NULL if none */
+		unsigned long block;	/* backing device page, if ZRAM_WB */
+	};
+	unsigned long flags;	/* zram_pageflags; bit locked by ZRAM_ACCESS */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;		/* last access, in seconds */
+#endif
 } __attribute__((aligned(4)));
 
+/* Which pages zram_writeback() moves to the backing device */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,		/* stored uncompressed */
+	ZRAM_WB_IDLE,		/* not accessed for idle_age seconds */
+};
+
+/* Log2 nanosecond buckets, the last one open ended */
+#define ZRAM_HIST_BUCKETS	24
+
+/*
+ * Backend contexts and output buffer. One per possible cpu; writers use
+ * the one for the cpu they are running on, so the mutex is normally
+ * uncontended and only guards against preemption and migration. Readers
+ * use 'dprivate' and 'decomp_hist' with preemption disabled instead.
+ */
+struct zram_stream {
+	struct mutex lock;
+	void *private;		/* backend compression context */
+	void *buffer;		/* two pages, output may expand */
+	unsigned long comp_hist[ZRAM_HIST_BUCKETS];
+	void *dprivate;		/* backend decompression context */
+	unsigned long decomp_hist[ZRAM_HIST_BUCKETS];
+};
+
 struct zram_stats {
-	u64 compr_size;		/* compressed size of pages stored */
+	u64 compr_size;		/* compressed size of objects stored */
 	u64 num_reads;		/* failed + successful */
 	u64 num_writes;		/* --do-- */
 	u64 failed_reads;	/* should NEVER! happen */
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_hits;		/* writes that found their data stored */
+	u64 dedup_saved;	/* compressed bytes shared, not stored again */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+	atomic_t bd_count;	/* pages currently on the backing device */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	const struct zram_backend *backend;
+	struct zram_stream __percpu *streams;
 	struct table *table;
+	struct zram_hash *hash;
+	size_t hash_size;	/* power of two */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -117,6 +171,19 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 
+	/* Backend name, can only be changed while not initialized */
+	char compressor[ZRAM_COMP_NAME_LEN];
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device, can only be changed while not initialized */
+	struct block_device *bdev;
+	char *backing_dev;	/* path it was opened by */
+	unsigned long *bitmap;	/* backing device pages in use */
+	unsigned long nr_blocks;
+	spinlock_t bitmap_lock;
+	unsigned long idle_age;	/* seconds */
+#endif
+
 	struct zram_stats stats;
 };
 
@@ -128,5 +195,9 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
 
 #endif
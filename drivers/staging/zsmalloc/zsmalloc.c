@@ -0,0 +1,680 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are rounded up to one of a set of size classes, ZS_SIZE_CLASS_DELTA
+ * bytes apart, and each class carves groups of 1 to ZS_MAX_PAGES_PER_ZSPAGE
+ * order-0 pages ("zspages") into equal slots laid end to end. The number of
+ * pages per zspage is picked per class to waste as little as possible of the
+ * tail, which means slots are free to straddle a page boundary. Pages may be
+ * highmem; they are only ever mapped with kmap_atomic().
+ *
+ * Per zspage bookkeeping lives outside the pages, in struct zspage: an array
+ * with one word per slot holding either the handle of the object in it or,
+ * for a free slot, the index of the next free one. A handle points to a
+ * small slab object recording the object's zspage and slot, so compaction
+ * can move objects without their users noticing.
+ *
+ * Locking:
+ *  class->lock		- the class's zspage lists and each zspage's slots
+ *  pool->migrate_lock	- held for read while an object is mapped or freed,
+ *			  and for write while compaction moves objects
+ *
+ * Lock order: pool->migrate_lock -> class->lock
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/* a free slot's word holds the next free slot shifted over this tag */
+#define ZS_OBJ_FREE		1UL
+
+/* zspages by how many of their slots are used */
+enum zs_fullness {
+	ZS_ALMOST_FULL,		/* more than 3/4, not all */
+	ZS_ALMOST_EMPTY,	/* 3/4 or fewer, at least one */
+	ZS_FULL,
+	ZS_NR_FULLNESS,
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[ZS_NR_FULLNESS];
+	unsigned int size;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	unsigned long nr_zspages;	/* protected by lock */
+	unsigned long nr_objs;		/* protected by lock */
+};
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list */
+	struct size_class *class;
+	enum zs_fullness fullness;
+	unsigned int inuse;
+	unsigned int free_idx;		/* first free slot */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long objs[0];		/* handle or next free, per slot */
+};
+
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned int idx;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;
+	rwlock_t migrate_lock;
+	atomic_long_t pages_allocated;
+	struct size_class size_class[ZS_SIZE_CLASSES];
+};
+
+/* where zs_map_object() put the object this cpu has mapped */
+struct zs_map_area {
+	char *vm_buf;		/* PAGE_SIZE copy of a straddling object */
+	char *vm_addr;		/* kmap_atomic() address, if not straddling */
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+	enum zs_mapmode vm_mm;
+};
+
+static DEFINE_PER_CPU(struct zs_map_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+static DEFINE_MUTEX(zs_init_lock);
+static int zs_nr_pools;
+
+static unsigned int get_size_class_index(size_t size)
+{
+	if (size < ZS_MIN_ALLOC_SIZE)
+		size = ZS_MIN_ALLOC_SIZE;
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Number of pages per zspage that leaves the least unused space at the
+ * end, as a fraction of the zspage.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned long zspage_size = i * PAGE_SIZE;
+		unsigned long waste = zspage_size % size;
+		unsigned int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > best_usedpc) {
+			best_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static enum zs_fullness get_fullness(struct size_class *class,
+				     struct zspage *zspage)
+{
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * 4 <= class->objs_per_zspage * 3)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/* caller holds class->lock */
+static void fix_fullness(struct size_class *class, struct zspage *zspage)
+{
+	enum zs_fullness fullness = get_fullness(class, zspage);
+
+	if (fullness == zspage->fullness)
+		return;
+	list_move(&zspage->list, &class->fullness_list[fullness]);
+	zspage->fullness = fullness;
+}
+
+/* caller holds class->lock; fuller zspages first, to keep the rest emptying */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	struct list_head *head;
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (list_empty(head))
+		head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (list_empty(head))
+		return NULL;
+	return list_first_entry(head, struct zspage, list);
+}
+
+/* caller holds class->lock */
+static unsigned int obj_take(struct zspage *zspage)
+{
+	unsigned int idx = zspage->free_idx;
+
+	zspage->free_idx = zspage->objs[idx] >> 1;
+	zspage->inuse++;
+	return idx;
+}
+
+/* caller holds class->lock */
+static void obj_put(struct zspage *zspage, unsigned int idx)
+{
+	zspage->objs[idx] = (zspage->free_idx << 1) | ZS_OBJ_FREE;
+	zspage->free_idx = idx;
+	zspage->inuse--;
+}
+
+/*
+ * Copy the object in slot 'idx' to or from 'buf', a page at a time, so
+ * a slot across a page boundary needs no special casing.
+ */
+static void copy_obj(struct size_class *class, struct zspage *zspage,
+		     unsigned int idx, char *buf, int to_obj)
+{
+	unsigned long offset = (unsigned long)idx * class->size;
+	unsigned int size = class->size;
+	unsigned int off, len;
+	char *addr;
+
+	while (size) {
+		off = offset & ~PAGE_MASK;
+		len = min_t(unsigned int, size, PAGE_SIZE - off);
+		addr = kmap_atomic(zspage->pages[offset >> PAGE_SHIFT],
+				   KM_USER0);
+		if (to_obj)
+			memcpy(addr + off, buf, len);
+		else
+			memcpy(buf, addr + off, len);
+		kunmap_atomic(addr, KM_USER0);
+
+		buf += len;
+		offset += len;
+		size -= len;
+	}
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				   struct size_class *class)
+{
+	struct zspage *zspage;
+	unsigned int i;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			 class->objs_per_zspage * sizeof(zspage->objs[0]),
+			 pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_ALMOST_EMPTY;
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->objs[i] = ((i + 1) << 1) | ZS_OBJ_FREE;
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	struct size_class *class = zspage->class;
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+static int zs_init_areas(void)
+{
+	struct zs_map_area *area;
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		area = &per_cpu(zs_map_area, cpu);
+		area->vm_buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!area->vm_buf)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void zs_free_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).vm_buf);
+		per_cpu(zs_map_area, cpu).vm_buf = NULL;
+	}
+
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+	zs_handle_cachep = NULL;
+}
+
+/* the handle cache and map areas exist while there are pools */
+static int zs_get_areas(void)
+{
+	int ret = 0;
+
+	mutex_lock(&zs_init_lock);
+	if (!zs_nr_pools)
+		ret = zs_init_areas();
+	if (ret)
+		zs_free_areas();
+	else
+		zs_nr_pools++;
+	mutex_unlock(&zs_init_lock);
+
+	return ret;
+}
+
+static void zs_put_areas(void)
+{
+	mutex_lock(&zs_init_lock);
+	if (!--zs_nr_pools)
+		zs_free_areas();
+	mutex_unlock(&zs_init_lock);
+}
+
+/* free a zspage and the handles of whatever is still in it */
+static void destroy_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	struct size_class *class = zspage->class;
+	unsigned int idx;
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		if (zspage->objs[idx] & ZS_OBJ_FREE)
+			continue;
+		kmem_cache_free(zs_handle_cachep, (void *)zspage->objs[idx]);
+	}
+	free_zspage(pool, zspage);
+}
+
+/**
+ * zs_create_pool - create a pool to allocate compressed objects from
+ * @name: name of the pool, for messages
+ * @flags: gfp flags for the pool's pages
+ *
+ * Returns NULL on failure.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	struct zs_pool *pool;
+	struct size_class *class;
+	int i, j;
+
+	if (zs_get_areas())
+		return NULL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool) {
+		zs_put_areas();
+		return NULL;
+	}
+
+	pool->name = name;
+	pool->flags = flags;
+	rwlock_init(&pool->migrate_lock);
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		spin_lock_init(&class->lock);
+		for (j = 0; j < ZS_NR_FULLNESS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					 class->size;
+	}
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/**
+ * zs_destroy_pool - free a pool and anything still allocated from it
+ * @pool: pool to destroy
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	struct zspage *zspage, *next;
+	struct size_class *class;
+	unsigned int i, j;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		for (j = 0; j < ZS_NR_FULLNESS; j++) {
+			list_for_each_entry_safe(zspage, next,
+					&class->fullness_list[j], list)
+				destroy_zspage(pool, zspage);
+		}
+	}
+	kfree(pool);
+
+	zs_put_areas();
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - allocate a compressed object
+ * @pool: pool to allocate from
+ * @size: object size, at most PAGE_SIZE
+ *
+ * Returns an opaque handle for the object, or 0 on failure. The pool's
+ * gfp flags decide whether this may sleep.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct size_class *class;
+	struct zs_handle *handle;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cachep,
+				  pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (!zspage) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+		spin_lock(&class->lock);
+		list_add(&zspage->list,
+			 &class->fullness_list[ZS_ALMOST_EMPTY]);
+		class->nr_zspages++;
+	}
+
+	idx = obj_take(zspage);
+	zspage->objs[idx] = (unsigned long)handle;
+	handle->zspage = zspage;
+	handle->idx = idx;
+	class->nr_objs++;
+	fix_fullness(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/**
+ * zs_free - free an object allocated with zs_malloc()
+ * @pool: pool the object came from
+ * @handle: the object's handle
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zspage *zspage;
+	int empty = 0;
+
+	read_lock(&pool->migrate_lock);
+	zspage = h->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_put(zspage, h->idx);
+	class->nr_objs--;
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		class->nr_zspages--;
+		empty = 1;
+	} else
+		fix_fullness(class, zspage);
+	spin_unlock(&class->lock);
+	read_unlock(&pool->migrate_lock);
+
+	if (empty)
+		free_zspage(pool, zspage);
+	kmem_cache_free(zs_handle_cachep, h);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get a pointer to an object's data
+ * @pool: pool the object came from
+ * @handle: the object's handle
+ * @mm: how the object will be accessed
+ *
+ * The object stays mapped, and the caller atomic, until zs_unmap_object().
+ * Only one object may be mapped per cpu at a time.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct zs_map_area *area;
+	unsigned long offset;
+	unsigned int off;
+
+	read_lock(&pool->migrate_lock);
+
+	area = &get_cpu_var(zs_map_area);
+	area->zspage = h->zspage;
+	area->class = area->zspage->class;
+	area->idx = h->idx;
+	area->vm_mm = mm;
+
+	offset = (unsigned long)area->idx * area->class->size;
+	off = offset & ~PAGE_MASK;
+	if (off + area->class->size <= PAGE_SIZE) {
+		area->vm_addr = kmap_atomic(
+			area->zspage->pages[offset >> PAGE_SHIFT], KM_USER1);
+		return area->vm_addr + off;
+	}
+
+	/* this object straddles two pages */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		copy_obj(area->class, area->zspage, area->idx,
+			 area->vm_buf, 0);
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_map_area *area;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr)
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else if (area->vm_mm != ZS_MM_RO)
+		copy_obj(area->class, area->zspage, area->idx,
+			 area->vm_buf, 1);
+	put_cpu_var(zs_map_area);
+
+	read_unlock(&pool->migrate_lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* caller holds class->lock */
+static struct zspage *find_compact_src(struct size_class *class)
+{
+	struct zspage *zspage, *src = NULL;
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++)
+		list_for_each_entry(zspage, &class->fullness_list[i], list)
+			if (!src || zspage->inuse < src->inuse)
+				src = zspage;
+
+	return src;
+}
+
+/* caller holds class->lock */
+static struct zspage *find_compact_dst(struct size_class *class,
+				       struct zspage *src)
+{
+	struct zspage *zspage;
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++)
+		list_for_each_entry(zspage, &class->fullness_list[i], list)
+			if (zspage != src)
+				return zspage;
+
+	return NULL;
+}
+
+/*
+ * Move objects out of the least used zspage into another until one of
+ * them runs out. Returns the zspage if it ended up empty, to be freed by
+ * the caller, or NULL. Caller holds migrate_lock for write, so nothing
+ * is mapped, and class->lock.
+ */
+static struct zspage *compact_one(struct size_class *class,
+				  struct zspage *src, struct zspage *dst)
+{
+	char *buf = __get_cpu_var(zs_map_area).vm_buf;
+	struct zs_handle *h;
+	unsigned int sidx, didx;
+
+	for (sidx = 0; sidx < class->objs_per_zspage; sidx++) {
+		if (!src->inuse || dst->inuse == class->objs_per_zspage)
+			break;
+		if (src->objs[sidx] & ZS_OBJ_FREE)
+			continue;
+
+		h = (struct zs_handle *)src->objs[sidx];
+		copy_obj(class, src, sidx, buf, 0);
+		didx = obj_take(dst);
+		copy_obj(class, dst, didx, buf, 1);
+		dst->objs[didx] = (unsigned long)h;
+		h->zspage = dst;
+		h->idx = didx;
+		obj_put(src, sidx);
+	}
+
+	fix_fullness(class, dst);
+	if (src->inuse) {
+		fix_fullness(class, src);
+		return NULL;
+	}
+
+	list_del(&src->list);
+	class->nr_zspages--;
+	return src;
+}
+
+/**
+ * zs_compact - pack partly used zspages together and free the rest
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. May sleep between zspages.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	struct size_class *class;
+	struct zspage *src, *dst, *freed;
+	unsigned long pages = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		while (1) {
+			freed = NULL;
+			write_lock(&pool->migrate_lock);
+			spin_lock(&class->lock);
+
+			/* stop once the objects left would not fit in fewer */
+			if (class->nr_zspages <= DIV_ROUND_UP(class->nr_objs,
+						class->objs_per_zspage)) {
+				spin_unlock(&class->lock);
+				write_unlock(&pool->migrate_lock);
+				break;
+			}
+
+			src = find_compact_src(class);
+			dst = find_compact_dst(class, src);
+			if (src && dst)
+				freed = compact_one(class, src, dst);
+
+			spin_unlock(&class->lock);
+			write_unlock(&pool->migrate_lock);
+
+			if (!src || !dst)
+				break;
+			if (freed) {
+				free_zspage(pool, freed);
+				pages += class->pages_per_zspage;
+			}
+			cond_resched();
+		}
+	}
+
+	return pages;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("zsmalloc memory allocator");
@@ -47,6 +47,7 @@ struct nvhost_chip_support {
 			    struct nvhost_master *,
 			    int chid);
 		int (*submit)(struct nvhost_job *job);
+		int (*submit_mult)(struct nvhost_job **jobs, int num_jobs);
 		int (*read3dreg)(struct nvhost_channel *channel,
 				struct nvhost_hwctx *hwctx,
 				u32 offset,
@@ -142,5 +143,7 @@ struct nvhost_chip_support {
 
 int nvhost_init_t20_support(struct nvhost_master *host);
 int nvhost_init_t30_support(struct nvhost_master *host);
+int nvhost_init_sw_syncpt_support(struct nvhost_master *host);
+int nvhost_init_sw_cdma_support(struct nvhost_master *host);
 
 #endif /* _NVHOST_CHIP_SUPPORT_H_ */
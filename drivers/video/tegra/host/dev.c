@@ -60,6 +60,8 @@ struct nvhost_channel_userctx {
 	struct nvhost_submit_hdr_ext hdr;
 	int num_relocshifts;
 	struct nvhost_job *job;
+	struct nvhost_job *batch[NVHOST_MAX_BATCH_JOBS];
+	int num_batch;
 	struct nvmap_client *nvmap;
 	u32 timeout;
 	u32 priority;
@@ -110,6 +112,15 @@ static void trace_write_cmdbufs(struct nvhost_job *job)
 	}
 }
 
+static void drop_batch(struct nvhost_channel_userctx *ctx)
+{
+	while (ctx->num_batch) {
+		struct nvhost_job *job = ctx->batch[--ctx->num_batch];
+		nvhost_job_unpin(job);
+		nvhost_job_put(job);
+	}
+}
+
 static int nvhost_channelrelease(struct inode *inode, struct file *filp)
 {
 	struct nvhost_channel_userctx *priv = filp->private_data;
@@ -127,6 +138,8 @@ static int nvhost_channelrelease(struct inode *inode, struct file *filp)
 	if (priv->job)
 		nvhost_job_put(priv->job);
 
+	drop_batch(priv);
+
 	nvmap_client_put(priv->nvmap);
 	kfree(priv);
 	return 0;
@@ -356,6 +369,86 @@ static int nvhost_ioctl_channel_flush(
 	return err;
 }
 
+/*
+ * Pin the job written so far and put it aside, to be submitted with the
+ * other queued jobs by nvhost_ioctl_channel_submit_batch().
+ */
+static int nvhost_ioctl_channel_queue_job(
+	struct nvhost_channel_userctx *ctx)
+{
+	struct device *device = &ctx->ch->dev->pdev->dev;
+	struct nvhost_job *job;
+	int err;
+
+	if (!ctx->job ||
+	    ctx->hdr.num_relocs ||
+	    ctx->hdr.num_cmdbufs ||
+	    ctx->hdr.num_waitchks) {
+		reset_submit(ctx);
+		dev_err(device, "channel submit out of sync\n");
+		return -EFAULT;
+	}
+
+	if (ctx->num_batch == NVHOST_MAX_BATCH_JOBS)
+		return -ENOSPC;
+
+	/* the next job is written to a fresh one */
+	job = nvhost_job_alloc(ctx->ch, ctx->hwctx, &ctx->hdr,
+			NULL, ctx->priority, ctx->clientid);
+	if (!job)
+		return -ENOMEM;
+
+	err = nvhost_job_pin(ctx->job);
+	if (err) {
+		dev_warn(device, "nvhost_job_pin failed: %d\n", err);
+		nvhost_job_put(job);
+		return err;
+	}
+
+	ctx->job->null_kickoff = nvhost_debug_null_kickoff_pid == current->tgid;
+
+	trace_write_cmdbufs(ctx->job);
+
+	ctx->batch[ctx->num_batch++] = ctx->job;
+	ctx->job = job;
+	return 0;
+}
+
+static int nvhost_ioctl_channel_submit_batch(
+	struct nvhost_channel_userctx *ctx,
+	struct nvhost_submit_batch_args *args)
+{
+	u32 fences[NVHOST_MAX_BATCH_JOBS];
+	int i, err;
+
+	trace_nvhost_ioctl_channel_flush(ctx->ch->desc->name);
+
+	args->num_jobs = 0;
+	if (!ctx->num_batch)
+		return 0;
+
+	/* context switch if needed, and submit all jobs to the channel */
+	err = nvhost_channel_submit_mult(ctx->batch, ctx->num_batch);
+	if (err) {
+		drop_batch(ctx);
+		return err;
+	}
+
+	/* the sync queue holds its own references */
+	for (i = 0; i < ctx->num_batch; i++) {
+		fences[i] = ctx->batch[i]->syncpt_end;
+		nvhost_job_put(ctx->batch[i]);
+	}
+	args->num_jobs = ctx->num_batch;
+	ctx->num_batch = 0;
+
+	if (args->fences &&
+	    copy_to_user((void __user *)(uintptr_t)args->fences, fences,
+			 args->num_jobs * sizeof(u32)))
+		return -EFAULT;
+	return 0;
+}
+
 static int nvhost_ioctl_channel_read_3d_reg(
 	struct nvhost_channel_userctx *ctx,
 	struct nvhost_read_3d_reg_args *args)
@@ -391,6 +484,12 @@ static long nvhost_channelctl(struct file *filp,
 	case NVHOST_IOCTL_CHANNEL_NULL_KICKOFF:
 		err = nvhost_ioctl_channel_flush(priv, (void *)buf, 1);
 		break;
+	case NVHOST_IOCTL_CHANNEL_QUEUE_JOB:
+		err = nvhost_ioctl_channel_queue_job(priv);
+		break;
+	case NVHOST_IOCTL_CHANNEL_SUBMIT_BATCH:
+		err = nvhost_ioctl_channel_submit_batch(priv, (void *)buf);
+		break;
 	case NVHOST_IOCTL_CHANNEL_SUBMIT_EXT:
 	{
 		struct nvhost_submit_hdr_ext *hdr;
@@ -594,6 +693,21 @@ static int nvhost_ioctl_ctrl_syncpt_waitex(
 					args->thresh, timeout, &args->value);
 }
 
+static int nvhost_ioctl_ctrl_syncpt_fence_fd(
+	struct nvhost_ctrl_userctx *ctx,
+	struct nvhost_ctrl_syncpt_fence_fd_args *args)
+{
+	int fd;
+	if (args->id >= ctx->dev->syncpt.nb_pts)
+		return -EINVAL;
+	fd = nvhost_syncpt_create_fence_fd(&ctx->dev->syncpt, args->id,
+					   args->thresh);
+	if (fd < 0)
+		return fd;
+	args->fd = fd;
+	return 0;
+}
+
 static int nvhost_ioctl_ctrl_module_mutex(
 	struct nvhost_ctrl_userctx *ctx,
 	struct nvhost_ctrl_module_mutex_args *args)
@@ -713,6 +827,9 @@ static long nvhost_ctrlctl(struct file *filp,
 	case NVHOST_IOCTL_CTRL_GET_VERSION:
 		err = nvhost_ioctl_ctrl_get_version(priv, (void *)buf);
 		break;
+	case NVHOST_IOCTL_CTRL_SYNCPT_FENCE_FD:
+		err = nvhost_ioctl_ctrl_syncpt_fence_fd(priv, (void *)buf);
+		break;
 	default:
 		err = -ENOTTY;
 		break;
@@ -861,6 +978,17 @@ static int __devinit nvhost_init_chip_support(struct nvhost_master *host)
 	if (err)
 		return err;
 
+#ifdef CONFIG_TEGRA_GRHOST_SW_SYNCPT
+	err = nvhost_init_sw_syncpt_support(host);
+	if (err)
+		return err;
+#endif
+#ifdef CONFIG_TEGRA_GRHOST_SW_CDMA
+	err = nvhost_init_sw_cdma_support(host);
+	if (err)
+		return err;
+#endif
+
 	/* allocate items sized in chip specific support init */
 	host->channels = kzalloc(sizeof(struct nvhost_channel) *
 				 host->nb_channels, GFP_KERNEL);
@@ -167,28 +167,37 @@ static void stop_cdma_timer_locked(struct nvhost_cdma *cdma)
 	cdma->timeout.clientid = 0;
 }
 
+/* completed jobs handed from update_cdma_locked() to be unpinned unlocked */
+#define CDMA_UPDATE_BATCH 16
+
 /**
  * For all sync queue entries that have already finished according to the
  * current sync point registers:
- *  - unpin & unref their mems
  *  - pop their push buffer slots
  *  - remove them from the sync queue
- * This is normally called from the host code's worker thread, but can be
+ *  - return them in done, for the caller to unpin & unref once it has
+ *    dropped the lock, so submitters don't wait on the unpinning
+ * At most max entries are removed, returns the number removed.
+ * This is normally called from the host code's cleanup thread, but can be
  * called manually if necessary.
  * Must be called with the cdma lock held.
  */
-static void update_cdma_locked(struct nvhost_cdma *cdma)
+static int update_cdma_locked(struct nvhost_cdma *cdma,
+			      struct nvhost_job **done, int max)
 {
 	bool signal = false;
 	struct nvhost_master *dev = cdma_to_dev(cdma);
+	int nr_done = 0;
 
-	BUG_ON(!cdma->running);
+	/* a completion can still be delivered after the channel stopped */
+	if (!cdma->running)
+		return 0;
 
 	/*
 	 * Walk the sync queue, reading the sync point registers as necessary,
 	 * to consume as many sync queue entries as possible without blocking
 	 */
-	for (;;) {
+	while (nr_done < max) {
 		struct nvhost_syncpt *sp = &dev->syncpt;
 		struct nvhost_job *job;
 		int result;
@@ -215,9 +224,6 @@ static void update_cdma_locked(struct nvhost_cdma *cdma)
 		if (cdma->timeout.clientid)
 			stop_cdma_timer_locked(cdma);
 
-		/* Unpin the memory */
-		nvhost_job_unpin(job);
-
 		/* Pop push buffer slots */
 		if (job->num_slots) {
 			struct push_buffer *pb = &cdma->push_buffer;
@@ -227,7 +233,7 @@ static void update_cdma_locked(struct nvhost_cdma *cdma)
 				signal = true;
 		}
 
-		nvhost_job_put(job);
+		done[nr_done++] = job;
 		kfifo_skip(&cdma->sync_queue);
 		if (cdma->event == CDMA_EVENT_SYNC_QUEUE_SPACE)
 			signal = true;
@@ -238,6 +244,8 @@ static void update_cdma_locked(struct nvhost_cdma *cdma)
 		cdma->event = CDMA_EVENT_NONE;
 		up(&cdma->sem);
 	}
+
+	return nr_done;
 }
 
 void nvhost_cdma_update_sync_queue(struct nvhost_cdma *cdma,
@@ -419,19 +427,25 @@ void nvhost_cdma_deinit(struct nvhost_cdma *cdma)
 }
 
 /**
- * Begin a cdma submit
+ * Begin a batch of cdma submits, for the given jobs. Takes the cdma lock,
+ * each job is then pushed between nvhost_cdma_begin_job() and
+ * nvhost_cdma_end_job(), and nvhost_cdma_end_batch() kicks them all off
+ * at once.
  */
-int nvhost_cdma_begin(struct nvhost_cdma *cdma, struct nvhost_job *job)
+int nvhost_cdma_begin_batch(struct nvhost_cdma *cdma,
+		struct nvhost_job **jobs, int num_jobs)
 {
+	int i;
+
 	mutex_lock(&cdma->lock);
 
-	if (job->timeout) {
+	for (i = 0; i < num_jobs; i++) {
 		/* init state on first submit with timeout value */
-		if (!cdma->timeout.initialized) {
+		if (jobs[i]->timeout && !cdma->timeout.initialized) {
 			int err;
 			BUG_ON(!cdma_op(cdma).timeout_init);
 			err = cdma_op(cdma).timeout_init(cdma,
-				job->syncpt_id);
+				jobs[i]->syncpt_id);
 			if (err) {
 				mutex_unlock(&cdma->lock);
 				return err;
@@ -442,9 +456,28 @@ int nvhost_cdma_begin(struct nvhost_cdma *cdma, struct nvhost_job *job)
 		BUG_ON(!cdma_op(cdma).start);
 		cdma_op(cdma).start(cdma);
 	}
+	return 0;
+}
+
+/**
+ * Start pushing the next job of a batch
+ */
+void nvhost_cdma_begin_job(struct nvhost_cdma *cdma)
+{
 	cdma->slots_free = 0;
 	cdma->slots_used = 0;
 	cdma->first_get = cdma_pb_op(cdma).putptr(&cdma->push_buffer);
+}
+
+/**
+ * Begin a cdma submit
+ */
+int nvhost_cdma_begin(struct nvhost_cdma *cdma, struct nvhost_job *job)
+{
+	int err = nvhost_cdma_begin_batch(cdma, &job, 1);
+	if (err)
+		return err;
+	nvhost_cdma_begin_job(cdma);
 	return 0;
 }
 
@@ -480,24 +513,24 @@ void nvhost_cdma_push_gather(struct nvhost_cdma *cdma,
 }
 
 /**
- * End a cdma submit
- * Kick off DMA, add a contiguous block of memory handles to the sync queue,
- * and a number of slots to be freed from the pushbuffer.
- * Blocks as necessary if the sync queue is full.
- * The handles for a submit must all be pinned at the same time, but they
- * can be unpinned in smaller chunks.
+ * Finish pushing a job of a batch
+ * Add a contiguous block of memory handles to the sync queue, and a number
+ * of slots to be freed from the pushbuffer.
+ * Blocks as necessary if the sync queue is full, kicking off what has been
+ * pushed so far so that the queue can drain.
  */
-void nvhost_cdma_end(struct nvhost_cdma *cdma,
+void nvhost_cdma_end_job(struct nvhost_cdma *cdma,
 		struct nvhost_job *job)
 {
 	bool was_idle = kfifo_len(&cdma->sync_queue) == 0;
 
 	BUG_ON(!cdma_op(cdma).kick);
-	cdma_op(cdma).kick(cdma);
-
 	BUG_ON(job->syncpt_id == NVSYNCPT_INVALID);
 
-	nvhost_cdma_wait_locked(cdma, CDMA_EVENT_SYNC_QUEUE_SPACE);
+	if (!cdma_status_locked(cdma, CDMA_EVENT_SYNC_QUEUE_SPACE)) {
+		cdma_op(cdma).kick(cdma);
+		nvhost_cdma_wait_locked(cdma, CDMA_EVENT_SYNC_QUEUE_SPACE);
+	}
 	add_to_sync_queue(cdma,
 			job,
 			cdma->slots_used,
@@ -506,18 +539,53 @@ void nvhost_cdma_end(struct nvhost_cdma *cdma,
 	/* start timer on idle -> active transitions */
 	if (job->timeout && was_idle)
 		cdma_start_timer_locked(cdma, job);
+}
+
+/**
+ * End a batch of cdma submits
+ * Kick off DMA for all jobs of the batch and release the cdma lock.
+ */
+void nvhost_cdma_end_batch(struct nvhost_cdma *cdma)
+{
+	BUG_ON(!cdma_op(cdma).kick);
+	cdma_op(cdma).kick(cdma);
 
 	mutex_unlock(&cdma->lock);
 }
 
+/**
+ * End a cdma submit
+ * Kick off DMA, add a contiguous block of memory handles to the sync queue,
+ * and a number of slots to be freed from the pushbuffer.
+ * Blocks as necessary if the sync queue is full.
+ * The handles for a submit must all be pinned at the same time, but they
+ * can be unpinned in smaller chunks.
+ */
+void nvhost_cdma_end(struct nvhost_cdma *cdma,
+		struct nvhost_job *job)
+{
+	nvhost_cdma_end_job(cdma, job);
+	nvhost_cdma_end_batch(cdma);
+}
+
 /**
  * Update cdma state according to current sync point values
  */
 void nvhost_cdma_update(struct nvhost_cdma *cdma)
 {
-	mutex_lock(&cdma->lock);
-	update_cdma_locked(cdma);
-	mutex_unlock(&cdma->lock);
+	struct nvhost_job *done[CDMA_UPDATE_BATCH];
+	int i, nr_done;
+
+	do {
+		mutex_lock(&cdma->lock);
+		nr_done = update_cdma_locked(cdma, done, CDMA_UPDATE_BATCH);
+		mutex_unlock(&cdma->lock);
+
+		for (i = 0; i < nr_done; i++) {
+			nvhost_job_unpin(done[i]);
+			nvhost_job_put(done[i]);
+		}
+	} while (nr_done == CDMA_UPDATE_BATCH);
 }
 
 /**
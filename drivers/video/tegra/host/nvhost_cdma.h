@@ -46,6 +46,10 @@ struct nvhost_job;
  *	begin
  *		push - send ops to the push buffer
  *	end - start command DMA and enqueue handles to be unpinned
+ * or, for several jobs at once:
+ *	begin_batch
+ *		begin_job, push, end_job - for each job
+ *	end_batch - start command DMA
  * Consumer:
  *	update - call to update sync queue and push buffer, unpin memory
  */
@@ -118,6 +122,9 @@ int	nvhost_cdma_init(struct nvhost_cdma *cdma);
 void	nvhost_cdma_deinit(struct nvhost_cdma *cdma);
 void	nvhost_cdma_stop(struct nvhost_cdma *cdma);
 int	nvhost_cdma_begin(struct nvhost_cdma *cdma, struct nvhost_job *job);
+int	nvhost_cdma_begin_batch(struct nvhost_cdma *cdma,
+		struct nvhost_job **jobs, int num_jobs);
+void	nvhost_cdma_begin_job(struct nvhost_cdma *cdma);
 void	nvhost_cdma_push(struct nvhost_cdma *cdma, u32 op1, u32 op2);
 #define NVHOST_CDMA_PUSH_GATHER_CTXSAVE 0xffffffff
 void	nvhost_cdma_push_gather(struct nvhost_cdma *cdma,
@@ -125,6 +132,9 @@ void	nvhost_cdma_push_gather(struct nvhost_cdma *cdma,
 		struct nvmap_handle *handle, u32 op1, u32 op2);
 void	nvhost_cdma_end(struct nvhost_cdma *cdma,
 		struct nvhost_job *job);
+void	nvhost_cdma_end_job(struct nvhost_cdma *cdma,
+		struct nvhost_job *job);
+void	nvhost_cdma_end_batch(struct nvhost_cdma *cdma);
 void	nvhost_cdma_update(struct nvhost_cdma *cdma);
 int	nvhost_cdma_flush(struct nvhost_cdma *cdma, int timeout);
 void	nvhost_cdma_peek(struct nvhost_cdma *cdma,
@@ -0,0 +1,164 @@
+/*
+ * drivers/video/tegra/host/nvhost_cdma_sw.c
+ *
+ * Tegra Graphics Host Software Command DMA Model
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kfifo.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "nvhost_cdma.h"
+#include "nvhost_channel.h"
+#include "dev.h"
+
+/*
+ * Stands in for the channel DMA engines on top of the software syncpoints.
+ * The push buffer is still filled as usual, but instead of writing DMAPUT
+ * a kick schedules a work item that "executes" every job in the sync queue
+ * by incrementing its syncpoint up to the job's end value.  Completion and
+ * cleanup then run through the normal interrupt and sync queue code, so
+ * the cost of the submit path can be measured without host1x fetching
+ * anything.  Context save and restore buffers are not executed.
+ */
+
+#define SW_CDMA_NB_CHANNELS	8
+
+struct sw_cdma {
+	struct nvhost_cdma *cdma;
+	struct work_struct work;
+	struct nvhost_job **jobs;	/* snapshot of the sync queue */
+};
+
+static struct sw_cdma sw_cdma[SW_CDMA_NB_CHANNELS];
+
+static void sw_cdma_execute(struct work_struct *work)
+{
+	struct sw_cdma *sw = container_of(work, struct sw_cdma, work);
+	struct nvhost_cdma *cdma = sw->cdma;
+	struct nvhost_syncpt *sp = &cdma_to_dev(cdma)->syncpt;
+	unsigned int i, n;
+
+	mutex_lock(&cdma->lock);
+	n = kfifo_out_peek(&cdma->sync_queue, sw->jobs,
+			   cdma_to_dev(cdma)->sync_queue_size);
+	for (i = 0; i < n; i++) {
+		struct nvhost_job *job = sw->jobs[i];
+
+		while (!nvhost_syncpt_min_cmp(sp, job->syncpt_id,
+					      job->syncpt_end))
+			nvhost_syncpt_cpu_incr(sp, job->syncpt_id);
+	}
+	mutex_unlock(&cdma->lock);
+}
+
+static void sw_cdma_start(struct nvhost_cdma *cdma)
+{
+	if (cdma->running)
+		return;
+
+	cdma->last_put = cdma_pb_op(cdma).putptr(&cdma->push_buffer);
+	cdma->running = true;
+}
+
+static void sw_cdma_stop(struct nvhost_cdma *cdma)
+{
+	mutex_lock(&cdma->lock);
+	if (cdma->running) {
+		nvhost_cdma_wait_locked(cdma, CDMA_EVENT_SYNC_QUEUE_EMPTY);
+		cdma->running = false;
+	}
+	mutex_unlock(&cdma->lock);
+
+	cancel_work_sync(&sw_cdma[cdma_to_channel(cdma)->chid].work);
+}
+
+static void sw_cdma_kick(struct nvhost_cdma *cdma)
+{
+	struct sw_cdma *sw = &sw_cdma[cdma_to_channel(cdma)->chid];
+
+	cdma->last_put = cdma_pb_op(cdma).putptr(&cdma->push_buffer);
+	sw->cdma = cdma;
+	schedule_work(&sw->work);
+}
+
+/* the model never stalls, so a timeout means the submit itself is wrong */
+static void sw_cdma_timeout_handler(struct work_struct *work)
+{
+	struct nvhost_cdma *cdma = container_of(to_delayed_work(work),
+					struct nvhost_cdma, timeout.wq);
+
+	mutex_lock(&cdma->lock);
+	if (cdma->timeout.clientid)
+		dev_warn(&cdma_to_dev(cdma)->pdev->dev,
+			 "sw cdma: syncpt %d never reached %d\n",
+			 cdma->timeout.syncpt_id, cdma->timeout.syncpt_val);
+	cdma->timeout.ctx = NULL;
+	cdma->timeout.clientid = 0;
+	mutex_unlock(&cdma->lock);
+}
+
+static int sw_cdma_timeout_init(struct nvhost_cdma *cdma, u32 syncpt_id)
+{
+	if (syncpt_id == NVSYNCPT_INVALID)
+		return -EINVAL;
+
+	INIT_DELAYED_WORK(&cdma->timeout.wq, sw_cdma_timeout_handler);
+	cdma->timeout.initialized = true;
+	return 0;
+}
+
+static void sw_cdma_timeout_destroy(struct nvhost_cdma *cdma)
+{
+	if (cdma->timeout.initialized)
+		cancel_delayed_work(&cdma->timeout.wq);
+	cdma->timeout.initialized = false;
+}
+
+int nvhost_init_sw_cdma_support(struct nvhost_master *host)
+{
+	int i;
+
+	if (host->nb_channels > SW_CDMA_NB_CHANNELS)
+		return -EINVAL;
+
+	for (i = 0; i < host->nb_channels; i++) {
+		INIT_WORK(&sw_cdma[i].work, sw_cdma_execute);
+		sw_cdma[i].jobs = kcalloc(host->sync_queue_size,
+					  sizeof(struct nvhost_job *),
+					  GFP_KERNEL);
+		if (!sw_cdma[i].jobs)
+			goto fail;
+	}
+
+	host->op.cdma.start = sw_cdma_start;
+	host->op.cdma.stop = sw_cdma_stop;
+	host->op.cdma.kick = sw_cdma_kick;
+	host->op.cdma.timeout_init = sw_cdma_timeout_init;
+	host->op.cdma.timeout_destroy = sw_cdma_timeout_destroy;
+
+	return 0;
+
+fail:
+	while (i--) {
+		kfree(sw_cdma[i].jobs);
+		sw_cdma[i].jobs = NULL;
+	}
+	return -ENOMEM;
+}
@@ -44,6 +44,18 @@ int nvhost_channel_submit(struct nvhost_job *job)
 	return channel_op(job->ch).submit(job);
 }
 
+int nvhost_channel_submit_mult(struct nvhost_job **jobs, int num_jobs)
+{
+	struct nvhost_channel *ch = jobs[0]->ch;
+
+	if (jobs[0]->priority < NVHOST_PRIORITY_MEDIUM)
+		(void)nvhost_cdma_flush(&ch->cdma,
+				NVHOST_CHANNEL_LOW_PRIO_MAX_WAIT);
+
+	BUG_ON(!channel_op(ch).submit_mult);
+	return channel_op(ch).submit_mult(jobs, num_jobs);
+}
+
 struct nvhost_channel *nvhost_getchannel(struct nvhost_channel *ch)
 {
 	int err = 0;
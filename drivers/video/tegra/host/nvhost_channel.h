@@ -35,6 +35,7 @@
 #define NVHOST_MAX_GATHERS 512
 #define NVHOST_MAX_HANDLES 1280
 #define NVHOST_MAX_POWERGATE_IDS 2
+#define NVHOST_MAX_BATCH_JOBS 16
 
 struct nvhost_master;
 struct nvhost_waitchk;
@@ -80,6 +81,7 @@ int nvhost_channel_init(
 	struct nvhost_master *dev, int index);
 
 int nvhost_channel_submit(struct nvhost_job *job);
+int nvhost_channel_submit_mult(struct nvhost_job **jobs, int num_jobs);
 
 struct nvhost_channel *nvhost_getchannel(struct nvhost_channel *ch);
 void nvhost_putchannel(struct nvhost_channel *ch, struct nvhost_hwctx *ctx);
@@ -25,6 +25,7 @@
 #include <linux/interrupt.h>
 #include <linux/slab.h>
 #include <linux/irq.h>
+#include <linux/rbtree.h>
 #include <trace/events/nvhost.h>
 
 
@@ -34,6 +35,7 @@
 /*** Wait list management ***/
 
 struct nvhost_waitlist {
+	struct rb_node node;
 	struct list_head list;
 	struct kref refcount;
 	u32 thresh;
@@ -56,39 +58,53 @@ static void waiter_release(struct kref *kref)
 }
 
 /**
- * add a waiter to a waiter queue, sorted by threshold
+ * add a waiter to a waiter queue, sorted by threshold. Waiters with
+ * equal thresholds stay in the order they were added.
  * returns true if it was added at the head of the queue
  */
 static bool add_waiter_to_queue(struct nvhost_waitlist *waiter,
-				struct list_head *queue)
+				struct rb_root *queue)
 {
+	struct rb_node **link = &queue->rb_node;
+	struct rb_node *parent = NULL;
 	struct nvhost_waitlist *pos;
 	u32 thresh = waiter->thresh;
+	bool leftmost = true;
 
-	list_for_each_entry_reverse(pos, queue, list)
-		if ((s32)(pos->thresh - thresh) <= 0) {
-			list_add(&waiter->list, &pos->list);
-			return false;
+	while (*link) {
+		parent = *link;
+		pos = rb_entry(parent, struct nvhost_waitlist, node);
+		if ((s32)(thresh - pos->thresh) < 0) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
 		}
+	}
 
-	list_add(&waiter->list, queue);
-	return true;
+	rb_link_node(&waiter->node, parent, link);
+	rb_insert_color(&waiter->node, queue);
+	return leftmost;
 }
 
 /**
  * run through a waiter queue for a single sync point ID
  * and gather all completed waiters into lists by actions
  */
-static void remove_completed_waiters(struct list_head *head, u32 sync,
+static void remove_completed_waiters(struct rb_root *head, u32 sync,
 			struct list_head completed[NVHOST_INTR_ACTION_COUNT])
 {
 	struct list_head *dest;
-	struct nvhost_waitlist *waiter, *next, *prev;
+	struct nvhost_waitlist *waiter, *prev;
+	struct rb_node *node;
 
-	list_for_each_entry_safe(waiter, next, head, list) {
+	while ((node = rb_first(head)) != NULL) {
+		waiter = rb_entry(node, struct nvhost_waitlist, node);
 		if ((s32)(waiter->thresh - sync) > 0)
 			break;
 
+		rb_erase(&waiter->node, head);
+
 		dest = completed + waiter->action;
 
 		/* consolidate submit cleanups */
@@ -103,21 +119,19 @@ static void remove_completed_waiters(struct list_head *head, u32 sync,
 		}
 
 		/* PENDING->REMOVED or CANCELLED->HANDLED */
-		if (atomic_inc_return(&waiter->state) == WLS_HANDLED || !dest) {
-			list_del(&waiter->list);
+		if (atomic_inc_return(&waiter->state) == WLS_HANDLED || !dest)
 			kref_put(&waiter->refcount, waiter_release);
-		} else {
-			list_move_tail(&waiter->list, dest);
-		}
+		else
+			list_add_tail(&waiter->list, dest);
 	}
 }
 
 void reset_threshold_interrupt(struct nvhost_intr *intr,
-			       struct list_head *head,
+			       struct rb_root *head,
 			       unsigned int id)
 {
-	u32 thresh = list_first_entry(head,
-				struct nvhost_waitlist, list)->thresh;
+	u32 thresh = rb_entry(rb_first(head),
+				struct nvhost_waitlist, node)->thresh;
 	BUG_ON(!(intr_op(intr).set_syncpt_threshold &&
 		 intr_op(intr).enable_syncpt_intr));
 
@@ -129,13 +143,17 @@ void reset_threshold_interrupt(struct nvhost_intr *intr,
 static void action_submit_complete(struct nvhost_waitlist *waiter)
 {
 	struct nvhost_channel *channel = waiter->data;
+	struct nvhost_intr *intr = &channel->dev->intr;
 	int nr_completed = waiter->count;
 
 	/*  Add nr_completed to trace */
 	trace_nvhost_channel_submit_complete(channel->desc->name,
 			nr_completed);
 
-	nvhost_cdma_update(&channel->cdma);
+	/* leave the sync queue cleanup to the cleanup thread */
+	set_bit(channel->chid, &intr->cleanup_pending);
+	wake_up(&intr->cleanup_wq);
+
 	nvhost_module_idle_mult(&channel->mod, nr_completed);
 }
 
@@ -171,6 +189,11 @@ static void action_wakeup_interruptible(struct nvhost_waitlist *waiter)
 	wake_up_interruptible(wq);
 }
 
+static void action_signal_fence(struct nvhost_waitlist *waiter)
+{
+	nvhost_syncpt_fence_signal(waiter->data);
+}
+
 typedef void (*action_handler)(struct nvhost_waitlist *waiter);
 
 static action_handler action_handlers[NVHOST_INTR_ACTION_COUNT] = {
@@ -179,6 +202,7 @@ static action_handler action_handlers[NVHOST_INTR_ACTION_COUNT] = {
 	action_ctxrestore,
 	action_wakeup,
 	action_wakeup_interruptible,
+	action_signal_fence,
 };
 
 static void run_handlers(struct list_head completed[NVHOST_INTR_ACTION_COUNT])
@@ -217,7 +241,7 @@ static int process_wait_list(struct nvhost_intr *intr,
 
 	remove_completed_waiters(&syncpt->wait_head, threshold, completed);
 
-	empty = list_empty(&syncpt->wait_head);
+	empty = RB_EMPTY_ROOT(&syncpt->wait_head);
 	if (!empty)
 		reset_threshold_interrupt(intr, &syncpt->wait_head,
 					  syncpt->id);
@@ -259,6 +283,33 @@ static void free_syncpt_irq(struct nvhost_intr_syncpt *syncpt)
 }
 
 
+/*** submit cleanup ***/
+
+/**
+ * Retires completed submits of the channels flagged by
+ * action_submit_complete(), so that neither the syncpt interrupt threads
+ * nor the submitters wait on the unpinning.
+ */
+static int nvhost_intr_cleanup_thread(void *data)
+{
+	struct nvhost_intr *intr = data;
+	struct nvhost_master *host = intr_to_dev(intr);
+	unsigned long pending;
+	int chid;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(intr->cleanup_wq,
+				intr->cleanup_pending || kthread_should_stop());
+
+		pending = xchg(&intr->cleanup_pending, 0);
+		for_each_set_bit(chid, &pending, host->nb_channels)
+			nvhost_cdma_update(&host->channels[chid].cdma);
+	}
+
+	return 0;
+}
+
+
 /*** host general interrupt service functions ***/
 
 
@@ -312,7 +363,7 @@ int nvhost_intr_add_action(struct nvhost_intr *intr, u32 id, u32 thresh,
 		spin_lock(&syncpt->lock);
 	}
 
-	queue_was_empty = list_empty(&syncpt->wait_head);
+	queue_was_empty = RB_EMPTY_ROOT(&syncpt->wait_head);
 
 	if (add_waiter_to_queue(waiter, &syncpt->wait_head)) {
 		/* added at head of list - new threshold value */
@@ -362,6 +413,17 @@ int nvhost_intr_init(struct nvhost_intr *intr, u32 irq_gen, u32 irq_sync)
 	intr->host_general_irq = irq_gen;
 	intr->host_general_irq_requested = false;
 
+	BUG_ON(host->nb_channels > BITS_PER_LONG);
+	init_waitqueue_head(&intr->cleanup_wq);
+	intr->cleanup_pending = 0;
+	intr->cleanup_thread = kthread_run(nvhost_intr_cleanup_thread, intr,
+					   "nvhost_cleanup");
+	if (IS_ERR(intr->cleanup_thread)) {
+		int err = PTR_ERR(intr->cleanup_thread);
+		intr->cleanup_thread = NULL;
+		return err;
+	}
+
 	for (id = 0, syncpt = intr->syncpt;
 	     id < nb_pts;
 	     ++id, ++syncpt) {
@@ -370,7 +432,7 @@ int nvhost_intr_init(struct nvhost_intr *intr, u32 irq_gen, u32 irq_sync)
 		syncpt->irq = irq_sync + id;
 		syncpt->irq_requested = 0;
 		spin_lock_init(&syncpt->lock);
-		INIT_LIST_HEAD(&syncpt->wait_head);
+		syncpt->wait_head = RB_ROOT;
 		snprintf(syncpt->thresh_irq_name,
 			sizeof(syncpt->thresh_irq_name),
 			"host_sp_%02d", id);
@@ -382,6 +444,11 @@ int nvhost_intr_init(struct nvhost_intr *intr, u32 irq_gen, u32 irq_sync)
 void nvhost_intr_deinit(struct nvhost_intr *intr)
 {
 	nvhost_intr_stop(intr);
+
+	if (intr->cleanup_thread) {
+		kthread_stop(intr->cleanup_thread);
+		intr->cleanup_thread = NULL;
+	}
 }
 
 void nvhost_intr_start(struct nvhost_intr *intr, u32 hz)
@@ -417,16 +484,19 @@ void nvhost_intr_stop(struct nvhost_intr *intr)
 	for (id = 0, syncpt = intr->syncpt;
 	     id < nb_pts;
 	     ++id, ++syncpt) {
-		struct nvhost_waitlist *waiter, *next;
-		list_for_each_entry_safe(waiter, next, &syncpt->wait_head, list) {
+		struct nvhost_waitlist *waiter;
+		struct rb_node *node, *next;
+		for (node = rb_first(&syncpt->wait_head); node; node = next) {
+			next = rb_next(node);
+			waiter = rb_entry(node, struct nvhost_waitlist, node);
 			if (atomic_cmpxchg(&waiter->state, WLS_CANCELLED, WLS_HANDLED)
 				== WLS_CANCELLED) {
-				list_del(&waiter->list);
+				rb_erase(&waiter->node, &syncpt->wait_head);
 				kref_put(&waiter->refcount, waiter_release);
 			}
 		}
 
-		if (!list_empty(&syncpt->wait_head)) {  /* output diagnostics */
+		if (!RB_EMPTY_ROOT(&syncpt->wait_head)) {  /* output diagnostics */
 			printk(KERN_DEBUG "%s id=%d\n", __func__, id);
 			BUG_ON(1);
 		}
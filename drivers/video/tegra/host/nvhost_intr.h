@@ -26,6 +26,7 @@
 #include <linux/kthread.h>
 #include <linux/semaphore.h>
 #include <linux/interrupt.h>
+#include <linux/rbtree.h>
 
 struct nvhost_channel;
 
@@ -60,6 +61,12 @@ enum nvhost_intr_action {
 	 */
 	NVHOST_INTR_ACTION_WAKEUP_INTERRUPTIBLE,
 
+	/**
+	 * Signal a syncpt fence file and let the host idle.
+	 * 'data' points to a struct nvhost_syncpt_fence
+	 */
+	NVHOST_INTR_ACTION_SIGNAL_FENCE,
+
 	NVHOST_INTR_ACTION_COUNT
 };
 
@@ -71,7 +78,7 @@ struct nvhost_intr_syncpt {
 	u8 irq_requested;
 	u16 irq;
 	spinlock_t lock;
-	struct list_head wait_head;
+	struct rb_root wait_head;
 	char thresh_irq_name[12];
 };
 
@@ -80,6 +87,9 @@ struct nvhost_intr {
 	struct mutex mutex;
 	int host_general_irq;
 	bool host_general_irq_requested;
+	struct task_struct *cleanup_thread;
+	wait_queue_head_t cleanup_wq;
+	unsigned long cleanup_pending;	/* channels with completed submits */
 };
 #define intr_to_dev(x) container_of(x, struct nvhost_master, intr)
 #define intr_op(intr) (intr_to_dev(intr)->op.intr)
@@ -21,11 +21,19 @@
  */
 
 #include <linux/nvhost_ioctl.h>
+#include <linux/anon_inodes.h>
+#include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
 #include "nvhost_syncpt.h"
 #include "dev.h"
 
 #define MAX_STUCK_CHECK_COUNT 15
 
+/* how long to spin on the register before setting up an interrupt */
+#define SYNCPT_POLL_USECS 20
+
 /**
  * Resets syncpoint and waitbase values to sw shadows
  */
@@ -128,6 +136,7 @@ int nvhost_syncpt_wait_timeout(struct nvhost_syncpt *sp, u32 id,
 	void *ref;
 	void *waiter;
 	int err = 0, check_count = 0, low_timeout = 0;
+	int poll;
 
 	if (value)
 		*value = 0;
@@ -153,12 +162,19 @@ int nvhost_syncpt_wait_timeout(struct nvhost_syncpt *sp, u32 id,
 	nvhost_module_busy(&syncpt_to_dev(sp)->mod);
 
 	if (client_managed(id) || !nvhost_syncpt_min_eq_max(sp, id)) {
-		/* try to read from register */
-		u32 val = syncpt_op(sp).update_min(sp, id);
-		if ((s32)(val - thresh) >= 0) {
-			if (value)
-				*value = val;
-			goto done;
+		/* try to read from register. A wait that is about to be met
+		 * is cheaper to spin on than to allocate a waiter and take
+		 * an interrupt for. */
+		for (poll = 0; ; poll++) {
+			u32 val = syncpt_op(sp).update_min(sp, id);
+			if ((s32)(val - thresh) >= 0) {
+				if (value)
+					*value = val;
+				goto done;
+			}
+			if (!timeout || poll == SYNCPT_POLL_USECS)
+				break;
+			udelay(1);
 		}
 	}
 
@@ -230,6 +246,124 @@ done:
 	return err;
 }
 
+/*** Fences ***/
+
+struct nvhost_syncpt_fence {
+	struct nvhost_syncpt *sp;
+	u32 id;
+	u32 thresh;
+	wait_queue_head_t wq;
+	void *ref;		/* waiter, NULL if none was needed */
+	atomic_t busy;		/* holding the host powered for the waiter */
+};
+
+static void fence_idle(struct nvhost_syncpt_fence *fence)
+{
+	if (atomic_xchg(&fence->busy, 0))
+		nvhost_module_idle(&syncpt_to_dev(fence->sp)->mod);
+}
+
+/**
+ * Called from the interrupt thread once the fence has signaled: wake the
+ * pollers and let the host idle, whether or not the fd is polled again.
+ */
+void nvhost_syncpt_fence_signal(struct nvhost_syncpt_fence *fence)
+{
+	wake_up_interruptible(&fence->wq);
+	fence_idle(fence);
+}
+
+static unsigned int fence_poll(struct file *filp, poll_table *wait)
+{
+	struct nvhost_syncpt_fence *fence = filp->private_data;
+
+	poll_wait(filp, &fence->wq, wait);
+
+	if (!nvhost_syncpt_min_cmp(fence->sp, fence->id, fence->thresh))
+		return 0;
+	return POLLIN | POLLRDNORM;
+}
+
+/* nvhost_intr_put_ref waits for a running action, so the fence can go */
+static void fence_free(struct nvhost_syncpt_fence *fence)
+{
+	if (fence->ref)
+		nvhost_intr_put_ref(&syncpt_to_dev(fence->sp)->intr,
+				    fence->ref);
+	fence_idle(fence);
+	kfree(fence);
+}
+
+static int fence_release(struct inode *inode, struct file *filp)
+{
+	fence_free(filp->private_data);
+	return 0;
+}
+
+static const struct file_operations nvhost_syncpt_fence_fops = {
+	.owner = THIS_MODULE,
+	.poll = fence_poll,
+	.release = fence_release,
+};
+
+/**
+ * Create a file descriptor that polls readable once syncpoint id reaches
+ * thresh, so that userspace can wait for many syncpoints with poll or
+ * epoll. The host is kept powered until the syncpoint is reached or the
+ * descriptor is closed. Returns the descriptor or a negative error code.
+ */
+int nvhost_syncpt_create_fence_fd(struct nvhost_syncpt *sp, u32 id,
+				  u32 thresh)
+{
+	struct nvhost_master *host = syncpt_to_dev(sp);
+	struct nvhost_syncpt_fence *fence;
+	void *waiter;
+	int err;
+
+	BUG_ON(!syncpt_op(sp).update_min);
+	if (!nvhost_syncpt_check_max(sp, id, thresh))
+		return -EINVAL;
+
+	fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+	if (!fence)
+		return -ENOMEM;
+	fence->sp = sp;
+	fence->id = id;
+	fence->thresh = thresh;
+	init_waitqueue_head(&fence->wq);
+
+	if (!nvhost_syncpt_min_cmp(sp, id, thresh)) {
+		/* keep host alive until the waiter has fired */
+		nvhost_module_busy(&host->mod);
+		atomic_set(&fence->busy, 1);
+
+		if ((s32)(syncpt_op(sp).update_min(sp, id) - thresh) < 0) {
+			waiter = nvhost_intr_alloc_waiter();
+			if (!waiter) {
+				err = -ENOMEM;
+				goto fail;
+			}
+			err = nvhost_intr_add_action(&host->intr, id, thresh,
+					NVHOST_INTR_ACTION_SIGNAL_FENCE,
+					fence, waiter, &fence->ref);
+			if (err)
+				goto fail;
+		} else {
+			fence_idle(fence);
+		}
+	}
+
+	err = anon_inode_getfd("nvhost-fence", &nvhost_syncpt_fence_fops,
+			       fence, O_RDONLY | O_CLOEXEC);
+	if (err < 0)
+		goto fail;
+	return err;
+
+fail:
+	fence_free(fence);
+	return err;
+}
+
 void nvhost_syncpt_debug(struct nvhost_syncpt *sp)
 {
 	syncpt_op(sp).debug(sp);
@@ -157,6 +157,12 @@ int nvhost_syncpt_wait_check(struct nvhost_syncpt *sp,
 			struct nvhost_waitchk *wait,
 			int num_waitchk);
 
+int nvhost_syncpt_create_fence_fd(struct nvhost_syncpt *sp, u32 id,
+				  u32 thresh);
+
+struct nvhost_syncpt_fence;
+void nvhost_syncpt_fence_signal(struct nvhost_syncpt_fence *fence);
+
 void nvhost_syncpt_debug(struct nvhost_syncpt *sp);
 
 #endif
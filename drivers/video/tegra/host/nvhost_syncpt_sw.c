@@ -0,0 +1,161 @@
+/*
+ * drivers/video/tegra/host/nvhost_syncpt_sw.c
+ *
+ * Tegra Graphics Host Software Emulated Syncpoints
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/bitops.h>
+#include <linux/workqueue.h>
+
+#include "nvhost_syncpt.h"
+#include "nvhost_intr.h"
+#include "dev.h"
+
+/*
+ * Replaces the syncpoint registers and threshold interrupts with their
+ * software shadows. CPU increments are the only thing that moves a
+ * syncpoint, and a work item stands in for the threshold interrupt, so
+ * waiters, fences and the wait list handling can be exercised without
+ * touching host1x. Channel submits only complete when the software
+ * command DMA model is used as well.
+ */
+
+#define SW_SYNCPT_NB_PTS	32
+
+struct sw_syncpt {
+	struct nvhost_master *host;
+	struct work_struct work;
+	unsigned long enabled;
+	u32 thresh[SW_SYNCPT_NB_PTS];
+};
+
+static struct sw_syncpt sw_syncpt;
+
+static void sw_syncpt_work(struct work_struct *work)
+{
+	struct nvhost_master *host = sw_syncpt.host;
+	struct nvhost_syncpt *sp = &host->syncpt;
+	unsigned int id;
+
+	for (id = 0; id < sp->nb_pts; id++) {
+		if (!test_bit(id, &sw_syncpt.enabled))
+			continue;
+		if (!nvhost_syncpt_min_cmp(sp, id,
+				ACCESS_ONCE(sw_syncpt.thresh[id])))
+			continue;
+		/* the wait list handling re-arms the threshold if needed */
+		if (test_and_clear_bit(id, &sw_syncpt.enabled))
+			nvhost_syncpt_thresh_fn(0, &host->intr.syncpt[id]);
+	}
+}
+
+static void sw_syncpt_noop(struct nvhost_syncpt *sp, u32 id)
+{
+}
+
+static u32 sw_syncpt_update_min(struct nvhost_syncpt *sp, u32 id)
+{
+	return nvhost_syncpt_read_min(sp, id);
+}
+
+static void sw_syncpt_cpu_incr(struct nvhost_syncpt *sp, u32 id)
+{
+	atomic_inc(&sp->min_val[id]);
+	smp_mb__after_atomic_inc();
+	if (test_bit(id, &sw_syncpt.enabled))
+		schedule_work(&sw_syncpt.work);
+}
+
+static void sw_intr_noop(struct nvhost_intr *intr)
+{
+}
+
+static void sw_intr_set_host_clocks_per_usec(struct nvhost_intr *intr,
+					     u32 cpm)
+{
+}
+
+static void sw_intr_set_syncpt_threshold(struct nvhost_intr *intr,
+					 u32 id, u32 thresh)
+{
+	sw_syncpt.thresh[id] = thresh;
+}
+
+static void sw_intr_enable_syncpt_intr(struct nvhost_intr *intr, u32 id)
+{
+	struct nvhost_syncpt *sp = &intr_to_dev(intr)->syncpt;
+
+	/* test_and_set_bit orders against the increment in cpu_incr */
+	test_and_set_bit(id, &sw_syncpt.enabled);
+	if (nvhost_syncpt_min_cmp(sp, id, sw_syncpt.thresh[id]))
+		schedule_work(&sw_syncpt.work);
+}
+
+static void sw_intr_disable_all_syncpt_intrs(struct nvhost_intr *intr)
+{
+	struct nvhost_master *host = intr_to_dev(intr);
+	unsigned int id;
+
+	sw_syncpt.enabled = 0;
+	smp_wmb();
+
+	/* there is no real irq for nvhost_intr_stop to free */
+	for (id = 0; id < host->syncpt.nb_pts; id++)
+		intr->syncpt[id].irq_requested = 0;
+}
+
+static int sw_intr_request_host_general_irq(struct nvhost_intr *intr)
+{
+	return 0;
+}
+
+static int sw_request_syncpt_irq(struct nvhost_intr_syncpt *syncpt)
+{
+	syncpt->irq_requested = 1;
+	return 0;
+}
+
+int nvhost_init_sw_syncpt_support(struct nvhost_master *host)
+{
+	if (host->syncpt.nb_pts > SW_SYNCPT_NB_PTS)
+		return -EINVAL;
+
+	sw_syncpt.host = host;
+	INIT_WORK(&sw_syncpt.work, sw_syncpt_work);
+
+	host->op.syncpt.reset = sw_syncpt_noop;
+	host->op.syncpt.reset_wait_base = sw_syncpt_noop;
+	host->op.syncpt.read_wait_base = sw_syncpt_noop;
+	host->op.syncpt.update_min = sw_syncpt_update_min;
+	host->op.syncpt.cpu_incr = sw_syncpt_cpu_incr;
+
+	host->op.intr.init_host_sync = sw_intr_noop;
+	host->op.intr.set_host_clocks_per_usec =
+		sw_intr_set_host_clocks_per_usec;
+	host->op.intr.set_syncpt_threshold = sw_intr_set_syncpt_threshold;
+	host->op.intr.enable_syncpt_intr = sw_intr_enable_syncpt_intr;
+	host->op.intr.disable_all_syncpt_intrs =
+		sw_intr_disable_all_syncpt_intrs;
+	host->op.intr.request_host_general_irq =
+		sw_intr_request_host_general_irq;
+	host->op.intr.free_host_general_irq = sw_intr_noop;
+	host->op.intr.request_syncpt_irq = sw_request_syncpt_irq;
+
+	return 0;
+}
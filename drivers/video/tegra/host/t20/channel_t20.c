@@ -192,40 +192,99 @@ static void t20_channel_sync_waitbases(struct nvhost_channel *ch, u32 syncpt_val
 	}
 }
 
-static int t20_channel_submit(struct nvhost_job *job)
+/*
+ * Schedule a context save interrupt (to drain the host FIFO if necessary,
+ * and to release the restore buffer) and a context restore interrupt for
+ * the first job of a submit.
+ */
+static void t20_channel_add_ctx_actions(struct nvhost_channel *channel,
+		struct nvhost_job *job,
+		struct nvhost_hwctx *hwctx_to_save, void **ctxsave_waiter,
+		bool need_restore, void **ctxrestore_waiter,
+		u32 user_syncpt_incrs)
 {
+	int err;
+
+	if (hwctx_to_save) {
+		err = nvhost_intr_add_action(&channel->dev->intr,
+			job->syncpt_id,
+			job->syncpt_end - job->syncpt_incrs
+				+ hwctx_to_save->save_thresh,
+			NVHOST_INTR_ACTION_CTXSAVE, hwctx_to_save,
+			*ctxsave_waiter,
+			NULL);
+		*ctxsave_waiter = NULL;
+		WARN(err, "Failed to set ctx save interrupt");
+	}
+
+	if (need_restore) {
+		BUG_ON(!*ctxrestore_waiter);
+		err = nvhost_intr_add_action(&channel->dev->intr,
+			job->syncpt_id,
+			job->syncpt_end - user_syncpt_incrs,
+			NVHOST_INTR_ACTION_CTXRESTORE, channel->cur_ctx,
+			*ctxrestore_waiter,
+			NULL);
+		*ctxrestore_waiter = NULL;
+		WARN(err, "Failed to set ctx restore interrupt");
+	}
+}
+
+/*
+ * Submit a batch of jobs of the same client to its channel, under a single
+ * hold of the submit and cdma locks and with a single kick at the end.
+ * Only the first job can cause a context switch, as all jobs share the
+ * context.
+ */
+static int t20_channel_submit_mult(struct nvhost_job **jobs, int num_jobs)
+{
+	struct nvhost_job *job = jobs[0];
 	struct nvhost_hwctx *hwctx_to_save = NULL;
 	struct nvhost_channel *channel = job->ch;
 	struct nvhost_syncpt *sp = &job->ch->dev->syncpt;
-	u32 user_syncpt_incrs = job->syncpt_incrs;
+	u32 user_syncpt_incrs;
+	u32 first_user_syncpt_incrs = job->syncpt_incrs;
 	bool need_restore = false;
 	u32 syncval;
-	int err;
+	int err, i;
 	void *ctxrestore_waiter = NULL;
-	void *ctxsave_waiter, *completed_waiter;
+	void *ctxsave_waiter;
+	void *completed_waiters[NVHOST_MAX_BATCH_JOBS] = { NULL };
+
+	BUG_ON(num_jobs < 1 || num_jobs > NVHOST_MAX_BATCH_JOBS);
 
 	if (job->hwctx && job->hwctx->has_timedout)
 		return -ETIMEDOUT;
 
 	ctxsave_waiter = nvhost_intr_alloc_waiter();
-	completed_waiter = nvhost_intr_alloc_waiter();
-	if (!ctxsave_waiter || !completed_waiter) {
+	if (!ctxsave_waiter) {
 		err = -ENOMEM;
 		goto done;
 	}
+	for (i = 0; i < num_jobs; i++) {
+		BUG_ON(jobs[i]->ch != channel || jobs[i]->hwctx != job->hwctx);
+		completed_waiters[i] = nvhost_intr_alloc_waiter();
+		if (!completed_waiters[i]) {
+			err = -ENOMEM;
+			goto done;
+		}
+	}
 
-	/* keep module powered */
-	nvhost_module_busy(&channel->mod);
-	if (channel->mod.desc->busy)
-		channel->mod.desc->busy(&channel->mod);
+	/* keep module powered, once for each job */
+	for (i = 0; i < num_jobs; i++) {
+		nvhost_module_busy(&channel->mod);
+		if (channel->mod.desc->busy)
+			channel->mod.desc->busy(&channel->mod);
 
-	/* before error checks, return current max */
-	job->syncpt_end = nvhost_syncpt_read_max(sp, job->syncpt_id);
+		/* before error checks, return current max */
+		jobs[i]->syncpt_end =
+			nvhost_syncpt_read_max(sp, jobs[i]->syncpt_id);
+	}
 
 	/* get submit lock */
 	err = mutex_lock_interruptible(&channel->submitlock);
 	if (err) {
-		nvhost_module_idle(&channel->mod);
+		nvhost_module_idle_mult(&channel->mod, num_jobs);
 		goto done;
 	}
 
@@ -234,7 +293,7 @@ static int t20_channel_submit(struct nvhost_job *job)
 		ctxrestore_waiter = nvhost_intr_alloc_waiter();
 		if (!ctxrestore_waiter) {
 			mutex_unlock(&channel->submitlock);
-			nvhost_module_idle(&channel->mod);
+			nvhost_module_idle_mult(&channel->mod, num_jobs);
 			err = -ENOMEM;
 			goto done;
 		}
@@ -242,100 +301,122 @@ static int t20_channel_submit(struct nvhost_job *job)
 	}
 
 	/* remove stale waits */
-	if (job->num_waitchk) {
+	for (i = 0; i < num_jobs; i++) {
+		if (!jobs[i]->num_waitchk)
+			continue;
 		err = nvhost_syncpt_wait_check(sp,
-					       job->nvmap,
-					       job->waitchk_mask,
-					       job->waitchk,
-					       job->num_waitchk);
+					       jobs[i]->nvmap,
+					       jobs[i]->waitchk_mask,
+					       jobs[i]->waitchk,
+					       jobs[i]->num_waitchk);
 		if (err) {
 			dev_warn(&channel->dev->pdev->dev,
 				 "nvhost_syncpt_wait_check failed: %d\n", err);
 			mutex_unlock(&channel->submitlock);
-			nvhost_module_idle(&channel->mod);
+			nvhost_module_idle_mult(&channel->mod, num_jobs);
 			goto done;
 		}
 	}
 
 	/* begin a CDMA submit */
-	err = nvhost_cdma_begin(&channel->cdma, job);
+	err = nvhost_cdma_begin_batch(&channel->cdma, jobs, num_jobs);
 	if (err) {
 		mutex_unlock(&channel->submitlock);
-		nvhost_module_idle(&channel->mod);
+		nvhost_module_idle_mult(&channel->mod, num_jobs);
 		goto done;
 	}
 
-	t20_channel_sync_waitbases(channel, job->syncpt_end);
-
-	/* context switch */
-	if (channel->cur_ctx != job->hwctx) {
-		trace_nvhost_channel_context_switch(channel->desc->name,
-		  channel->cur_ctx, job->hwctx);
-		hwctx_to_save = channel->cur_ctx;
-		if (hwctx_to_save &&
-			hwctx_to_save->has_timedout) {
-			hwctx_to_save = NULL;
-			dev_dbg(&channel->dev->pdev->dev,
-				"%s: skip save of timed out context (0x%p)\n",
-				__func__, channel->cur_ctx);
-		}
-		if (hwctx_to_save) {
-			job->syncpt_incrs += hwctx_to_save->save_incrs;
-			hwctx_to_save->valid = true;
-			channel->ctxhandler.get(hwctx_to_save);
+	for (i = 0; i < num_jobs; i++) {
+		job = jobs[i];
+		user_syncpt_incrs = job->syncpt_incrs;
+
+		nvhost_cdma_begin_job(&channel->cdma);
+
+		/* earlier jobs of the batch have moved max */
+		if (i)
+			job->syncpt_end =
+				nvhost_syncpt_read_max(sp, job->syncpt_id);
+
+		t20_channel_sync_waitbases(channel, job->syncpt_end);
+
+		/* context switch */
+		if (channel->cur_ctx != job->hwctx) {
+			trace_nvhost_channel_context_switch(channel->desc->name,
+			  channel->cur_ctx, job->hwctx);
+			hwctx_to_save = channel->cur_ctx;
+			if (hwctx_to_save &&
+				hwctx_to_save->has_timedout) {
+				hwctx_to_save = NULL;
+				dev_dbg(&channel->dev->pdev->dev,
+					"%s: skip save of timed out context (0x%p)\n",
+					__func__, channel->cur_ctx);
+			}
+			if (hwctx_to_save) {
+				job->syncpt_incrs += hwctx_to_save->save_incrs;
+				hwctx_to_save->valid = true;
+				channel->ctxhandler.get(hwctx_to_save);
+			}
+			channel->cur_ctx = job->hwctx;
+			if (need_restore)
+				job->syncpt_incrs +=
+					channel->cur_ctx->restore_incrs;
 		}
-		channel->cur_ctx = job->hwctx;
-		if (need_restore)
-			job->syncpt_incrs += channel->cur_ctx->restore_incrs;
-	}
-
-	/* get absolute sync value */
-	if (BIT(job->syncpt_id) & sp->client_managed)
-		syncval = nvhost_syncpt_set_max(sp,
-				job->syncpt_id, job->syncpt_incrs);
-	else
-		syncval = nvhost_syncpt_incr_max(sp,
-				job->syncpt_id, job->syncpt_incrs);
 
-	job->syncpt_end = syncval;
-
-	/* push save buffer (pre-gather setup depends on unit) */
-	if (hwctx_to_save)
-		channel->ctxhandler.save_push(&channel->cdma, hwctx_to_save);
-
-	/* gather restore buffer */
-	if (need_restore) {
-		nvhost_cdma_push_gather(&channel->cdma,
-			channel->dev->nvmap,
-			nvmap_ref_to_handle(channel->cur_ctx->restore),
-			nvhost_opcode_gather(channel->cur_ctx->restore_size),
-			channel->cur_ctx->restore_phys);
-		channel->ctxhandler.get(channel->cur_ctx);
-	}
-
-	/* add a setclass for modules that require it (unless ctxsw added it) */
-	if (!hwctx_to_save && !need_restore && channel->desc->class)
-		nvhost_cdma_push(&channel->cdma,
-			nvhost_opcode_setclass(channel->desc->class, 0, 0),
-			NVHOST_OPCODE_NOOP);
+		/* get absolute sync value */
+		if (BIT(job->syncpt_id) & sp->client_managed)
+			syncval = nvhost_syncpt_set_max(sp,
+					job->syncpt_id, job->syncpt_incrs);
+		else
+			syncval = nvhost_syncpt_incr_max(sp,
+					job->syncpt_id, job->syncpt_incrs);
 
-	if (job->null_kickoff) {
-		int incr;
-		u32 op_incr;
+		job->syncpt_end = syncval;
 
-		/* TODO ideally we'd also perform host waits here */
+		/* push save buffer (pre-gather setup depends on unit) */
+		if (i == 0 && hwctx_to_save)
+			channel->ctxhandler.save_push(&channel->cdma,
+						      hwctx_to_save);
 
-		/* push increments that correspond to nulled out commands */
-		op_incr = nvhost_opcode_imm(0, 0x100 | job->syncpt_id);
-		for (incr = 0; incr < (user_syncpt_incrs >> 1); incr++)
-			nvhost_cdma_push(&channel->cdma, op_incr, op_incr);
-		if (user_syncpt_incrs & 1)
-			nvhost_cdma_push(&channel->cdma,
-					op_incr, NVHOST_OPCODE_NOOP);
+		/* gather restore buffer */
+		if (i == 0 && need_restore) {
+			nvhost_cdma_push_gather(&channel->cdma,
+				channel->dev->nvmap,
+				nvmap_ref_to_handle(channel->cur_ctx->restore),
+				nvhost_opcode_gather(
+					channel->cur_ctx->restore_size),
+				channel->cur_ctx->restore_phys);
+			channel->ctxhandler.get(channel->cur_ctx);
+		}
 
-		/* for 3d, waitbase needs to be incremented after each submit */
-		if (channel->desc->class == NV_GRAPHICS_3D_CLASS_ID)
+		/* add a setclass for modules that require it (unless ctxsw
+		 * added it) */
+		if ((i || (!hwctx_to_save && !need_restore)) &&
+		    channel->desc->class)
 			nvhost_cdma_push(&channel->cdma,
+				nvhost_opcode_setclass(channel->desc->class,
+						       0, 0),
+				NVHOST_OPCODE_NOOP);
+
+		if (job->null_kickoff) {
+			int incr;
+			u32 op_incr;
+
+			/* TODO ideally we'd also perform host waits here */
+
+			/* push increments that correspond to nulled out
+			 * commands */
+			op_incr = nvhost_opcode_imm(0, 0x100 | job->syncpt_id);
+			for (incr = 0; incr < (user_syncpt_incrs >> 1); incr++)
+				nvhost_cdma_push(&channel->cdma,
+						op_incr, op_incr);
+			if (user_syncpt_incrs & 1)
+				nvhost_cdma_push(&channel->cdma,
+						op_incr, NVHOST_OPCODE_NOOP);
+
+			/* for 3d, waitbase needs to be incremented after each
+			 * submit */
+			if (channel->desc->class == NV_GRAPHICS_3D_CLASS_ID)
+				nvhost_cdma_push(&channel->cdma,
 					nvhost_opcode_setclass(
 						NV_HOST1X_CLASS_ID,
 						NV_CLASS_HOST_INCR_SYNCPT_BASE,
@@ -343,70 +424,66 @@ static int t20_channel_submit(struct nvhost_job *job)
 					nvhost_class_host_incr_syncpt_base(
 						NVWAITBASE_3D,
 						user_syncpt_incrs));
-	} else {
-		/* push user gathers */
-		int i = 0;
-		for ( ; i < job->num_gathers; i++) {
-			u32 op1 = nvhost_opcode_gather(job->gathers[i].words);
-			u32 op2 = job->gathers[i].mem;
-			nvhost_cdma_push_gather(&channel->cdma,
-					job->nvmap, job->unpins[i/2],
-					op1, op2);
+		} else {
+			/* push user gathers */
+			int g = 0;
+			for ( ; g < job->num_gathers; g++) {
+				u32 op1 = nvhost_opcode_gather(
+						job->gathers[g].words);
+				u32 op2 = job->gathers[g].mem;
+				nvhost_cdma_push_gather(&channel->cdma,
+						job->nvmap, job->unpins[g/2],
+						op1, op2);
+			}
 		}
-	}
 
-	/* end CDMA submit & stash pinned hMems into sync queue */
-	nvhost_cdma_end(&channel->cdma, job);
-
-	trace_nvhost_channel_submitted(channel->desc->name,
-			syncval - job->syncpt_incrs, syncval);
-
-	/*
-	 * schedule a context save interrupt (to drain the host FIFO
-	 * if necessary, and to release the restore buffer)
-	 */
-	if (hwctx_to_save) {
-		err = nvhost_intr_add_action(&channel->dev->intr,
-			job->syncpt_id,
-			syncval - job->syncpt_incrs
-				+ hwctx_to_save->save_thresh,
-			NVHOST_INTR_ACTION_CTXSAVE, hwctx_to_save,
-			ctxsave_waiter,
-			NULL);
-		ctxsave_waiter = NULL;
-		WARN(err, "Failed to set ctx save interrupt");
-	}
-
-	if (need_restore) {
-		BUG_ON(!ctxrestore_waiter);
+		/* stash pinned hMems into sync queue */
+		nvhost_cdma_end_job(&channel->cdma, job);
+
+		trace_nvhost_channel_submitted(channel->desc->name,
+				syncval - job->syncpt_incrs, syncval);
+
+		/*
+		 * Add the waiters before pushing the next job: if that one
+		 * has to wait for push buffer space, only the cleanup run by
+		 * the completion of the jobs already pushed can free it, and
+		 * a pending context save may have to drain the host FIFO.
+		 */
+		if (i == 0)
+			t20_channel_add_ctx_actions(channel, job,
+					hwctx_to_save, &ctxsave_waiter,
+					need_restore, &ctxrestore_waiter,
+					first_user_syncpt_incrs);
+
+		/* schedule a submit complete interrupt */
 		err = nvhost_intr_add_action(&channel->dev->intr,
-			job->syncpt_id,
-			syncval - user_syncpt_incrs,
-			NVHOST_INTR_ACTION_CTXRESTORE, channel->cur_ctx,
-			ctxrestore_waiter,
-			NULL);
-		ctxrestore_waiter = NULL;
-		WARN(err, "Failed to set ctx restore interrupt");
+				job->syncpt_id,
+				job->syncpt_end,
+				NVHOST_INTR_ACTION_SUBMIT_COMPLETE, channel,
+				completed_waiters[i],
+				NULL);
+		completed_waiters[i] = NULL;
+		WARN(err, "Failed to set submit complete interrupt");
 	}
 
-	/* schedule a submit complete interrupt */
-	err = nvhost_intr_add_action(&channel->dev->intr, job->syncpt_id,
-			syncval,
-			NVHOST_INTR_ACTION_SUBMIT_COMPLETE, channel,
-			completed_waiter,
-			NULL);
-	completed_waiter = NULL;
-	WARN(err, "Failed to set submit complete interrupt");
+	/* end CDMA submit */
+	nvhost_cdma_end_batch(&channel->cdma);
 
 	mutex_unlock(&channel->submitlock);
 
 done:
 	kfree(ctxrestore_waiter);
 	kfree(ctxsave_waiter);
-	kfree(completed_waiter);
+	for (i = 0; i < num_jobs; i++)
+		kfree(completed_waiters[i]);
 	return err;
 }
 
+static int t20_channel_submit(struct nvhost_job *job)
+{
+	return t20_channel_submit_mult(&job, 1);
+}
+
 static int t20_channel_read_3d_reg(
 	struct nvhost_channel *channel,
 	struct nvhost_hwctx *hwctx,
@@ -587,6 +664,7 @@ int nvhost_init_t20_channel_support(struct nvhost_master *host)
 
 	host->op.channel.init = t20_channel_init;
 	host->op.channel.submit = t20_channel_submit;
+	host->op.channel.submit_mult = t20_channel_submit_mult;
 	host->op.channel.read3dreg = t20_channel_read_3d_reg;
 
 	return 0;
@@ -27,14 +27,17 @@
 #include <linux/mm.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/rculist.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <linux/atomic.h>
 
 #include <mach/nvmap.h>
 
 #include "nvmap_heap.h"
+#include "nvmap_pp_core.h"
 
 #define nvmap_err(_client, _fmt, ...)				\
 	dev_err(nvmap_client_to_device(_client),		\
@@ -50,6 +53,18 @@
 
 #define nvmap_ref_to_id(_ref)		((unsigned long)(_ref)->handle)
 
+/* handles and handle refs are looked up by id in hash tables under RCU;
+ * the tables are only changed under the device's handle_lock and the
+ * client's ref_lock respectively */
+#define NVMAP_HANDLE_HASH_BITS		8
+#define NVMAP_REF_HASH_BITS		5
+
+#ifdef CONFIG_NVMAP_HIGHMEM_ONLY
+#define GFP_NVMAP		(__GFP_HIGHMEM | __GFP_NOWARN)
+#else
+#define GFP_NVMAP		(GFP_KERNEL | __GFP_HIGHMEM | __GFP_NOWARN)
+#endif
+
 struct nvmap_device;
 struct page;
 struct tegra_iovmm_area;
@@ -66,7 +81,8 @@ struct nvmap_pgalloc {
 };
 
 struct nvmap_handle {
-	struct rb_node node;	/* entry on global handle tree */
+	struct hlist_node node;	/* entry on global handle hash */
+	struct rcu_head rcu;
 	atomic_t ref;		/* reference count (i.e., # of duplications) */
 	atomic_t pin;		/* pin count */
 	unsigned int usecount;	/* how often is used */
@@ -88,6 +104,22 @@ struct nvmap_handle {
 	struct mutex lock;
 };
 
+/* one page pool for each non-default kernel mapping attribute, indexed by
+ * the handle's NVMAP_HANDLE_* cache flag */
+#define NVMAP_UC_POOL		NVMAP_HANDLE_UNCACHEABLE
+#define NVMAP_WC_POOL		NVMAP_HANDLE_WRITE_COMBINE
+#define NVMAP_IWB_POOL		NVMAP_HANDLE_INNER_CACHEABLE
+#define NVMAP_NUM_POOLS		(NVMAP_IWB_POOL + 1)
+
+struct nvmap_page_pool {
+	struct mutex lock;
+	struct nvmap_pp_stack stack;	/* free pages, under lock */
+	int flags;			/* NVMAP_HANDLE_* attribute */
+	struct work_struct refill_work;
+	unsigned long hits;
+	unsigned long misses;
+};
+
 struct nvmap_share {
 	struct tegra_iovmm_client *iovmm;
 	wait_queue_head_t pin_wait;
@@ -97,6 +129,9 @@ struct nvmap_share {
 	struct list_head *mru_lists;
 	int nr_mru;
 #endif
+#ifdef CONFIG_NVMAP_PAGE_POOLS
+	struct nvmap_page_pool pools[NVMAP_NUM_POOLS];
+#endif
 };
 
 struct nvmap_carveout_commit {
@@ -109,6 +144,7 @@ struct nvmap_client {
 	struct nvmap_device		*dev;
 	struct nvmap_share		*share;
 	struct rb_root			handle_refs;
+	struct hlist_head		ref_hash[1 << NVMAP_REF_HASH_BITS];
 	atomic_t			iovm_commit;
 	size_t				iovm_limit;
 	struct mutex			ref_lock;
@@ -172,6 +208,9 @@ struct nvmap_handle_ref *_nvmap_validate_id_locked(struct nvmap_client *priv,
 struct nvmap_handle *nvmap_get_handle_id(struct nvmap_client *client,
 					 unsigned long id);
 
+int nvmap_get_handle_ids(struct nvmap_client *client, unsigned int nr,
+			 const unsigned long *ids, struct nvmap_handle **h);
+
 struct nvmap_handle_ref *nvmap_create_handle(struct nvmap_client *client,
 					     size_t size);
 
@@ -193,10 +232,22 @@ void nvmap_unpin_ids(struct nvmap_client *priv,
 
 void _nvmap_handle_free(struct nvmap_handle *h);
 
+void nvmap_pages_set_attr(struct page **pages, int nr, unsigned long flags);
+
+void nvmap_pages_free(struct page **pages, int nr, unsigned long flags);
+
 int nvmap_handle_remove(struct nvmap_device *dev, struct nvmap_handle *h);
 
 void nvmap_handle_add(struct nvmap_device *dev, struct nvmap_handle *h);
 
+/* takes a reference on h unless it is already being freed; the caller
+ * must hold rcu_read_lock or otherwise keep h from being freed */
+static inline struct nvmap_handle *nvmap_handle_get_unless_zero(
+	struct nvmap_handle *h)
+{
+	return atomic_inc_not_zero(&h->ref) ? h : NULL;
+}
+
 static inline struct nvmap_handle *nvmap_handle_get(struct nvmap_handle *h)
 {
 	if (unlikely(atomic_inc_return(&h->ref) <= 1)) {
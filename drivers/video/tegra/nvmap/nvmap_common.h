@@ -25,6 +25,11 @@ extern void v7_clean_kern_cache_all(void *);
 
 #define FLUSH_CLEAN_BY_SET_WAY_THRESHOLD (8 * PAGE_SIZE)
 
+/* ranges of at least this many bytes are cleaned or flushed from the
+ * inner cache by set/way instead of by line; calibrated at probe time,
+ * FLUSH_CLEAN_BY_SET_WAY_THRESHOLD until then */
+extern u32 nvmap_cache_maint_threshold;
+
 static inline void inner_flush_cache_all(void)
 {
 	on_each_cpu(v7_flush_kern_cache_all, NULL, 1);
@@ -24,7 +24,10 @@
 #include <linux/bitmap.h>
 #include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/hash.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
@@ -44,6 +47,7 @@
 #include "nvmap.h"
 #include "nvmap_ioctl.h"
 #include "nvmap_mru.h"
+#include "nvmap_pp.h"
 #include "nvmap_common.h"
 
 #define NVMAP_NUM_PTES		64
@@ -71,7 +75,7 @@ struct nvmap_device {
 	unsigned int	lastpte;
 	spinlock_t	ptelock;
 
-	struct rb_root	handles;
+	struct hlist_head handles[1 << NVMAP_HANDLE_HASH_BITS];
 	spinlock_t	handle_lock;
 	wait_queue_head_t pte_wait;
 	struct miscdevice dev_super;
@@ -85,6 +89,8 @@ struct nvmap_device {
 
 struct nvmap_device *nvmap_dev;
 
+u32 nvmap_cache_maint_threshold = FLUSH_CLEAN_BY_SET_WAY_THRESHOLD;
+
 static struct backing_dev_info nvmap_bdi = {
 	.ra_pages	= 0,
 	.capabilities	= (BDI_CAP_NO_ACCT_AND_WRITEBACK |
@@ -201,43 +207,72 @@ void nvmap_free_pte(struct nvmap_device *dev, pte_t **pte)
 	wake_up(&dev->pte_wait);
 }
 
+static inline struct hlist_head *handle_hash(struct nvmap_device *dev,
+					     unsigned long id)
+{
+	return &dev->handles[hash_long(id, NVMAP_HANDLE_HASH_BITS)];
+}
+
 /* verifies that the handle ref value "ref" is a valid handle ref for the
- * file. caller must hold the file's ref_lock prior to calling this function */
+ * file. caller must hold the file's ref_lock or rcu_read_lock prior to
+ * calling this function */
 struct nvmap_handle_ref *_nvmap_validate_id_locked(struct nvmap_client *c,
 						   unsigned long id)
 {
-	struct rb_node *n = c->handle_refs.rb_node;
+	struct nvmap_handle_ref *ref;
+	struct hlist_node *pos;
 
-	while (n) {
-		struct nvmap_handle_ref *ref;
-		ref = rb_entry(n, struct nvmap_handle_ref, node);
+	hlist_for_each_entry_rcu(ref, pos,
+			&c->ref_hash[hash_long(id, NVMAP_REF_HASH_BITS)],
+			hash_node) {
 		if ((unsigned long)ref->handle == id)
 			return ref;
-		else if (id > (unsigned long)ref->handle)
-			n = n->rb_right;
-		else
-			n = n->rb_left;
 	}
 
 	return NULL;
 }
 
+/* handle refs and handles are freed after an RCU grace period, so a handle
+ * found through a ref can be referenced here without taking ref_lock */
 struct nvmap_handle *nvmap_get_handle_id(struct nvmap_client *client,
 					 unsigned long id)
 {
 	struct nvmap_handle_ref *ref;
 	struct nvmap_handle *h = NULL;
 
-	nvmap_ref_lock(client);
+	rcu_read_lock();
 	ref = _nvmap_validate_id_locked(client, id);
 	if (ref)
-		h = ref->handle;
-	if (h)
-		h = nvmap_handle_get(h);
-	nvmap_ref_unlock(client);
+		h = nvmap_handle_get_unless_zero(ref->handle);
+	rcu_read_unlock();
 	return h;
 }
 
+/* references the handles for nr ids of client in one go.  on failure no
+ * references are held and -EINVAL is returned. */
+int nvmap_get_handle_ids(struct nvmap_client *client, unsigned int nr,
+			 const unsigned long *ids, struct nvmap_handle **h)
+{
+	struct nvmap_handle_ref *ref;
+	unsigned int i;
+
+	rcu_read_lock();
+	for (i = 0; i < nr; i++) {
+		ref = _nvmap_validate_id_locked(client, ids[i]);
+		h[i] = ref ? nvmap_handle_get_unless_zero(ref->handle) : NULL;
+		if (!h[i])
+			break;
+	}
+	rcu_read_unlock();
+
+	if (i == nr)
+		return 0;
+
+	while (i--)
+		nvmap_handle_put(h[i]);
+	return -EINVAL;
+}
+
 unsigned long nvmap_carveout_usage(struct nvmap_client *c,
 				   struct nvmap_heap_block *b)
 {
@@ -287,7 +322,7 @@ int nvmap_flush_heap_block(struct nvmap_client *client,
 	if (prot == NVMAP_HANDLE_UNCACHEABLE || prot == NVMAP_HANDLE_WRITE_COMBINE)
 		goto out;
 
-	if (len >= FLUSH_CLEAN_BY_SET_WAY_THRESHOLD) {
+	if (len >= nvmap_cache_maint_threshold) {
 		inner_flush_cache_all();
 		if (prot != NVMAP_HANDLE_INNER_CACHEABLE)
 			outer_flush_range(block->base, block->base + len);
@@ -547,63 +582,40 @@ int nvmap_handle_remove(struct nvmap_device *dev, struct nvmap_handle *h)
 	BUG_ON(atomic_read(&h->ref) < 0);
 	BUG_ON(atomic_read(&h->pin) != 0);
 
-	rb_erase(&h->node, &dev->handles);
+	hlist_del_rcu(&h->node);
 
 	spin_unlock(&dev->handle_lock);
 	return 0;
 }
 
-/* adds a newly-created handle to the device master tree */
+/* adds a newly-created handle to the device master hash */
 void nvmap_handle_add(struct nvmap_device *dev, struct nvmap_handle *h)
 {
-	struct rb_node **p;
-	struct rb_node *parent = NULL;
-
 	spin_lock(&dev->handle_lock);
-	p = &dev->handles.rb_node;
-	while (*p) {
-		struct nvmap_handle *b;
-
-		parent = *p;
-		b = rb_entry(parent, struct nvmap_handle, node);
-		if (h > b)
-			p = &parent->rb_right;
-		else
-			p = &parent->rb_left;
-	}
-	rb_link_node(&h->node, parent, p);
-	rb_insert_color(&h->node, &dev->handles);
+	hlist_add_head_rcu(&h->node, handle_hash(dev, (unsigned long)h));
 	spin_unlock(&dev->handle_lock);
 }
 
-/* validates that a handle is in the device master tree, and that the
+/* validates that a handle is in the device master hash, and that the
  * client has permission to access it */
 struct nvmap_handle *nvmap_validate_get(struct nvmap_client *client,
 					unsigned long id)
 {
-	struct nvmap_handle *h = NULL;
-	struct rb_node *n;
-
-	spin_lock(&client->dev->handle_lock);
-
-	n = client->dev->handles.rb_node;
+	struct nvmap_handle *h;
+	struct hlist_node *pos;
 
-	while (n) {
-		h = rb_entry(n, struct nvmap_handle, node);
-		if ((unsigned long)h == id) {
-			if (client->super || h->global || (h->owner == client))
-				h = nvmap_handle_get(h);
-			else
-				h = NULL;
-			spin_unlock(&client->dev->handle_lock);
-			return h;
-		}
-		if (id > (unsigned long)h)
-			n = n->rb_right;
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(h, pos, handle_hash(client->dev, id), node) {
+		if ((unsigned long)h != id)
+			continue;
+		if (client->super || h->global || (h->owner == client))
+			h = nvmap_handle_get_unless_zero(h);
 		else
-			n = n->rb_left;
+			h = NULL;
+		rcu_read_unlock();
+		return h;
 	}
-	spin_unlock(&client->dev->handle_lock);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -675,6 +687,7 @@ static void destroy_client(struct nvmap_client *client)
 
 		ref = rb_entry(n, struct nvmap_handle_ref, node);
 		rb_erase(&ref->node, &client->handle_refs);
+		hlist_del(&ref->hash_node);
 
 		smp_rmb();
 		pins = atomic_read(&ref->pin);
@@ -839,6 +852,10 @@ static long nvmap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		err = nvmap_ioctl_get_param(filp, uarg);
 		break;
 
+	case NVMAP_IOC_PARAM_MULT:
+		err = nvmap_ioctl_get_param_mult(filp, uarg);
+		break;
+
 	case NVMAP_IOC_UNPIN_MULT:
 	case NVMAP_IOC_PIN_MULT:
 		err = nvmap_ioctl_pinop(filp, cmd == NVMAP_IOC_PIN_MULT, uarg);
@@ -865,6 +882,10 @@ static long nvmap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		err = nvmap_ioctl_cache_maint(filp, uarg);
 		break;
 
+	case NVMAP_IOC_CACHE_LIST:
+		err = nvmap_ioctl_cache_maint_list(filp, uarg);
+		break;
+
 	default:
 		return -ENOTTY;
 	}
@@ -1142,6 +1163,54 @@ static const struct file_operations debug_iovmm_allocations_fops = {
 	.release = single_release,
 };
 
+#define NVMAP_CALIBRATE_ORDER		4
+#define NVMAP_CALIBRATE_LOOPS		4
+#define NVMAP_CACHE_MAINT_THRESHOLD_MAX	(256 * PAGE_SIZE)
+
+/* times flushing a dirty buffer from the inner cache by line against
+ * flushing the whole inner cache by set/way, and sets the size at which
+ * the whole cache flush becomes the cheaper of the two */
+static void nvmap_calibrate_cache_maint(struct device *dev)
+{
+	size_t size = PAGE_SIZE << NVMAP_CALIBRATE_ORDER;
+	s64 range_ns = 0, all_ns = 0;
+	unsigned long buf;
+	u64 threshold;
+	ktime_t start;
+	int i;
+
+	buf = __get_free_pages(GFP_KERNEL, NVMAP_CALIBRATE_ORDER);
+	if (!buf) {
+		dev_warn(dev, "couldn't calibrate cache maintenance\n");
+		return;
+	}
+
+	for (i = 0; i < NVMAP_CALIBRATE_LOOPS; i++) {
+		memset((void *)buf, i, size);
+		start = ktime_get();
+		dmac_flush_range((void *)buf, (void *)(buf + size));
+		range_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		memset((void *)buf, i, size);
+		start = ktime_get();
+		inner_flush_cache_all();
+		all_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+	free_pages(buf, NVMAP_CALIBRATE_ORDER);
+
+	if (range_ns <= 0 || all_ns <= 0)
+		return;
+
+	threshold = div64_u64((u64)all_ns * size, range_ns);
+	nvmap_cache_maint_threshold = clamp_t(u64, threshold, PAGE_SIZE,
+					      NVMAP_CACHE_MAINT_THRESHOLD_MAX);
+	dev_info(dev, "cache maintenance by set/way from %u bytes "
+		 "(%lld ns per %u bytes by line, %lld ns by set/way)\n",
+		 nvmap_cache_maint_threshold,
+		 div_s64(range_ns, NVMAP_CALIBRATE_LOOPS), size,
+		 div_s64(all_ns, NVMAP_CALIBRATE_LOOPS));
+}
+
 static int nvmap_probe(struct platform_device *pdev)
 {
 	struct nvmap_platform_data *plat = pdev->dev.platform_data;
@@ -1176,7 +1245,8 @@ static int nvmap_probe(struct platform_device *pdev)
 	dev->dev_super.fops = &nvmap_super_fops;
 	dev->dev_super.parent = &pdev->dev;
 
-	dev->handles = RB_ROOT;
+	for (i = 0; i < ARRAY_SIZE(dev->handles); i++)
+		INIT_HLIST_HEAD(&dev->handles[i]);
 
 	init_waitqueue_head(&dev->pte_wait);
 
@@ -1204,6 +1274,14 @@ static int nvmap_probe(struct platform_device *pdev)
 		goto fail;
 	}
 
+	e = nvmap_page_pools_init(&dev->iovmm_master);
+	if (e) {
+		dev_err(&pdev->dev, "couldn't initialize page pools\n");
+		goto fail;
+	}
+
+	nvmap_calibrate_cache_maint(&pdev->dev);
+
 	spin_lock_init(&dev->ptelock);
 	spin_lock_init(&dev->handle_lock);
 	INIT_LIST_HEAD(&dev->clients);
@@ -1309,6 +1387,11 @@ static int nvmap_probe(struct platform_device *pdev)
 			debugfs_create_file("allocations", 0664, iovmm_root,
 				dev, &debug_iovmm_allocations_fops);
 		}
+		nvmap_page_pools_debugfs_init(&dev->iovmm_master,
+					      nvmap_debug_root);
+		debugfs_create_u32("cache_maint_threshold", 0644,
+				   nvmap_debug_root,
+				   &nvmap_cache_maint_threshold);
 	}
 
 	platform_set_drvdata(pdev, dev);
@@ -1323,6 +1406,7 @@ fail_heaps:
 	}
 fail:
 	kfree(dev->heaps);
+	nvmap_page_pools_destroy(&dev->iovmm_master);
 	nvmap_mru_destroy(&dev->iovmm_master);
 	if (dev->dev_super.minor != MISC_DYNAMIC_MINOR)
 		misc_deregister(&dev->dev_super);
@@ -1340,22 +1424,24 @@ fail:
 static int nvmap_remove(struct platform_device *pdev)
 {
 	struct nvmap_device *dev = platform_get_drvdata(pdev);
-	struct rb_node *n;
+	struct hlist_node *pos, *n;
 	struct nvmap_handle *h;
 	int i;
 
 	misc_deregister(&dev->dev_super);
 	misc_deregister(&dev->dev_user);
 
-	while ((n = rb_first(&dev->handles))) {
-		h = rb_entry(n, struct nvmap_handle, node);
-		rb_erase(&h->node, &dev->handles);
-		kfree(h);
+	for (i = 0; i < ARRAY_SIZE(dev->handles); i++) {
+		hlist_for_each_entry_safe(h, pos, n, &dev->handles[i], node) {
+			hlist_del(&h->node);
+			kfree(h);
+		}
 	}
 
 	if (!IS_ERR_OR_NULL(dev->iovmm_master.iovmm))
 		tegra_iovmm_free_client(dev->iovmm_master.iovmm);
 
+	nvmap_page_pools_destroy(&dev->iovmm_master);
 	nvmap_mru_destroy(&dev->iovmm_master);
 
 	for (i = 0; i < dev->nr_carveouts; i++) {
@@ -28,6 +28,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 
 #include <asm/cacheflush.h>
 #include <asm/outercache.h>
@@ -41,6 +42,7 @@
 
 #include "nvmap.h"
 #include "nvmap_mru.h"
+#include "nvmap_pp.h"
 #include "nvmap_common.h"
 
 #define PRINT_CARVEOUT_CONVERSION 0
@@ -52,11 +54,6 @@
 
 #define NVMAP_SECURE_HEAPS	(NVMAP_HEAP_CARVEOUT_IRAM | NVMAP_HEAP_IOVMM | \
 				 NVMAP_HEAP_CARVEOUT_VPR)
-#ifdef CONFIG_NVMAP_HIGHMEM_ONLY
-#define GFP_NVMAP		(__GFP_HIGHMEM | __GFP_NOWARN)
-#else
-#define GFP_NVMAP		(GFP_KERNEL | __GFP_HIGHMEM | __GFP_NOWARN)
-#endif
 /* handles may be arbitrarily large (16+MiB), and any handle allocated from
  * the kernel (i.e., not a carveout handle) includes its array of pages. to
  * preserve kmalloc space, if the array of pages exceeds PAGELIST_VMALLOC_MIN,
@@ -82,10 +79,69 @@ static inline void altfree(void *ptr, size_t len)
 		kfree(ptr);
 }
 
+/* Give the kernel mapping of pages the attribute in flags, and flush
+ * highmem pages from the caches. */
+void nvmap_pages_set_attr(struct page **pages, int nr, unsigned long flags)
+{
+	unsigned long base;
+	int i;
+
+	if (flags == NVMAP_HANDLE_WRITE_COMBINE)
+		set_pages_array_wc(pages, nr);
+	else if (flags == NVMAP_HANDLE_UNCACHEABLE)
+		set_pages_array_uc(pages, nr);
+	else if (flags == NVMAP_HANDLE_INNER_CACHEABLE)
+		set_pages_array_iwb(pages, nr);
+	else
+		return;
+
+	/* Flush the cache for allocated high mem pages only */
+	for (i = 0; i < nr; i++) {
+		if (PageHighMem(pages[i])) {
+			__flush_dcache_page(page_mapping(pages[i]), pages[i]);
+			base = page_to_phys(pages[i]);
+			outer_flush_range(base, base + PAGE_SIZE);
+		}
+	}
+}
+
+/* Restore the default attribute of pages set up with flags and free them */
+void nvmap_pages_free(struct page **pages, int nr, unsigned long flags)
+{
+	int i;
+
+	if (flags == NVMAP_HANDLE_WRITE_COMBINE ||
+	    flags == NVMAP_HANDLE_UNCACHEABLE ||
+	    flags == NVMAP_HANDLE_INNER_CACHEABLE)
+		set_pages_array_wb(pages, nr);
+
+	for (i = 0; i < nr; i++)
+		__free_page(pages[i]);
+}
+
+/* Return pages to the pool for their attribute, or to the kernel */
+static void handle_pages_release(struct nvmap_share *share,
+				 struct page **pages, int nr,
+				 unsigned long flags)
+{
+	struct nvmap_page_pool *pool = nvmap_page_pool_get(share, flags);
+	int pooled = 0;
+
+	if (pool)
+		pooled = nvmap_page_pool_release_pages(pool, pages, nr);
+	if (pooled < nr)
+		nvmap_pages_free(pages + pooled, nr - pooled, flags);
+}
+
+static void handle_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct nvmap_handle, rcu));
+}
+
 void _nvmap_handle_free(struct nvmap_handle *h)
 {
 	struct nvmap_device *dev = h->dev;
-	unsigned int i, nr_page;
+	unsigned int nr_page;
 
 	if (nvmap_handle_remove(dev, h) != 0)
 		return;
@@ -106,22 +162,17 @@ void _nvmap_handle_free(struct nvmap_handle *h)
 
 	nvmap_mru_remove(nvmap_get_share_from_dev(dev), h);
 
-	/* Restore page attributes. */
-	if (h->flags == NVMAP_HANDLE_WRITE_COMBINE ||
-	    h->flags == NVMAP_HANDLE_UNCACHEABLE ||
-	    h->flags == NVMAP_HANDLE_INNER_CACHEABLE)
-		set_pages_array_wb(h->pgalloc.pages, nr_page);
-
 	if (h->pgalloc.area)
 		tegra_iovmm_free_vm(h->pgalloc.area);
 
-	for (i = 0; i < nr_page; i++)
-		__free_page(h->pgalloc.pages[i]);
+	handle_pages_release(nvmap_get_share_from_dev(dev),
+			     h->pgalloc.pages, nr_page, h->flags);
 
 	altfree(h->pgalloc.pages, nr_page * sizeof(struct page *));
 
 out:
-	kfree(h);
+	/* lockless lookups may still be looking at h */
+	call_rcu(&h->rcu, handle_free_rcu);
 }
 
 static struct page *nvmap_alloc_pages_exact(gfp_t gfp, size_t size)
@@ -151,14 +202,16 @@ static int handle_page_alloc(struct nvmap_client *client,
 	unsigned int nr_page = size >> PAGE_SHIFT;
 	pgprot_t prot;
 	unsigned int i = 0;
+	unsigned int pooled = 0;
 	struct page **pages;
-	unsigned long base;
+	struct nvmap_page_pool *pool;
 
 	pages = altalloc(nr_page * sizeof(*pages));
 	if (!pages)
 		return -ENOMEM;
 
 	prot = nvmap_pgprot(h, pgprot_kernel);
+	pool = nvmap_page_pool_get(client->share, h->flags);
 
 #ifdef CONFIG_NVMAP_ALLOW_SYSMEM
 	if (nr_page == 1)
@@ -166,7 +219,10 @@ static int handle_page_alloc(struct nvmap_client *client,
 #endif
 
 	h->pgalloc.area = NULL;
-	if (contiguous) {
+	if (contiguous && nr_page == 1 && pool)
+		pooled = i = nvmap_page_pool_alloc_pages(pool, pages, 1);
+
+	if (contiguous && !pooled) {
 		struct page *page;
 		page = nvmap_alloc_pages_exact(GFP_NVMAP, size);
 		if (!page)
@@ -175,8 +231,12 @@ static int handle_page_alloc(struct nvmap_client *client,
 		for (i = 0; i < nr_page; i++)
 			pages[i] = nth_page(page, i);
 
-	} else {
-		for (i = 0; i < nr_page; i++) {
+	} else if (!contiguous) {
+		/* pages from the pool already have the right attribute */
+		if (pool)
+			pooled = i = nvmap_page_pool_alloc_pages(pool, pages,
+								 nr_page);
+		for (; i < nr_page; i++) {
 			pages[i] = nvmap_alloc_pages_exact(GFP_NVMAP,
 				PAGE_SIZE);
 			if (!pages[i])
@@ -195,25 +255,8 @@ static int handle_page_alloc(struct nvmap_client *client,
 	}
 
 	/* Update the pages mapping in kernel page table. */
-	if (h->flags == NVMAP_HANDLE_WRITE_COMBINE)
-		set_pages_array_wc(pages, nr_page);
-	else if (h->flags == NVMAP_HANDLE_UNCACHEABLE)
-		set_pages_array_uc(pages, nr_page);
-	else if (h->flags == NVMAP_HANDLE_INNER_CACHEABLE)
-		set_pages_array_iwb(pages, nr_page);
-	else
-		goto skip_cache_flush;
+	nvmap_pages_set_attr(pages + pooled, nr_page - pooled, h->flags);
 
-	/* Flush the cache for allocated high mem pages only */
-	for (i = 0; i < nr_page; i++) {
-		if (PageHighMem(pages[i])) {
-			__flush_dcache_page(page_mapping(pages[i]), pages[i]);
-			base = page_to_phys(pages[i]);
-			outer_flush_range(base, base + PAGE_SIZE);
-		}
-	}
-
-skip_cache_flush:
 	h->size = size;
 	h->pgalloc.pages = pages;
 	h->pgalloc.contig = contiguous;
@@ -221,8 +264,10 @@ skip_cache_flush:
 	return 0;
 
 fail:
-	while (i--)
+	while (i-- > pooled)
 		__free_page(pages[i]);
+	if (pooled)
+		handle_pages_release(client->share, pages, pooled, h->flags);
 	altfree(pages, nr_page * sizeof(*pages));
 	wmb();
 	return -ENOMEM;
@@ -435,6 +480,11 @@ out:
 	return err;
 }
 
+static void handle_ref_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct nvmap_handle_ref, rcu));
+}
+
 void nvmap_free_handle_id(struct nvmap_client *client, unsigned long id)
 {
 	struct nvmap_handle_ref *ref;
@@ -460,6 +510,7 @@ void nvmap_free_handle_id(struct nvmap_client *client, unsigned long id)
 	smp_rmb();
 	pins = atomic_read(&ref->pin);
 	rb_erase(&ref->node, &client->handle_refs);
+	hlist_del_rcu(&ref->hash_node);
 
 	if (h->alloc && h->heap_pgalloc && !h->pgalloc.contig)
 		atomic_sub(h->size, &client->iovm_commit);
@@ -484,7 +535,7 @@ void nvmap_free_handle_id(struct nvmap_client *client, unsigned long id)
 	if (h->owner == client)
 		h->owner = NULL;
 
-	kfree(ref);
+	call_rcu(&ref->rcu, handle_ref_free_rcu);
 
 out:
 	BUG_ON(!atomic_read(&h->ref));
@@ -509,6 +560,8 @@ static void add_handle_ref(struct nvmap_client *client,
 	}
 	rb_link_node(&ref->node, parent, p);
 	rb_insert_color(&ref->node, &client->handle_refs);
+	hlist_add_head_rcu(&ref->hash_node, &client->ref_hash[
+		hash_long((unsigned long)ref->handle, NVMAP_REF_HASH_BITS)]);
 	nvmap_ref_unlock(client);
 }
 
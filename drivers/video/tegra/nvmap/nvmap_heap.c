@@ -27,10 +27,12 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/err.h>
+#include <linux/workqueue.h>
 
 #include <mach/nvmap.h>
 #include "nvmap.h"
 #include "nvmap_heap.h"
+#include "nvmap_heap_core.h"
 #include "nvmap_common.h"
 
 #include <asm/tlbflush.h>
@@ -68,33 +70,26 @@
  * and to ensure that the minimum free block size in the carveout (i.e., the
  * "small" threshold) is still a meaningful size.
  *
+ * the size class free lists and the splitting and merging of list blocks
+ * are in nvmap_heap_core.c.
+ *
+ * with the compactor, a heap whose free space gets too fragmented has its
+ * movable (unpinned and unmapped) blocks relocated towards the bottom of
+ * the heap a few at a time from a work item, rather than only when an
+ * allocation has already failed.
+ *
  */
 
 #define MAX_BUDDY_NR	128	/* maximum buddies in a buddy allocator */
 
-enum direction {
-	TOP_DOWN,
-	BOTTOM_UP
-};
-
-enum block_type {
-	BLOCK_FIRST_FIT,	/* block was allocated directly from the heap */
-	BLOCK_BUDDY,		/* block was allocated from a buddy sub-heap */
-	BLOCK_EMPTY,
-};
-
-struct heap_stat {
-	size_t free;		/* total free size */
-	size_t free_largest;	/* largest free block */
-	size_t free_count;	/* number of free blocks */
-	size_t total;		/* total size */
-	size_t largest;		/* largest unique block */
-	size_t count;		/* total number of blocks */
-	/* fast compaction attempt counter */
-	unsigned int compaction_count_fast;
-	/* full compaction attempt counter */
-	unsigned int compaction_count_full;
-};
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+/* background compaction starts once this percentage of the free space is
+ * outside the largest free block */
+#define NVMAP_HEAP_COMPACT_FRAG		25
+/* and relocates at most this many blocks per run */
+#define NVMAP_HEAP_COMPACT_BUDGET	8
+#define NVMAP_HEAP_COMPACT_DELAY	(HZ / 2)
+#endif
 
 struct buddy_heap;
 
@@ -103,17 +98,6 @@ struct buddy_block {
 	struct buddy_heap *heap;
 };
 
-struct list_block {
-	struct nvmap_heap_block block;
-	struct list_head all_list;
-	unsigned int mem_prot;
-	unsigned long orig_addr;
-	size_t size;
-	size_t align;
-	struct nvmap_heap *heap;
-	struct list_head free_list;
-};
-
 struct combo_block {
 	union {
 		struct list_block lb;
@@ -134,8 +118,7 @@ struct buddy_heap {
 };
 
 struct nvmap_heap {
-	struct list_head all_list;
-	struct list_head free_list;
+	struct nvmap_heap_core core;
 	struct mutex lock;
 	struct list_head buddy_list;
 	unsigned int min_buddy_shift;
@@ -144,6 +127,9 @@ struct nvmap_heap {
 	const char *name;
 	void *arg;
 	struct device dev;
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	struct delayed_work compact_work;
+#endif
 };
 
 static struct kmem_cache *buddy_heap_cache;
@@ -160,6 +146,16 @@ static inline unsigned int order_of(size_t len, size_t min_shift)
 	return fls(len)-1;
 }
 
+static struct list_block *heap_alloc_block(void)
+{
+	return kmem_cache_zalloc(block_cache, GFP_KERNEL);
+}
+
+static void heap_free_block(struct list_block *b)
+{
+	kmem_cache_free(block_cache, b);
+}
+
 /* returns the free size in bytes of the buddy heap; must be called while
  * holding the parent heap's lock. */
 static void buddy_stat(struct buddy_heap *heap, struct heap_stat *stat)
@@ -189,17 +185,11 @@ static void buddy_stat(struct buddy_heap *heap, struct heap_stat *stat)
 static unsigned long heap_stat(struct nvmap_heap *heap, struct heap_stat *stat)
 {
 	struct buddy_heap *bh;
-	struct list_block *l = NULL;
-	unsigned long base = -1ul;
+	unsigned long base;
 
 	memset(stat, 0, sizeof(*stat));
 	mutex_lock(&heap->lock);
-	list_for_each_entry(l, &heap->all_list, all_list) {
-		stat->total += l->size;
-		stat->largest = max(l->size, stat->largest);
-		stat->count++;
-		base = min(base, l->orig_addr);
-	}
+	base = nvmap_heap_core_stat(&heap->core, stat);
 
 	list_for_each_entry(bh, &heap->buddy_list, buddy_list) {
 		buddy_stat(bh, stat);
@@ -209,14 +199,11 @@ static unsigned long heap_stat(struct nvmap_heap *heap, struct heap_stat *stat)
 		stat->total -= bh->heap_base->size;
 		stat->count--;
 	}
-
-	list_for_each_entry(l, &heap->free_list, free_list) {
-		stat->free += l->size;
-		stat->free_count++;
-		stat->free_largest = max(l->size, stat->free_largest);
-	}
 	mutex_unlock(&heap->lock);
 
+	stat->fragmentation = nvmap_heap_fragmentation(stat->free,
+						       stat->free_largest);
+
 	return base;
 }
 
@@ -247,6 +234,9 @@ static struct device_attribute heap_stat_free_size =
 static struct device_attribute heap_stat_base =
 	__ATTR(base, S_IRUGO, heap_stat_show, NULL);
 
+static struct device_attribute heap_stat_fragmentation =
+	__ATTR(fragmentation, S_IRUGO, heap_stat_show, NULL);
+
 static struct device_attribute heap_attr_name =
 	__ATTR(name, S_IRUGO, heap_name_show, NULL);
 
@@ -258,6 +248,7 @@ static struct attribute *heap_stat_attrs[] = {
 	&heap_stat_free_count.attr,
 	&heap_stat_free_size.attr,
 	&heap_stat_base.attr,
+	&heap_stat_fragmentation.attr,
 	&heap_attr_name.attr,
 	NULL,
 };
@@ -297,6 +288,8 @@ static ssize_t heap_stat_show(struct device *dev,
 		return sprintf(buf, "%u\n", stat.free);
 	else if (attr == &heap_stat_base)
 		return sprintf(buf, "%08lx\n", base);
+	else if (attr == &heap_stat_fragmentation)
+		return sprintf(buf, "%u\n", stat.fragmentation);
 	else
 		return -EINVAL;
 }
@@ -393,10 +386,7 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 					      unsigned int mem_prot,
 					      unsigned long base_max)
 {
-	struct list_block *b = NULL;
-	struct list_block *i = NULL;
-	struct list_block *rem = NULL;
-	unsigned long fix_base;
+	struct list_block *b;
 	enum direction dir;
 
 	/* since pages are only mappable with one cache attribute,
@@ -416,86 +406,12 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 	dir = (len <= heap->small_alloc) ? BOTTOM_UP : TOP_DOWN;
 #endif
 
-	if (dir == BOTTOM_UP) {
-		list_for_each_entry(i, &heap->free_list, free_list) {
-			size_t fix_size;
-			fix_base = ALIGN(i->block.base, align);
-			fix_size = i->size - (fix_base - i->block.base);
-
-			/* needed for compaction. relocated chunk
-			 * should never go up */
-			if (base_max && fix_base > base_max)
-				break;
-
-			if (fix_size >= len) {
-				b = i;
-				break;
-			}
-		}
-	} else {
-		list_for_each_entry_reverse(i, &heap->free_list, free_list) {
-			if (i->size >= len) {
-				fix_base = i->block.base + i->size - len;
-				fix_base &= ~(align-1);
-				if (fix_base >= i->block.base) {
-					b = i;
-					break;
-				}
-			}
-		}
-	}
-
+	b = nvmap_heap_core_alloc(&heap->core, len, align, dir, base_max);
 	if (!b)
 		return NULL;
 
-	if (dir == BOTTOM_UP)
-		b->block.type = BLOCK_FIRST_FIT;
-
-	/* split free block */
-	if (b->block.base != fix_base) {
-		/* insert a new free block before allocated */
-		rem = kmem_cache_zalloc(block_cache, GFP_KERNEL);
-		if (!rem) {
-			b->orig_addr = b->block.base;
-			b->block.base = fix_base;
-			b->size -= (b->block.base - b->orig_addr);
-			goto out;
-		}
-
-		rem->block.type = BLOCK_EMPTY;
-		rem->block.base = b->block.base;
-		rem->orig_addr = rem->block.base;
-		rem->size = fix_base - rem->block.base;
-		b->block.base = fix_base;
-		b->orig_addr = fix_base;
-		b->size -= rem->size;
-		list_add_tail(&rem->all_list,  &b->all_list);
-		list_add_tail(&rem->free_list, &b->free_list);
-	}
-
-	b->orig_addr = b->block.base;
-
-	if (b->size > len) {
-		/* insert a new free block after allocated */
-		rem = kmem_cache_zalloc(block_cache, GFP_KERNEL);
-		if (!rem)
-			goto out;
-
-		rem->block.type = BLOCK_EMPTY;
-		rem->block.base = b->block.base + len;
-		rem->size = b->size - len;
-		BUG_ON(rem->size > b->size);
-		rem->orig_addr = rem->block.base;
-		b->size = len;
-		list_add(&rem->all_list,  &b->all_list);
-		list_add(&rem->free_list, &b->free_list);
-	}
-
-out:
-	list_del(&b->free_list);
 	b->heap = heap;
 	b->mem_prot = mem_prot;
-	b->align = align;
 	return &b->block;
 }
 
@@ -503,16 +419,19 @@ out:
 static void freelist_debug(struct nvmap_heap *heap, const char *title,
 			   struct list_block *token)
 {
-	int i;
+	int i, c;
 	struct list_block *n;
 
 	dev_debug(&heap->dev, "%s\n", title);
-	i = 0;
-	list_for_each_entry(n, &heap->free_list, free_list) {
-		dev_debug(&heap->dev, "\t%d [%p..%p]%s\n", i, (void *)n->orig_addr,
-			  (void *)(n->orig_addr + n->size),
-			  (n == token) ? "<--" : "");
-		i++;
+	for (c = 0; c < NVMAP_HEAP_NR_CLASSES; c++) {
+		i = 0;
+		list_for_each_entry(n, &heap->core.free_lists[c], free_list) {
+			dev_debug(&heap->dev, "\t%d.%d [%p..%p]%s\n", c, i,
+				  (void *)n->orig_addr,
+				  (void *)(n->orig_addr + n->size),
+				  (n == token) ? "<--" : "");
+			i++;
+		}
 	}
 }
 #else
@@ -522,56 +441,11 @@ static void freelist_debug(struct nvmap_heap *heap, const char *title,
 static struct list_block *do_heap_free(struct nvmap_heap_block *block)
 {
 	struct list_block *b = container_of(block, struct list_block, block);
-	struct list_block *n = NULL;
 	struct nvmap_heap *heap = b->heap;
 
-	BUG_ON(b->block.base > b->orig_addr);
-	b->size += (b->block.base - b->orig_addr);
-	b->block.base = b->orig_addr;
-
 	freelist_debug(heap, "free list before", b);
-
-	/* Find position of first free block to the right of freed one */
-	list_for_each_entry(n, &heap->free_list, free_list) {
-		if (n->block.base > b->block.base)
-			break;
-	}
-
-	/* Add freed block before found free one */
-	list_add_tail(&b->free_list, &n->free_list);
-	BUG_ON(list_empty(&b->all_list));
-
-	freelist_debug(heap, "free list pre-merge", b);
-
-	/* merge freed block with next if they connect
-	 * freed block becomes bigger, next one is destroyed */
-	if (!list_is_last(&b->free_list, &heap->free_list)) {
-		n = list_first_entry(&b->free_list, struct list_block, free_list);
-		if (n->block.base == b->block.base + b->size) {
-			list_del(&n->all_list);
-			list_del(&n->free_list);
-			BUG_ON(b->orig_addr >= n->orig_addr);
-			b->size += n->size;
-			kmem_cache_free(block_cache, n);
-		}
-	}
-
-	/* merge freed block with prev if they connect
-	 * previous free block becomes bigger, freed one is destroyed */
-	if (b->free_list.prev != &heap->free_list) {
-		n = list_entry(b->free_list.prev, struct list_block, free_list);
-		if (n->block.base + n->size == b->block.base) {
-			list_del(&b->all_list);
-			list_del(&b->free_list);
-			BUG_ON(n->orig_addr >= b->orig_addr);
-			n->size += b->size;
-			kmem_cache_free(block_cache, b);
-			b = n;
-		}
-	}
-
+	b = nvmap_heap_core_free(&heap->core, b);
 	freelist_debug(heap, "free list after", b);
-	b->block.type = BLOCK_EMPTY;
 	return b;
 }
 
@@ -758,8 +632,12 @@ fail:
 	return heap_block_new;
 }
 
-static void nvmap_heap_compact(struct nvmap_heap *heap,
-				size_t requested_size, bool fast)
+/* relocates blocks next to free blocks towards the bottom of the heap,
+ * until a free block of requested_size exists (if it is not 0) or budget
+ * blocks have been moved (if it is not 0).  returns the number of blocks
+ * moved; must be called while holding the heap's lock. */
+static int nvmap_heap_compact(struct nvmap_heap *heap,
+			      size_t requested_size, bool fast, int budget)
 {
 	struct list_block *block_current = NULL;
 	struct list_block *block_prev = NULL;
@@ -768,10 +646,10 @@ static void nvmap_heap_compact(struct nvmap_heap *heap,
 	struct list_head *ptr, *ptr_prev, *ptr_next;
 	int relocation_count = 0;
 
-	ptr = heap->all_list.next;
+	ptr = heap->core.all_list.next;
 
 	/* walk through all blocks */
-	while (ptr != &heap->all_list) {
+	while (ptr != &heap->core.all_list) {
 		block_current = list_entry(ptr, struct list_block, all_list);
 
 		ptr_prev = ptr->prev;
@@ -782,11 +660,15 @@ static void nvmap_heap_compact(struct nvmap_heap *heap,
 			continue;
 		}
 
-		if (fast && block_current->size >= requested_size)
+		if (fast && requested_size &&
+		    block_current->size >= requested_size)
+			break;
+
+		if (budget && relocation_count >= budget)
 			break;
 
 		/* relocate prev block */
-		if (ptr_prev != &heap->all_list) {
+		if (ptr_prev != &heap->core.all_list) {
 
 			block_prev = list_entry(ptr_prev,
 					struct list_block, all_list);
@@ -805,7 +687,7 @@ static void nvmap_heap_compact(struct nvmap_heap *heap,
 			}
 		}
 
-		if (ptr_next != &heap->all_list) {
+		if (ptr_next != &heap->core.all_list) {
 
 			block_next = list_entry(ptr_next,
 					struct list_block, all_list);
@@ -820,7 +702,29 @@ static void nvmap_heap_compact(struct nvmap_heap *heap,
 		}
 		ptr = ptr_next;
 	}
-	pr_err("Relocated %d chunks\n", relocation_count);
+	return relocation_count;
+}
+
+static bool heap_fragmented(struct nvmap_heap *heap)
+{
+	return nvmap_heap_fragmentation(heap->core.free_size,
+			nvmap_heap_core_free_largest(&heap->core)) >=
+		NVMAP_HEAP_COMPACT_FRAG;
+}
+
+static void nvmap_heap_compact_work(struct work_struct *work)
+{
+	struct nvmap_heap *heap = container_of(to_delayed_work(work),
+					       struct nvmap_heap, compact_work);
+	int moved;
+
+	mutex_lock(&heap->lock);
+	moved = nvmap_heap_compact(heap, 0, true, NVMAP_HEAP_COMPACT_BUDGET);
+	/* keep going while there is something left that can be moved */
+	if (moved && heap_fragmented(heap))
+		schedule_delayed_work(&heap->compact_work,
+				      NVMAP_HEAP_COMPACT_DELAY);
+	mutex_unlock(&heap->lock);
 }
 #endif
 
@@ -860,11 +764,13 @@ struct nvmap_heap_block *nvmap_heap_alloc(struct nvmap_heap *h,
 	b = do_heap_alloc(h, len, align, prot, 0);
 	if (!b) {
 		pr_err("Compaction triggered!\n");
-		nvmap_heap_compact(h, len, true);
+		pr_err("Relocated %d chunks\n",
+		       nvmap_heap_compact(h, len, true, 0));
 		b = do_heap_alloc(h, len, align, prot, 0);
 		if (!b) {
 			pr_err("Full compaction triggered!\n");
-			nvmap_heap_compact(h, len, false);
+			pr_err("Relocated %d chunks\n",
+			       nvmap_heap_compact(h, len, false, 0));
 			b = do_heap_alloc(h, len, align, prot, 0);
 		}
 	}
@@ -914,6 +820,11 @@ void nvmap_heap_free(struct nvmap_heap_block *b)
 		lb = container_of(b, struct list_block, block);
 		nvmap_flush_heap_block(NULL, b, lb->size, lb->mem_prot);
 		do_heap_free(b);
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+		if (heap_fragmented(h))
+			schedule_delayed_work(&h->compact_work,
+					      NVMAP_HEAP_COMPACT_DELAY);
+#endif
 	}
 
 	if (bh) {
@@ -1004,16 +915,14 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 	h->buddy_heap_size = buddy_size;
 	if (buddy_size)
 		h->min_buddy_shift = ilog2(buddy_size / MAX_BUDDY_NR);
-	INIT_LIST_HEAD(&h->free_list);
 	INIT_LIST_HEAD(&h->buddy_list);
-	INIT_LIST_HEAD(&h->all_list);
 	mutex_init(&h->lock);
-	l->block.base = base;
-	l->block.type = BLOCK_EMPTY;
-	l->size = len;
-	l->orig_addr = base;
-	list_add_tail(&l->free_list, &h->free_list);
-	list_add_tail(&l->all_list, &h->all_list);
+	h->core.alloc_block = heap_alloc_block;
+	h->core.free_block = heap_free_block;
+	nvmap_heap_core_init(&h->core, l, base, len);
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	INIT_DELAYED_WORK(&h->compact_work, nvmap_heap_compact_work);
+#endif
 
 	inner_flush_cache_all();
 	outer_flush_range(base, base + len);
@@ -1045,6 +954,9 @@ void nvmap_heap_destroy(struct nvmap_heap *heap)
 {
 	WARN_ON(!list_empty(&heap->buddy_list));
 
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	cancel_delayed_work_sync(&heap->compact_work);
+#endif
 	sysfs_remove_group(&heap->dev.kobj, &heap_stat_attr_group);
 	device_unregister(&heap->dev);
 
@@ -1057,10 +969,10 @@ void nvmap_heap_destroy(struct nvmap_heap *heap)
 		kmem_cache_free(buddy_heap_cache, b);
 	}
 
-	WARN_ON(!list_is_singular(&heap->all_list));
-	while (!list_empty(&heap->all_list)) {
+	WARN_ON(!list_is_singular(&heap->core.all_list));
+	while (!list_empty(&heap->core.all_list)) {
 		struct list_block *l;
-		l = list_first_entry(&heap->all_list, struct list_block,
+		l = list_first_entry(&heap->core.all_list, struct list_block,
 				     all_list);
 		list_del(&l->all_list);
 		kmem_cache_free(block_cache, l);
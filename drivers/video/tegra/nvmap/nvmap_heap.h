@@ -25,6 +25,8 @@
 
 struct device;
 struct nvmap_heap;
+struct nvmap_handle;
+struct nvmap_client;
 struct attribute_group;
 
 struct nvmap_heap_block {
@@ -0,0 +1,271 @@
+/*
+ * drivers/video/tegra/nvmap/nvmap_heap_core.c
+ *
+ * Free lists and block split/merge for the GPU heap allocator.
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+
+#include <asm/page.h>
+
+#include "nvmap_heap_core.h"
+
+/*
+ * free blocks are kept on segregated lists by power-of-2 size class, so an
+ * allocation only looks at free blocks that can hold it.  it is placed in
+ * the smallest class with a block that fits, at the lowest (BOTTOM_UP) or
+ * highest (TOP_DOWN) address in that class.  freed blocks are merged with
+ * their free neighbours in the address-ordered list of all blocks.
+ */
+
+static inline unsigned int size_class(size_t len)
+{
+	return min_t(unsigned int, fls(len >> PAGE_SHIFT),
+		     NVMAP_HEAP_NR_CLASSES - 1);
+}
+
+/* the size of a free block must not change while it is on a free list */
+static void free_list_add(struct nvmap_heap_core *core, struct list_block *b)
+{
+	list_add_tail(&b->free_list, &core->free_lists[size_class(b->size)]);
+	core->free_size += b->size;
+}
+
+static void free_list_del(struct nvmap_heap_core *core, struct list_block *b)
+{
+	list_del(&b->free_list);
+	core->free_size -= b->size;
+}
+
+void nvmap_heap_core_init(struct nvmap_heap_core *core, struct list_block *l,
+			  unsigned long base, size_t len)
+{
+	int c;
+
+	for (c = 0; c < NVMAP_HEAP_NR_CLASSES; c++)
+		INIT_LIST_HEAD(&core->free_lists[c]);
+	INIT_LIST_HEAD(&core->all_list);
+	core->free_size = 0;
+	l->block.base = base;
+	l->block.type = BLOCK_EMPTY;
+	l->size = len;
+	l->orig_addr = base;
+	list_add_tail(&l->all_list, &core->all_list);
+	free_list_add(core, l);
+}
+
+size_t nvmap_heap_core_free_largest(struct nvmap_heap_core *core)
+{
+	struct list_block *l;
+	size_t largest = 0;
+	int c;
+
+	for (c = NVMAP_HEAP_NR_CLASSES - 1; c >= 0 && !largest; c--)
+		list_for_each_entry(l, &core->free_lists[c], free_list)
+			largest = max(largest, l->size);
+	return largest;
+}
+
+unsigned int nvmap_heap_fragmentation(size_t free, size_t largest)
+{
+	if (!free)
+		return 0;
+	return div_u64((u64)(free - largest) * 100, free);
+}
+
+unsigned long nvmap_heap_core_stat(struct nvmap_heap_core *core,
+				   struct heap_stat *stat)
+{
+	struct list_block *l;
+	unsigned long base = -1ul;
+	int c;
+
+	list_for_each_entry(l, &core->all_list, all_list) {
+		stat->total += l->size;
+		stat->largest = max(l->size, stat->largest);
+		stat->count++;
+		base = min(base, l->orig_addr);
+	}
+
+	for (c = 0; c < NVMAP_HEAP_NR_CLASSES; c++) {
+		list_for_each_entry(l, &core->free_lists[c], free_list) {
+			stat->free += l->size;
+			stat->free_count++;
+			stat->free_largest = max(l->size, stat->free_largest);
+		}
+	}
+	return base;
+}
+
+/*
+ * finds the free block to place an allocation of len bytes in, and the
+ * aligned base of the allocation inside it.  the smallest size class that
+ * has room is used, except when base_max is set: then the lowest fitting
+ * base anywhere in the heap is wanted, to move a block as far down as it
+ * can go.
+ */
+static struct list_block *find_free_block(struct nvmap_heap_core *core,
+					  size_t len, size_t align,
+					  enum direction dir,
+					  unsigned long base_max,
+					  unsigned long *base)
+{
+	struct list_block *b = NULL;
+	struct list_block *i;
+	unsigned long fix_base;
+	unsigned int c;
+
+	for (c = size_class(len); c < NVMAP_HEAP_NR_CLASSES; c++) {
+		list_for_each_entry(i, &core->free_lists[c], free_list) {
+			if (i->size < len)
+				continue;
+
+			if (dir == BOTTOM_UP) {
+				fix_base = ALIGN(i->block.base, align);
+				if (fix_base - i->block.base > i->size - len)
+					continue;
+			} else {
+				fix_base = i->block.base + i->size - len;
+				fix_base &= ~(align-1);
+				if (fix_base < i->block.base)
+					continue;
+			}
+
+			/* needed for compaction. relocated chunk
+			 * should never go up */
+			if (base_max && fix_base > base_max)
+				continue;
+
+			if (!b || (dir == BOTTOM_UP && fix_base < *base) ||
+			    (dir == TOP_DOWN && fix_base > *base)) {
+				b = i;
+				*base = fix_base;
+			}
+		}
+
+		if (b && !base_max)
+			break;
+	}
+
+	return b;
+}
+
+struct list_block *nvmap_heap_core_alloc(struct nvmap_heap_core *core,
+					 size_t len, size_t align,
+					 enum direction dir,
+					 unsigned long base_max)
+{
+	struct list_block *b = NULL;
+	struct list_block *rem = NULL;
+	unsigned long fix_base = 0;
+
+	b = find_free_block(core, len, align, dir, base_max, &fix_base);
+	if (!b)
+		return NULL;
+
+	free_list_del(core, b);
+	b->block.type = BLOCK_FIRST_FIT;
+
+	/* split free block */
+	if (b->block.base != fix_base) {
+		/* insert a new free block before allocated */
+		rem = core->alloc_block();
+		if (!rem) {
+			b->orig_addr = b->block.base;
+			b->block.base = fix_base;
+			b->size -= (b->block.base - b->orig_addr);
+			goto out;
+		}
+
+		rem->block.type = BLOCK_EMPTY;
+		rem->block.base = b->block.base;
+		rem->orig_addr = rem->block.base;
+		rem->size = fix_base - rem->block.base;
+		b->block.base = fix_base;
+		b->orig_addr = fix_base;
+		b->size -= rem->size;
+		list_add_tail(&rem->all_list,  &b->all_list);
+		free_list_add(core, rem);
+	}
+
+	b->orig_addr = b->block.base;
+
+	if (b->size > len) {
+		/* insert a new free block after allocated */
+		rem = core->alloc_block();
+		if (!rem)
+			goto out;
+
+		rem->block.type = BLOCK_EMPTY;
+		rem->block.base = b->block.base + len;
+		rem->size = b->size - len;
+		BUG_ON(rem->size > b->size);
+		rem->orig_addr = rem->block.base;
+		b->size = len;
+		list_add(&rem->all_list,  &b->all_list);
+		free_list_add(core, rem);
+	}
+
+out:
+	b->align = align;
+	return b;
+}
+
+struct list_block *nvmap_heap_core_free(struct nvmap_heap_core *core,
+					struct list_block *b)
+{
+	struct list_block *n = NULL;
+
+	BUG_ON(b->block.base < b->orig_addr);
+	b->size += (b->block.base - b->orig_addr);
+	b->block.base = b->orig_addr;
+	b->block.type = BLOCK_EMPTY;
+
+	/* merge freed block with next if it is free
+	 * freed block becomes bigger, next one is destroyed */
+	if (!list_is_last(&b->all_list, &core->all_list)) {
+		n = list_entry(b->all_list.next, struct list_block, all_list);
+		if (n->block.type == BLOCK_EMPTY) {
+			BUG_ON(n->block.base != b->block.base + b->size);
+			free_list_del(core, n);
+			list_del(&n->all_list);
+			b->size += n->size;
+			core->free_block(n);
+		}
+	}
+
+	/* merge freed block with prev if it is free
+	 * previous free block becomes bigger, freed one is destroyed */
+	if (b->all_list.prev != &core->all_list) {
+		n = list_entry(b->all_list.prev, struct list_block, all_list);
+		if (n->block.type == BLOCK_EMPTY) {
+			BUG_ON(n->block.base + n->size != b->block.base);
+			free_list_del(core, n);
+			list_del(&b->all_list);
+			n->size += b->size;
+			core->free_block(b);
+			b = n;
+		}
+	}
+
+	free_list_add(core, b);
+	return b;
+}
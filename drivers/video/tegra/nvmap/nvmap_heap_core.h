@@ -0,0 +1,116 @@
+/*
+ * drivers/video/tegra/nvmap/nvmap_heap_core.h
+ *
+ * Free lists and block split/merge for the GPU heap allocator.
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __NVMAP_HEAP_CORE_H
+#define __NVMAP_HEAP_CORE_H
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+#include "nvmap_heap.h"
+
+/*
+ * The address-ordered block list, the size class free lists and the
+ * split/merge of blocks.  Nothing in here locks, sleeps or touches the
+ * memory, so it builds as is in tools/testing/nvmap-heap to replay
+ * allocation traces; locking, buddy heaps, relocation and sysfs stay in
+ * nvmap_heap.c.
+ */
+
+/* free list size classes: class n >= 1 holds free blocks of
+ * [2^(n-1), 2^n) pages, the last class everything larger */
+#define NVMAP_HEAP_NR_CLASSES	16
+
+enum direction {
+	TOP_DOWN,
+	BOTTOM_UP
+};
+
+enum block_type {
+	BLOCK_FIRST_FIT,	/* block was allocated directly from the heap */
+	BLOCK_BUDDY,		/* block was allocated from a buddy sub-heap */
+	BLOCK_EMPTY,
+};
+
+struct heap_stat {
+	size_t free;		/* total free size */
+	size_t free_largest;	/* largest free block */
+	size_t free_count;	/* number of free blocks */
+	size_t total;		/* total size */
+	size_t largest;		/* largest unique block */
+	size_t count;		/* total number of blocks */
+	/* percentage of the free size outside of the largest free block */
+	unsigned int fragmentation;
+	/* fast compaction attempt counter */
+	unsigned int compaction_count_fast;
+	/* full compaction attempt counter */
+	unsigned int compaction_count_full;
+};
+
+struct list_block {
+	struct nvmap_heap_block block;
+	struct list_head all_list;
+	unsigned int mem_prot;
+	unsigned long orig_addr;
+	size_t size;
+	size_t align;
+	struct nvmap_heap *heap;
+	struct list_head free_list;	/* in free_lists[] while empty */
+};
+
+struct nvmap_heap_core {
+	struct list_head all_list;
+	struct list_head free_lists[NVMAP_HEAP_NR_CLASSES];
+	size_t free_size;
+	/* zeroed list_block for a split, NULL if there is no memory */
+	struct list_block *(*alloc_block)(void);
+	void (*free_block)(struct list_block *b);
+};
+
+/* set up core to manage len bytes at base, with l as its one free block */
+void nvmap_heap_core_init(struct nvmap_heap_core *core, struct list_block *l,
+			  unsigned long base, size_t len);
+
+/* places len bytes aligned to align (a power of 2) in the free space and
+ * splits the rest of the free block off; the result is not above base_max
+ * unless that is 0.  returns NULL when nothing fits. */
+struct list_block *nvmap_heap_core_alloc(struct nvmap_heap_core *core,
+					 size_t len, size_t align,
+					 enum direction dir,
+					 unsigned long base_max);
+
+/* frees b and merges it with its free neighbours, returns the free block
+ * that b ended up in */
+struct list_block *nvmap_heap_core_free(struct nvmap_heap_core *core,
+					struct list_block *b);
+
+/* size of the largest free block */
+size_t nvmap_heap_core_free_largest(struct nvmap_heap_core *core);
+
+/* adds the list blocks of core to stat, returns the lowest block address */
+unsigned long nvmap_heap_core_stat(struct nvmap_heap_core *core,
+				   struct heap_stat *stat);
+
+/* percentage of free outside of the largest free block */
+unsigned int nvmap_heap_fragmentation(size_t free, size_t largest);
+
+#endif
@@ -320,67 +320,75 @@ out:
 	return err;
 }
 
-int nvmap_ioctl_get_param(struct file *filp, void __user* arg)
+static int handle_get_param(struct nvmap_client *client,
+			    struct nvmap_handle *h, u32 param,
+			    unsigned long *result)
 {
-	struct nvmap_handle_param op;
-	struct nvmap_client *client = filp->private_data;
-	struct nvmap_handle *h;
-	int err = 0;
-
-	if (copy_from_user(&op, arg, sizeof(op)))
-		return -EFAULT;
-
-	h = nvmap_get_handle_id(client, op.handle);
-	if (!h)
-		return -EINVAL;
-
-	switch (op.param) {
+	switch (param) {
 	case NVMAP_HANDLE_PARAM_SIZE:
-		op.result = h->orig_size;
+		*result = h->orig_size;
 		break;
 	case NVMAP_HANDLE_PARAM_ALIGNMENT:
 		mutex_lock(&h->lock);
 		if (!h->alloc)
-			op.result = 0;
+			*result = 0;
 		else if (h->heap_pgalloc)
-			op.result = PAGE_SIZE;
+			*result = PAGE_SIZE;
 		else if (h->carveout->base)
-			op.result = (h->carveout->base & -h->carveout->base);
+			*result = (h->carveout->base & -h->carveout->base);
 		else
-			op.result = SZ_4M;
+			*result = SZ_4M;
 		mutex_unlock(&h->lock);
 		break;
 	case NVMAP_HANDLE_PARAM_BASE:
 		if (WARN_ON(!h->alloc || !atomic_add_return(0, &h->pin)))
-			op.result = -1ul;
+			*result = -1ul;
 		else if (!h->heap_pgalloc) {
 			mutex_lock(&h->lock);
-			op.result = h->carveout->base;
+			*result = h->carveout->base;
 			mutex_unlock(&h->lock);
 		} else if (h->pgalloc.contig)
-			op.result = page_to_phys(h->pgalloc.pages[0]);
+			*result = page_to_phys(h->pgalloc.pages[0]);
 		else if (h->pgalloc.area)
-			op.result = h->pgalloc.area->iovm_start;
+			*result = h->pgalloc.area->iovm_start;
 		else
-			op.result = -1ul;
+			*result = -1ul;
 		break;
 	case NVMAP_HANDLE_PARAM_HEAP:
 		if (!h->alloc)
-			op.result = 0;
+			*result = 0;
 		else if (!h->heap_pgalloc) {
 			mutex_lock(&h->lock);
-			op.result = nvmap_carveout_usage(client, h->carveout);
+			*result = nvmap_carveout_usage(client, h->carveout);
 			mutex_unlock(&h->lock);
 		} else if (h->pgalloc.contig)
-			op.result = NVMAP_HEAP_SYSMEM;
+			*result = NVMAP_HEAP_SYSMEM;
 		else
-			op.result = NVMAP_HEAP_IOVMM;
+			*result = NVMAP_HEAP_IOVMM;
 		break;
 	default:
-		err = -EINVAL;
-		break;
+		return -EINVAL;
 	}
 
+	return 0;
+}
+
+int nvmap_ioctl_get_param(struct file *filp, void __user* arg)
+{
+	struct nvmap_handle_param op;
+	struct nvmap_client *client = filp->private_data;
+	struct nvmap_handle *h;
+	int err = 0;
+
+	if (copy_from_user(&op, arg, sizeof(op)))
+		return -EFAULT;
+
+	h = nvmap_get_handle_id(client, op.handle);
+	if (!h)
+		return -EINVAL;
+
+	err = handle_get_param(client, h, op.param, &op.result);
+
 	if (!err && copy_to_user(arg, &op, sizeof(op)))
 		err = -EFAULT;
 
@@ -388,6 +396,51 @@ int nvmap_ioctl_get_param(struct file *filp, void __user* arg)
 	return err;
 }
 
+/* queries the same parameter of an array of handles; the handles are
+ * resolved a batch at a time with a single lockless lookup pass */
+int nvmap_ioctl_get_param_mult(struct file *filp, void __user *arg)
+{
+	struct nvmap_handle_param_mult op;
+	struct nvmap_client *client = filp->private_data;
+	unsigned long ids[16];
+	unsigned long results[ARRAY_SIZE(ids)];
+	struct nvmap_handle *h[ARRAY_SIZE(ids)];
+	unsigned long __user *handles;
+	unsigned long __user *output;
+	unsigned int i, n, done;
+	int err = 0;
+
+	if (copy_from_user(&op, arg, sizeof(op)))
+		return -EFAULT;
+
+	handles = (unsigned long __user *)op.handles;
+	output = (unsigned long __user *)op.results;
+
+	for (done = 0; done < op.count && !err; done += n) {
+		n = min_t(unsigned int, op.count - done, ARRAY_SIZE(ids));
+
+		if (copy_from_user(ids, handles + done, n * sizeof(*ids)))
+			return -EFAULT;
+
+		err = nvmap_get_handle_ids(client, n, ids, h);
+		if (err)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (!err)
+				err = handle_get_param(client, h[i], op.param,
+						       &results[i]);
+			nvmap_handle_put(h[i]);
+		}
+
+		if (!err && copy_to_user(output + done, results,
+					 n * sizeof(*results)))
+			err = -EFAULT;
+	}
+
+	return err;
+}
+
 int nvmap_ioctl_rw_handle(struct file *filp, int is_read, void __user* arg)
 {
 	struct nvmap_client *client = filp->private_data;
@@ -535,13 +588,29 @@ static void heap_page_cache_maint(struct nvmap_client *client,
 	}
 }
 
+/* outer cache maintenance of a handle range, for when the inner cache has
+ * been taken care of as a whole */
+static void handle_outer_cache_maint(struct nvmap_client *client,
+	struct nvmap_handle *h, unsigned long start, unsigned long end,
+	unsigned int op)
+{
+	if (h->heap_pgalloc && (h->flags != NVMAP_HANDLE_INNER_CACHEABLE)) {
+		heap_page_cache_maint(client, h, start, end, op,
+				false, true, NULL, 0, 0);
+	} else if (h->flags != NVMAP_HANDLE_INNER_CACHEABLE) {
+		start += h->carveout->base;
+		end += h->carveout->base;
+		outer_cache_maint(op, start, end - start);
+	}
+}
+
 static bool fast_cache_maint(struct nvmap_client *client, struct nvmap_handle *h,
 	unsigned long start, unsigned long end, unsigned int op)
 {
 	int ret = false;
 
 	if ((op == NVMAP_CACHE_OP_INV) ||
-		((end - start) < FLUSH_CLEAN_BY_SET_WAY_THRESHOLD))
+		((end - start) < nvmap_cache_maint_threshold))
 		goto out;
 
 	if (op == NVMAP_CACHE_OP_WB_INV)
@@ -549,14 +618,7 @@ static bool fast_cache_maint(struct nvmap_client *client, struct nvmap_handle *h
 	else if (op == NVMAP_CACHE_OP_WB)
 		inner_clean_cache_all();
 
-	if (h->heap_pgalloc && (h->flags != NVMAP_HANDLE_INNER_CACHEABLE)) {
-		heap_page_cache_maint(client, h, start, end, op,
-				false, true, NULL, 0, 0);
-	} else if (h->flags != NVMAP_HANDLE_INNER_CACHEABLE) {
-		start += h->carveout->base;
-		end += h->carveout->base;
-		outer_cache_maint(op, start, end - start);
-	}
+	handle_outer_cache_maint(client, h, start, end, op);
 	ret = true;
 out:
 	return ret;
@@ -642,6 +704,174 @@ out:
 	return err;
 }
 
+#define NVMAP_CACHE_LIST_BATCH	64
+
+struct cache_list_batch {
+	struct nvmap_cache_op_range r[NVMAP_CACHE_LIST_BATCH];
+	unsigned long ids[NVMAP_CACHE_LIST_BATCH];
+	struct nvmap_handle *h[NVMAP_CACHE_LIST_BATCH];
+};
+
+static bool handle_cacheable(struct nvmap_handle *h)
+{
+	return h->flags != NVMAP_HANDLE_UNCACHEABLE &&
+		h->flags != NVMAP_HANDLE_WRITE_COMBINE;
+}
+
+/* merges each range into the one before it if it is for the same handle
+ * and op and overlaps or adjoins it, dropping the handle reference of the
+ * merged range; returns the number of ranges left. The ranges must have
+ * been checked against their handles already. */
+static unsigned int cache_list_coalesce(struct cache_list_batch *b,
+					unsigned int n)
+{
+	struct nvmap_cache_op_range *r = b->r;
+	unsigned int i, j = 0;
+	u64 end;
+
+	for (i = 0; i < n; i++) {
+		struct nvmap_cache_op_range *p = j ? &r[j - 1] : NULL;
+
+		if (p && p->handle == r[i].handle && p->op == r[i].op &&
+		    r[i].offset >= p->offset &&
+		    r[i].offset <= (u64)p->offset + p->len) {
+			end = max((u64)p->offset + p->len,
+				  (u64)r[i].offset + r[i].len);
+			if (end - p->offset <= UINT_MAX) {
+				p->len = end - p->offset;
+				nvmap_handle_put(b->h[i]);
+				continue;
+			}
+		}
+		b->h[j] = b->h[i];
+		r[j++] = r[i];
+	}
+	return j;
+}
+
+static int cache_list_maint(struct nvmap_client *client,
+			    struct cache_list_batch *b, unsigned int n)
+{
+	unsigned long total = 0;
+	bool clean_only = true;
+	bool whole = true;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < n; i++)
+		b->ids[i] = b->r[i].handle;
+
+	err = nvmap_get_handle_ids(client, n, b->ids, b->h);
+	if (err)
+		return err;
+
+	for (i = 0; i < n; i++) {
+		struct nvmap_handle *h = b->h[i];
+
+		if (!h->alloc) {
+			err = -EFAULT;
+			goto out;
+		}
+		if ((u64)b->r[i].offset + b->r[i].len > h->size) {
+			nvmap_warn(client, "cache maintenance outside handle\n");
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	n = cache_list_coalesce(b, n);
+
+	for (i = 0; i < n; i++) {
+		struct nvmap_handle *h = b->h[i];
+
+		if (!handle_cacheable(h))
+			continue;
+		/* invalidates must not be reordered against the whole
+		 * cache clean, so do them range by range */
+		if (b->r[i].op == NVMAP_CACHE_OP_INV)
+			whole = false;
+		else if (b->r[i].op == NVMAP_CACHE_OP_WB_INV)
+			clean_only = false;
+		total += b->r[i].len;
+	}
+
+	/* one set/way operation on the inner cache for the whole batch if
+	 * the ranges add up to more than it costs */
+	whole = whole && total >= nvmap_cache_maint_threshold;
+	if (whole) {
+		wmb();
+		if (clean_only)
+			inner_clean_cache_all();
+		else
+			inner_flush_cache_all();
+	}
+
+	for (i = 0; i < n && !err; i++) {
+		unsigned long start = b->r[i].offset;
+		unsigned long end = start + b->r[i].len;
+
+		if (!whole)
+			err = cache_maint(client, b->h[i], start, end,
+					  b->r[i].op);
+		else if (handle_cacheable(b->h[i]) && start != end)
+			handle_outer_cache_maint(client, b->h[i], start, end,
+						 b->r[i].op);
+	}
+
+out:
+	for (i = 0; i < n; i++)
+		nvmap_handle_put(b->h[i]);
+	return err;
+}
+
+int nvmap_ioctl_cache_maint_list(struct file *filp, void __user *arg)
+{
+	struct nvmap_client *client = filp->private_data;
+	struct nvmap_cache_op_range __user *ranges;
+	struct nvmap_cache_op_list op;
+	struct cache_list_batch *b;
+	unsigned int i, n, done;
+	int err = 0;
+
+	if (copy_from_user(&op, arg, sizeof(op)))
+		return -EFAULT;
+
+	if (!op.count)
+		return 0;
+
+	b = kmalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	ranges = (struct nvmap_cache_op_range __user *)op.ranges;
+
+	for (done = 0; done < op.count && !err; done += n) {
+		n = min_t(unsigned int, op.count - done,
+			  NVMAP_CACHE_LIST_BATCH);
+
+		if (copy_from_user(b->r, ranges + done, n * sizeof(*b->r))) {
+			err = -EFAULT;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!b->r[i].handle ||
+			    b->r[i].op < NVMAP_CACHE_OP_WB ||
+			    b->r[i].op > NVMAP_CACHE_OP_WB_INV) {
+				err = -EINVAL;
+				break;
+			}
+		}
+		if (err)
+			break;
+
+		err = cache_list_maint(client, b, n);
+	}
+
+	kfree(b);
+	return err;
+}
+
 static int rw_handle_page(struct nvmap_handle *h, int is_read,
 			  phys_addr_t start, unsigned long rw_addr,
 			  unsigned long bytes, unsigned long kaddr, pte_t *pte)
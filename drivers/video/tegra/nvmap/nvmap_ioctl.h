@@ -88,6 +88,13 @@ struct nvmap_handle_param {
 	unsigned long result;
 };
 
+struct nvmap_handle_param_mult {
+	unsigned long handles;	/* array of handles to query */
+	unsigned long results;	/* array of results to return */
+	__u32 param;		/* NVMAP_HANDLE_PARAM_* to query */
+	__u32 count;		/* number of entries in handles */
+};
+
 struct nvmap_cache_op {
 	unsigned long addr;
 	__u32 handle;
@@ -95,6 +102,18 @@ struct nvmap_cache_op {
 	__s32 op;
 };
 
+struct nvmap_cache_op_range {
+	__u32 handle;
+	__u32 offset;		/* offset into hmem */
+	__u32 len;
+	__s32 op;
+};
+
+struct nvmap_cache_op_list {
+	unsigned long ranges;	/* array of struct nvmap_cache_op_range */
+	__u32 count;		/* number of entries in ranges */
+};
+
 #define NVMAP_IOC_MAGIC 'N'
 
 /* Creates a new memory handle. On input, the argument is the size of the new
@@ -134,12 +153,23 @@ struct nvmap_cache_op {
  * reference to the same handle */
 #define NVMAP_IOC_GET_ID  _IOWR(NVMAP_IOC_MAGIC, 13, struct nvmap_create_handle)
 
-#define NVMAP_IOC_MAXNR (_IOC_NR(NVMAP_IOC_GET_ID))
+/* Returns the same parameter for each of an array of handles, like
+ * NVMAP_IOC_PARAM but without an ioctl per handle */
+#define NVMAP_IOC_PARAM_MULT _IOW(NVMAP_IOC_MAGIC, 14, struct nvmap_handle_param_mult)
+
+/* Performs cache maintenance on a list of handle ranges; consecutive
+ * entries for adjacent or overlapping ranges of the same handle and op are
+ * merged */
+#define NVMAP_IOC_CACHE_LIST _IOW(NVMAP_IOC_MAGIC, 15, struct nvmap_cache_op_list)
+
+#define NVMAP_IOC_MAXNR (_IOC_NR(NVMAP_IOC_CACHE_LIST))
 
 int nvmap_ioctl_pinop(struct file *filp, bool is_pin, void __user *arg);
 
 int nvmap_ioctl_get_param(struct file *filp, void __user* arg);
 
+int nvmap_ioctl_get_param_mult(struct file *filp, void __user *arg);
+
 int nvmap_ioctl_getid(struct file *filp, void __user *arg);
 
 int nvmap_ioctl_alloc(struct file *filp, void __user *arg);
@@ -152,6 +182,8 @@ int nvmap_map_into_caller_ptr(struct file *filp, void __user *arg);
 
 int nvmap_ioctl_cache_maint(struct file *filp, void __user *arg);
 
+int nvmap_ioctl_cache_maint_list(struct file *filp, void __user *arg);
+
 int nvmap_ioctl_rw_handle(struct file *filp, int is_read, void __user* arg);
 
 
@@ -0,0 +1,253 @@
+/*
+ * drivers/video/tegra/nvmap/nvmap_pp.c
+ *
+ * Page pools for nvmap system memory allocations
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+
+#include "nvmap.h"
+#include "nvmap_pp.h"
+
+/* Changing the kernel mapping attribute of a page means remapping it and
+ * flushing the TLB and caches, so pages freed from uncached, write-combined
+ * and inner cacheable handles are kept with that attribute in a pool per
+ * attribute and handed out again as they are.  A pool that drops below
+ * 1/8 full is refilled to 1/4 from a work item, and a shrinker gives the
+ * pages back to the kernel under memory pressure.  The stack and the
+ * thresholds are in nvmap_pp_core.c. */
+
+static const char * const pool_names[NVMAP_NUM_POOLS] = {
+	[NVMAP_UC_POOL]		= "uc",
+	[NVMAP_WC_POOL]		= "wc",
+	[NVMAP_IWB_POOL]	= "iwb",
+};
+
+/* the shrinker has no other way to find the pools */
+static struct nvmap_share *nvmap_pp_share;
+
+struct nvmap_page_pool *nvmap_page_pool_get(struct nvmap_share *share,
+					    unsigned long flags)
+{
+	if (flags >= NVMAP_NUM_POOLS || !share->pools[flags].stack.page_array)
+		return NULL;
+	return &share->pools[flags];
+}
+
+int nvmap_page_pool_alloc_pages(struct nvmap_page_pool *pool,
+				struct page **pages, int nr)
+{
+	bool refill;
+	int got;
+
+	mutex_lock(&pool->lock);
+	got = nvmap_pp_pop(&pool->stack, pages, nr);
+	pool->hits += got;
+	pool->misses += nr - got;
+	refill = nvmap_pp_need_refill(&pool->stack);
+	mutex_unlock(&pool->lock);
+
+	if (refill)
+		schedule_work(&pool->refill_work);
+	return got;
+}
+
+int nvmap_page_pool_release_pages(struct nvmap_page_pool *pool,
+				  struct page **pages, int nr)
+{
+	int taken;
+
+	mutex_lock(&pool->lock);
+	taken = nvmap_pp_push(&pool->stack, pages, nr);
+	mutex_unlock(&pool->lock);
+	return taken;
+}
+
+static void nvmap_page_pool_refill(struct work_struct *work)
+{
+	struct nvmap_page_pool *pool =
+		container_of(work, struct nvmap_page_pool, refill_work);
+	struct page *pages[NVMAP_PP_BATCH];
+	int want, got, taken;
+
+	for (;;) {
+		mutex_lock(&pool->lock);
+		want = nvmap_pp_refill_count(&pool->stack);
+		mutex_unlock(&pool->lock);
+		if (!want)
+			break;
+
+		for (got = 0; got < want; got++) {
+			pages[got] = alloc_page(GFP_NVMAP | __GFP_NORETRY);
+			if (!pages[got])
+				break;
+		}
+		if (!got)
+			break;
+
+		nvmap_pages_set_attr(pages, got, pool->flags);
+
+		mutex_lock(&pool->lock);
+		taken = nvmap_pp_push(&pool->stack, pages, got);
+		mutex_unlock(&pool->lock);
+		if (taken < got)
+			nvmap_pages_free(pages + taken, got - taken, pool->flags);
+		if (got < want)
+			break;
+	}
+}
+
+/* give up to nr pages of the pool back to the kernel, returns how many */
+static int nvmap_page_pool_drain(struct nvmap_page_pool *pool, int nr)
+{
+	struct page *pages[NVMAP_PP_BATCH];
+	int freed = 0, got;
+
+	while (freed < nr) {
+		mutex_lock(&pool->lock);
+		got = nvmap_pp_pop(&pool->stack, pages,
+				   min(nr - freed, NVMAP_PP_BATCH));
+		mutex_unlock(&pool->lock);
+		if (!got)
+			break;
+		nvmap_pages_free(pages, got, pool->flags);
+		freed += got;
+	}
+	return freed;
+}
+
+static int nvmap_page_pool_shrink(struct shrinker *shrinker,
+				  int nr_to_scan, gfp_t gfp_mask)
+{
+	struct nvmap_share *share = nvmap_pp_share;
+	int npages[NVMAP_NUM_POOLS], drain[NVMAP_NUM_POOLS];
+	int i, left;
+
+	if (!share)
+		return 0;
+
+	/* restoring the attribute may sleep */
+	if (nr_to_scan && !(gfp_mask & __GFP_WAIT))
+		return -1;
+
+	for (i = 0; i < NVMAP_NUM_POOLS; i++)
+		npages[i] = share->pools[i].stack.npages;
+	left = nvmap_pp_shrink_plan(npages, drain, NVMAP_NUM_POOLS,
+				    nr_to_scan);
+	for (i = 0; i < NVMAP_NUM_POOLS; i++)
+		if (drain[i])
+			nvmap_page_pool_drain(&share->pools[i], drain[i]);
+	return left;
+}
+
+static struct shrinker nvmap_page_pool_shrinker = {
+	.shrink = nvmap_page_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+int nvmap_page_pools_init(struct nvmap_share *share)
+{
+	struct nvmap_page_pool *pool;
+	int i;
+
+	for (i = 0; i < NVMAP_NUM_POOLS; i++) {
+		pool = &share->pools[i];
+		mutex_init(&pool->lock);
+		INIT_WORK(&pool->refill_work, nvmap_page_pool_refill);
+		pool->flags = i;
+		pool->stack.npages = 0;
+		pool->stack.max_pages = CONFIG_NVMAP_PAGE_POOL_SIZE;
+		pool->stack.page_array = vmalloc(pool->stack.max_pages *
+						 sizeof(struct page *));
+		if (!pool->stack.page_array)
+			goto fail;
+	}
+
+	nvmap_pp_share = share;
+	register_shrinker(&nvmap_page_pool_shrinker);
+	return 0;
+
+fail:
+	while (i--) {
+		vfree(share->pools[i].stack.page_array);
+		share->pools[i].stack.page_array = NULL;
+	}
+	return -ENOMEM;
+}
+
+void nvmap_page_pools_destroy(struct nvmap_share *share)
+{
+	struct nvmap_page_pool *pool;
+	int i;
+
+	if (nvmap_pp_share != share)
+		return;
+
+	unregister_shrinker(&nvmap_page_pool_shrinker);
+	nvmap_pp_share = NULL;
+	for (i = 0; i < NVMAP_NUM_POOLS; i++) {
+		pool = &share->pools[i];
+		cancel_work_sync(&pool->refill_work);
+		nvmap_page_pool_drain(pool, pool->stack.npages);
+		vfree(pool->stack.page_array);
+		pool->stack.page_array = NULL;
+	}
+}
+
+static int nvmap_page_pool_debug_show(struct seq_file *s, void *unused)
+{
+	struct nvmap_share *share = s->private;
+	struct nvmap_page_pool *pool;
+	int i;
+
+	seq_printf(s, "%-4s %8s %8s %10s %10s\n",
+		   "pool", "pages", "max", "hits", "misses");
+	for (i = 0; i < NVMAP_NUM_POOLS; i++) {
+		pool = &share->pools[i];
+		mutex_lock(&pool->lock);
+		seq_printf(s, "%-4s %8d %8d %10lu %10lu\n", pool_names[i],
+			   pool->stack.npages, pool->stack.max_pages,
+			   pool->hits, pool->misses);
+		mutex_unlock(&pool->lock);
+	}
+	return 0;
+}
+
+static int nvmap_page_pool_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nvmap_page_pool_debug_show, inode->i_private);
+}
+
+static const struct file_operations debug_page_pool_fops = {
+	.open = nvmap_page_pool_debug_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void nvmap_page_pools_debugfs_init(struct nvmap_share *share,
+				   struct dentry *root)
+{
+	debugfs_create_file("pagepools", 0444, root, share,
+			    &debug_page_pool_fops);
+}
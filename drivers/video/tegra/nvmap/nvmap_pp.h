@@ -0,0 +1,77 @@
+/*
+ * drivers/video/tegra/nvmap/nvmap_pp.h
+ *
+ * Page pools for nvmap system memory allocations
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __VIDEO_TEGRA_NVMAP_PP_H
+#define __VIDEO_TEGRA_NVMAP_PP_H
+
+#include "nvmap.h"
+
+struct dentry;
+
+#ifdef CONFIG_NVMAP_PAGE_POOLS
+
+int nvmap_page_pools_init(struct nvmap_share *share);
+
+void nvmap_page_pools_destroy(struct nvmap_share *share);
+
+void nvmap_page_pools_debugfs_init(struct nvmap_share *share,
+				   struct dentry *root);
+
+/* returns the pool for pages mapped with attribute flags, or NULL */
+struct nvmap_page_pool *nvmap_page_pool_get(struct nvmap_share *share,
+					    unsigned long flags);
+
+/* fill pages[0..ret) from the pool, the pages already have the attribute */
+int nvmap_page_pool_alloc_pages(struct nvmap_page_pool *pool,
+				struct page **pages, int nr);
+
+/* take pages[0..ret) into the pool, the caller frees the rest */
+int nvmap_page_pool_release_pages(struct nvmap_page_pool *pool,
+				  struct page **pages, int nr);
+
+#else
+
+#define nvmap_page_pools_init(_s)		0
+#define nvmap_page_pools_destroy(_s)		do { } while (0)
+#define nvmap_page_pools_debugfs_init(_s, _r)	do { } while (0)
+
+static inline struct nvmap_page_pool *nvmap_page_pool_get(
+	struct nvmap_share *share, unsigned long flags)
+{
+	return NULL;
+}
+
+static inline int nvmap_page_pool_alloc_pages(struct nvmap_page_pool *pool,
+					      struct page **pages, int nr)
+{
+	return 0;
+}
+
+static inline int nvmap_page_pool_release_pages(struct nvmap_page_pool *pool,
+						struct page **pages, int nr)
+{
+	return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * drivers/video/tegra/nvmap/nvmap_pp_core.c
+ *
+ * Page pool bookkeeping for nvmap system memory allocations
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "nvmap_pp_core.h"
+
+#define NVMAP_PP_REFILL_LOW(_s)		((_s)->max_pages / 8)
+#define NVMAP_PP_REFILL_HIGH(_s)	((_s)->max_pages / 4)
+
+int nvmap_pp_pop(struct nvmap_pp_stack *s, struct page **pages, int nr)
+{
+	nr = clamp(nr, 0, s->npages);
+	s->npages -= nr;
+	memcpy(pages, &s->page_array[s->npages], nr * sizeof(*pages));
+	return nr;
+}
+
+int nvmap_pp_push(struct nvmap_pp_stack *s, struct page **pages, int nr)
+{
+	nr = clamp(nr, 0, s->max_pages - s->npages);
+	memcpy(&s->page_array[s->npages], pages, nr * sizeof(*pages));
+	s->npages += nr;
+	return nr;
+}
+
+bool nvmap_pp_need_refill(const struct nvmap_pp_stack *s)
+{
+	return s->npages < NVMAP_PP_REFILL_LOW(s);
+}
+
+int nvmap_pp_refill_count(const struct nvmap_pp_stack *s)
+{
+	return clamp(NVMAP_PP_REFILL_HIGH(s) - s->npages, 0, NVMAP_PP_BATCH);
+}
+
+int nvmap_pp_shrink_plan(const int *npages, int *drain, int nr_pools,
+			 int nr_to_scan)
+{
+	int i, left = 0;
+
+	for (i = 0; i < nr_pools; i++) {
+		drain[i] = clamp(nr_to_scan, 0, npages[i]);
+		nr_to_scan -= drain[i];
+		left += npages[i] - drain[i];
+	}
+	return left;
+}
@@ -0,0 +1,64 @@
+/*
+ * drivers/video/tegra/nvmap/nvmap_pp_core.h
+ *
+ * Page pool bookkeeping for nvmap system memory allocations
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __VIDEO_TEGRA_NVMAP_PP_CORE_H
+#define __VIDEO_TEGRA_NVMAP_PP_CORE_H
+
+#include <linux/types.h>
+
+/* Nothing in here locks, allocates or touches the pages, so the pool
+ * bookkeeping builds as is in tools/testing/nvmap-pp. */
+
+struct page;
+
+#define NVMAP_PP_BATCH		32
+
+/* a stack of free pages that all have the same kernel mapping attribute */
+struct nvmap_pp_stack {
+	struct page **page_array;
+	int npages;
+	int max_pages;
+};
+
+/* take up to nr pages off the top of s into pages[], returns how many */
+int nvmap_pp_pop(struct nvmap_pp_stack *s, struct page **pages, int nr);
+
+/* put up to nr pages from pages[] on s until it is full, returns how many */
+int nvmap_pp_push(struct nvmap_pp_stack *s, struct page **pages, int nr);
+
+/* true once s has dropped below 1/8 full */
+bool nvmap_pp_need_refill(const struct nvmap_pp_stack *s);
+
+/* pages to allocate in the next refill round to bring s up to 1/4 full,
+ * at most NVMAP_PP_BATCH, 0 when it is there */
+int nvmap_pp_refill_count(const struct nvmap_pp_stack *s);
+
+/*
+ * Split a shrink of nr_to_scan pages over nr_pools pools holding npages[i]
+ * pages each, emptying them in order: drain[i] is set to the pages to give
+ * back from pool i.  Returns the pages left in the pools afterwards, which
+ * is what the shrinker reports.
+ */
+int nvmap_pp_shrink_plan(const int *npages, int *drain, int nr_pools,
+			 int nr_to_scan);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ * LZ4 Public Kernel Interface
+ *
+ * A compressor for the LZ4 block format: byte-aligned literal runs and
+ * matches with 16-bit offsets, favouring speed, decompression speed in
+ * particular, over ratio.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/*
+ * lz4_compress()
+ *	src	: source address of the original data
+ *	src_len	: size of the original data
+ *	dst	: output buffer address of the compressed data,
+ *		  at least lz4_compressbound(src_len) bytes
+ *	dst_len	: is the output size, which is returned after compress done
+ *	wrkmem	: address of the working memory,
+ *		  LZ4_MEM_COMPRESS bytes
+ *	return	: Success if return 0
+ *		  Error if return (< 0)
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src	: source address of the compressed data
+ *	src_len	: is the input size, therefore the compressed size
+ *	dst	: output buffer address of the decompressed data
+ *	dst_len	: is the max size of the destination buffer, which is
+ *		  replaced by the decompressed size on return
+ *	return	: Success if return 0
+ *		  Error if return (< 0)
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len);
+
+#endif
@@ -112,6 +112,13 @@ struct nvhost_set_priority_args {
 	__u32 priority;
 };
 
+/* submits the jobs queued with NVHOST_IOCTL_CHANNEL_QUEUE_JOB */
+struct nvhost_submit_batch_args {
+	__u32 num_jobs;		/* out: number of jobs submitted */
+	__u32 pad;
+	__u64 fences;		/* out: __u32 syncpt end of each job, may be 0 */
+};
+
 #define NVHOST_IOCTL_CHANNEL_FLUSH		\
 	_IOR(NVHOST_IOCTL_MAGIC, 1, struct nvhost_get_param_args)
 #define NVHOST_IOCTL_CHANNEL_GET_SYNCPOINTS	\
@@ -138,8 +145,12 @@ struct nvhost_set_priority_args {
 	_IOR(NVHOST_IOCTL_MAGIC, 12, struct nvhost_get_param_args)
 #define NVHOST_IOCTL_CHANNEL_SET_PRIORITY	\
 	_IOW(NVHOST_IOCTL_MAGIC, 13, struct nvhost_set_priority_args)
+#define NVHOST_IOCTL_CHANNEL_QUEUE_JOB		\
+	_IO(NVHOST_IOCTL_MAGIC, 14)
+#define NVHOST_IOCTL_CHANNEL_SUBMIT_BATCH	\
+	_IOWR(NVHOST_IOCTL_MAGIC, 15, struct nvhost_submit_batch_args)
 #define NVHOST_IOCTL_CHANNEL_LAST		\
-	_IOC_NR(NVHOST_IOCTL_CHANNEL_SET_PRIORITY)
+	_IOC_NR(NVHOST_IOCTL_CHANNEL_SUBMIT_BATCH)
 #define NVHOST_IOCTL_CHANNEL_MAX_ARG_SIZE sizeof(struct nvhost_submit_hdr_ext)
 
 struct nvhost_ctrl_syncpt_read_args {
@@ -164,6 +175,12 @@ struct nvhost_ctrl_syncpt_waitex_args {
 	__u32 value;
 };
 
+struct nvhost_ctrl_syncpt_fence_fd_args {
+	__u32 id;
+	__u32 thresh;
+	__s32 fd;
+};
+
 struct nvhost_ctrl_module_mutex_args {
 	__u32 id;
 	__u32 lock;
@@ -196,8 +213,11 @@ struct nvhost_ctrl_module_regrdwr_args {
 #define NVHOST_IOCTL_CTRL_GET_VERSION	\
 	_IOR(NVHOST_IOCTL_MAGIC, 7, struct nvhost_get_param_args)
 
+#define NVHOST_IOCTL_CTRL_SYNCPT_FENCE_FD	\
+	_IOWR(NVHOST_IOCTL_MAGIC, 8, struct nvhost_ctrl_syncpt_fence_fd_args)
+
 #define NVHOST_IOCTL_CTRL_LAST			\
-	_IOC_NR(NVHOST_IOCTL_CTRL_GET_VERSION)
+	_IOC_NR(NVHOST_IOCTL_CTRL_SYNCPT_FENCE_FD)
 #define NVHOST_IOCTL_CTRL_MAX_ARG_SIZE	\
 	sizeof(struct nvhost_ctrl_module_regrdwr_args)
 
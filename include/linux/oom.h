@@ -49,6 +49,14 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask,
 		int order, nodemask_t *mask);
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
+extern int register_oom_adj_notifier(struct notifier_block *nb);
+extern int unregister_oom_adj_notifier(struct notifier_block *nb);
+extern void oom_adj_notify(struct task_struct *p);
+extern void oom_adj_notify_exit(struct task_struct *p);
+
+/* values passed to the oom_adj notifiers */
+#define OOM_ADJ_NOTIFY_UPDATE	0
+#define OOM_ADJ_NOTIFY_EXIT	1
 
 extern bool oom_killer_disabled;
 
@@ -140,6 +140,7 @@ extern unsigned long nr_running(void);
 extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
+extern unsigned long nr_running_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
 
 
@@ -1540,6 +1541,12 @@ struct task_struct {
 #ifdef CONFIG_HAVE_HW_BREAKPOINT
 	atomic_t ptrace_bp_refcnt;
 #endif
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	/* linkage in the lowmemorykiller's oom_adj buckets */
+	struct list_head lowmem_node;
+	/* rss of the process when the lowmemorykiller last looked */
+	unsigned long lowmem_rss;
+#endif
 };
 
 /* Future-safe accessor for struct task_struct's cpus_allowed. */
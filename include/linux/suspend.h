@@ -299,6 +299,41 @@ static inline bool pm_wakeup_pending(void) { return false; }
 
 extern struct mutex pm_mutex;
 
+/* Phases of a suspend attempt timed by the suspend profiler */
+enum suspend_profile_phase {
+	SUSPEND_PROFILE_SYNC,
+	SUSPEND_PROFILE_FREEZE,
+	SUSPEND_PROFILE_SUSPEND,
+	SUSPEND_PROFILE_SUSPEND_NOIRQ,
+	SUSPEND_PROFILE_PLATFORM,
+	SUSPEND_PROFILE_RESUME_NOIRQ,
+	SUSPEND_PROFILE_RESUME,
+	SUSPEND_PROFILE_THAW,
+	SUSPEND_PROFILE_PHASES
+};
+
+#ifdef CONFIG_SUSPEND_PROFILE
+/* set while a suspend attempt is being profiled */
+extern bool suspend_profile_enabled;
+
+extern void suspend_profile_begin(void);
+extern void suspend_profile_phase(enum suspend_profile_phase phase);
+extern void suspend_profile_end(int error);
+extern void suspend_profile_device(struct device *dev, ktime_t calltime,
+				   int error);
+extern void suspend_profile_abort(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2)));
+#else
+#define suspend_profile_enabled	false
+
+static inline void suspend_profile_begin(void) {}
+static inline void suspend_profile_phase(enum suspend_profile_phase phase) {}
+static inline void suspend_profile_end(int error) {}
+static inline void suspend_profile_device(struct device *dev,
+					  ktime_t calltime, int error) {}
+static inline void suspend_profile_abort(const char *fmt, ...) {}
+#endif
+
 #ifndef CONFIG_HIBERNATE_CALLBACKS
 static inline void lock_system_sleep(void) {}
 static inline void unlock_system_sleep(void) {}
@@ -0,0 +1,99 @@
+/*
+ * include/trace/events/lowmemorykiller.h
+ *
+ * Android lowmemorykiller event logging to ftrace.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+
+#include <linux/sched.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmemory_kill,
+	TP_PROTO(struct task_struct *p, int oom_adj, int tasksize, int min_adj,
+		 int other_free, int other_file, u64 decide_ns),
+
+	TP_ARGS(p, oom_adj, tasksize, min_adj, other_free, other_file,
+		decide_ns),
+
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, oom_adj)
+		__field(int, tasksize)
+		__field(int, min_adj)
+		__field(int, other_free)
+		__field(int, other_file)
+		__field(u64, decide_ns)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid = p->pid;
+		__entry->oom_adj = oom_adj;
+		__entry->tasksize = tasksize;
+		__entry->min_adj = min_adj;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+		__entry->decide_ns = decide_ns;
+	),
+
+	TP_printk("comm=%s pid=%d oom_adj=%d tasksize=%d min_adj=%d "
+		  "other_free=%d other_file=%d decide_ns=%llu",
+		  __entry->comm, __entry->pid, __entry->oom_adj,
+		  __entry->tasksize, __entry->min_adj, __entry->other_free,
+		  __entry->other_file,
+		  (unsigned long long)__entry->decide_ns)
+);
+
+TRACE_EVENT(lowmemory_pressure,
+	TP_PROTO(int other_free, int other_file, long free_slope,
+		 long file_slope, long reclaim_rate, int min_adj, int need),
+
+	TP_ARGS(other_free, other_file, free_slope, file_slope, reclaim_rate,
+		min_adj, need),
+
+	TP_STRUCT__entry(
+		__field(int, other_free)
+		__field(int, other_file)
+		__field(long, free_slope)
+		__field(long, file_slope)
+		__field(long, reclaim_rate)
+		__field(int, min_adj)
+		__field(int, need)
+	),
+
+	TP_fast_assign(
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+		__entry->free_slope = free_slope;
+		__entry->file_slope = file_slope;
+		__entry->reclaim_rate = reclaim_rate;
+		__entry->min_adj = min_adj;
+		__entry->need = need;
+	),
+
+	TP_printk("other_free=%d other_file=%d free_slope=%ld file_slope=%ld "
+		  "reclaim_rate=%ld min_adj=%d need=%d",
+		  __entry->other_free, __entry->other_file,
+		  __entry->free_slope, __entry->file_slope,
+		  __entry->reclaim_rate, __entry->min_adj, __entry->need)
+);
+
+#endif /* _TRACE_LOWMEMORYKILLER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -985,6 +985,8 @@ NORET_TYPE void do_exit(long code)
 	taskstats_exit(tsk, group_dead);
 
 	exit_mm(tsk);
+	if (thread_group_leader(tsk))
+		oom_adj_notify_exit(tsk);
 
 	if (group_dead)
 		acct_process();
@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -30,6 +34,10 @@ enum {
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/* call the handlers of one level concurrently */
+static int async_handlers = 1;
+module_param_named(async, async_handlers, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
 static void early_suspend(struct work_struct *work);
@@ -44,6 +52,10 @@ enum {
 };
 static int state;
 
+static LIST_HEAD(early_suspend_domain);
+static u64 early_suspend_ns;
+static u64 late_resume_ns;
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -70,11 +82,80 @@ void unregister_early_suspend(struct early_suspend *handler)
 }
 EXPORT_SYMBOL(unregister_early_suspend);
 
-static void early_suspend(struct work_struct *work)
+static void call_early_suspend(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	h->suspend(h);
+	h->stat.suspend_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (h->stat.suspend_ns > h->stat.max_suspend_ns)
+		h->stat.max_suspend_ns = h->stat.suspend_ns;
+}
+
+static void call_late_resume(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	h->resume(h);
+	h->stat.resume_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (h->stat.resume_ns > h->stat.max_resume_ns)
+		h->stat.max_resume_ns = h->stat.resume_ns;
+}
+
+static bool level_has_peer(struct early_suspend *h)
+{
+	struct early_suspend *e;
+
+	if (h->link.prev != &early_suspend_handlers) {
+		e = list_entry(h->link.prev, struct early_suspend, link);
+		if (e->level == h->level)
+			return true;
+	}
+	if (h->link.next != &early_suspend_handlers) {
+		e = list_entry(h->link.next, struct early_suspend, link);
+		if (e->level == h->level)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Call the handlers of each level concurrently on the async threads, and
+ * wait for a level to finish before starting the next.  Suspend goes up
+ * through the levels, resume down.  Caller holds early_suspend_lock.
+ */
+static void call_handlers(bool resume)
 {
 	struct early_suspend *pos;
+	struct list_head *p;
+	int level = 0;
+	bool first = true;
+	async_func_ptr *call = resume ? call_late_resume : call_early_suspend;
+
+	p = resume ? early_suspend_handlers.prev : early_suspend_handlers.next;
+	for (; p != &early_suspend_handlers; p = resume ? p->prev : p->next) {
+		pos = list_entry(p, struct early_suspend, link);
+		if ((resume ? pos->resume : pos->suspend) == NULL)
+			continue;
+		if (!first && pos->level != level)
+			async_synchronize_full_domain(&early_suspend_domain);
+		first = false;
+		level = pos->level;
+		if (async_handlers && level_has_peer(pos))
+			async_schedule_domain(call, pos, &early_suspend_domain);
+		else
+			call(pos, 0);
+	}
+	async_synchronize_full_domain(&early_suspend_domain);
+}
+
+static void early_suspend(struct work_struct *work)
+{
 	unsigned long irqflags;
 	int abort = 0;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -93,10 +174,9 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL)
-			pos->suspend(pos);
-	}
+	start = ktime_get();
+	call_handlers(false);
+	early_suspend_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -112,9 +192,9 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -131,9 +211,9 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-		if (pos->resume != NULL)
-			pos->resume(pos);
+	start = ktime_get();
+	call_handlers(true);
+	late_resume_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -176,3 +256,54 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_debug_show(struct seq_file *s, void *data)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(s, "early_suspend: %llu us, late_resume: %llu us\n\n",
+		   div_u64(early_suspend_ns, NSEC_PER_USEC),
+		   div_u64(late_resume_ns, NSEC_PER_USEC));
+	seq_printf(s, "level  suspend_us  max_us   resume_us  max_us  handler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(s, "%5d %11llu %7llu %11llu %7llu  %pf/%pf\n",
+			   pos->level,
+			   div_u64(pos->stat.suspend_ns, NSEC_PER_USEC),
+			   div_u64(pos->stat.max_suspend_ns, NSEC_PER_USEC),
+			   div_u64(pos->stat.resume_ns, NSEC_PER_USEC),
+			   div_u64(pos->stat.max_resume_ns, NSEC_PER_USEC),
+			   pos->suspend, pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_debug_show, NULL);
+}
+
+static const struct file_operations early_suspend_debug_fops = {
+	.open		= early_suspend_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init early_suspend_debug_init(void)
+{
+	struct dentry *d;
+
+	d = debugfs_create_file("early_suspend", 0444, NULL, NULL,
+		&early_suspend_debug_fops);
+	if (!d) {
+		pr_err("Failed to create early_suspend debug file\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+late_initcall(early_suspend_debug_init);
+#endif
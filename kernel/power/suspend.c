@@ -104,10 +104,12 @@ static int suspend_prepare(void)
 	if (error)
 		goto Finish;
 
+	suspend_profile_phase(SUSPEND_PROFILE_FREEZE);
 	error = suspend_freeze_processes();
 	if (!error)
 		return 0;
 
+	suspend_profile_phase(SUSPEND_PROFILE_THAW);
 	suspend_thaw_processes();
 	usermodehelper_enable();
  Finish:
@@ -144,11 +146,13 @@ static int suspend_enter(suspend_state_t state)
 			goto Platform_finish;
 	}
 
+	suspend_profile_phase(SUSPEND_PROFILE_SUSPEND_NOIRQ);
 	error = dpm_suspend_noirq(PMSG_SUSPEND);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to power down\n");
 		goto Platform_finish;
 	}
+	suspend_profile_phase(SUSPEND_PROFILE_PLATFORM);
 
 	if (suspend_ops->prepare_late) {
 		error = suspend_ops->prepare_late();
@@ -176,7 +180,8 @@ static int suspend_enter(suspend_state_t state)
 		if (!(suspend_test(TEST_CORE) || pm_wakeup_pending())) {
 			error = suspend_ops->enter(state);
 			events_check_enabled = false;
-		}
+		} else if (pm_wakeup_pending())
+			suspend_profile_abort("wakeup event");
 		syscore_resume();
 		sysdev_resume();
 	}
@@ -191,6 +196,7 @@ static int suspend_enter(suspend_state_t state)
 	if (suspend_ops->wake)
 		suspend_ops->wake();
 
+	suspend_profile_phase(SUSPEND_PROFILE_RESUME_NOIRQ);
 	dpm_resume_noirq(PMSG_RESUME);
 
  Platform_finish:
@@ -220,6 +226,7 @@ int suspend_devices_and_enter(suspend_state_t state)
 	}
 	suspend_console();
 	suspend_test_start();
+	suspend_profile_phase(SUSPEND_PROFILE_SUSPEND);
 	error = dpm_suspend_start(PMSG_SUSPEND);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to suspend\n");
@@ -233,6 +240,7 @@ int suspend_devices_and_enter(suspend_state_t state)
 
  Resume_devices:
 	suspend_test_start();
+	suspend_profile_phase(SUSPEND_PROFILE_RESUME);
 	dpm_resume_end(PMSG_RESUME);
 	suspend_test_finish("resume devices");
 	resume_console();
@@ -282,6 +290,8 @@ int enter_state(suspend_state_t state)
 	if (!mutex_trylock(&pm_mutex))
 		return -EBUSY;
 
+	suspend_profile_begin();
+	suspend_profile_phase(SUSPEND_PROFILE_SYNC);
 	printk(KERN_INFO "PM: Syncing filesystems ... ");
 	sys_sync();
 	printk("done.\n");
@@ -301,8 +311,10 @@ int enter_state(suspend_state_t state)
 
  Finish:
 	pr_debug("PM: Finishing wakeup.\n");
+	suspend_profile_phase(SUSPEND_PROFILE_THAW);
 	suspend_finish();
  Unlock:
+	suspend_profile_end(error);
 	mutex_unlock(&pm_mutex);
 	return error;
 }
@@ -0,0 +1,338 @@
+/*
+ * debugfs file to profile suspend attempts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Every suspend attempt records how long each phase took and, if it
+ * failed, what aborted it.  The time spent in each device's suspend and
+ * resume callbacks is added up per driver, so the drivers that keep the
+ * system awake longest on the way down and up can be found.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/init.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/suspend.h>
+
+#define SUSPEND_PROFILE_HISTORY		16
+#define SUSPEND_PROFILE_NAME_LEN	32
+#define SUSPEND_PROFILE_ENTRIES		256
+#define SUSPEND_PROFILE_HASH_BITS	6
+
+struct suspend_profile_attempt {
+	unsigned long seq;
+	s64 phase_ns[SUSPEND_PROFILE_PHASES];
+	int error;
+	char reason[SUSPEND_PROFILE_NAME_LEN];
+};
+
+/* per driver (or wakelock, for aborts) costs, summed over all attempts */
+struct suspend_profile_entry {
+	struct hlist_node node;
+	char name[SUSPEND_PROFILE_NAME_LEN];
+	unsigned long calls;
+	unsigned long aborts;
+	s64 suspend_ns;
+	s64 resume_ns;
+	s64 max_ns;
+};
+
+static const char *suspend_profile_phase_names[SUSPEND_PROFILE_PHASES] = {
+	[SUSPEND_PROFILE_SYNC]		= "sync",
+	[SUSPEND_PROFILE_FREEZE]	= "freeze",
+	[SUSPEND_PROFILE_SUSPEND]	= "suspend",
+	[SUSPEND_PROFILE_SUSPEND_NOIRQ]	= "late",
+	[SUSPEND_PROFILE_PLATFORM]	= "platform",
+	[SUSPEND_PROFILE_RESUME_NOIRQ]	= "early",
+	[SUSPEND_PROFILE_RESUME]	= "resume",
+	[SUSPEND_PROFILE_THAW]		= "thaw",
+};
+
+bool suspend_profile_enabled;
+
+/* protects everything below */
+static DEFINE_SPINLOCK(suspend_profile_lock);
+static struct suspend_profile_attempt history[SUSPEND_PROFILE_HISTORY];
+static unsigned long attempts;
+static unsigned long aborted_attempts;
+static int cur_phase = -1;
+static ktime_t phase_start;
+
+static struct suspend_profile_entry entries[SUSPEND_PROFILE_ENTRIES];
+static int nr_entries;
+static struct hlist_head entry_hash[1 << SUSPEND_PROFILE_HASH_BITS];
+
+static struct suspend_profile_attempt *cur_attempt(void)
+{
+	return &history[attempts % SUSPEND_PROFILE_HISTORY];
+}
+
+/*
+ * Find or add the entry for name.  Entries are never freed, once the
+ * table is full everything new is charged to the last entry, "(other)".
+ */
+static struct suspend_profile_entry *find_entry(const char *name)
+{
+	struct suspend_profile_entry *e;
+	struct hlist_node *pos;
+	struct hlist_head *head;
+	int len = strnlen(name, SUSPEND_PROFILE_NAME_LEN - 1);
+
+	head = &entry_hash[jhash(name, len, 0) &
+			   ((1 << SUSPEND_PROFILE_HASH_BITS) - 1)];
+	hlist_for_each_entry(e, pos, head, node)
+		if (!strncmp(e->name, name, len) && !e->name[len])
+			return e;
+
+	if (nr_entries == SUSPEND_PROFILE_ENTRIES - 1) {
+		e = &entries[nr_entries];
+		if (!e->name[0])
+			strlcpy(e->name, "(other)", sizeof(e->name));
+		return e;
+	}
+	e = &entries[nr_entries++];
+	memcpy(e->name, name, len);
+	e->name[len] = '\0';
+	hlist_add_head(&e->node, head);
+	return e;
+}
+
+static void end_phase_locked(ktime_t now)
+{
+	if (cur_phase >= 0)
+		cur_attempt()->phase_ns[cur_phase] +=
+			ktime_to_ns(ktime_sub(now, phase_start));
+	phase_start = now;
+}
+
+void suspend_profile_begin(void)
+{
+	struct suspend_profile_attempt *a;
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_profile_lock, flags);
+	a = cur_attempt();
+	memset(a, 0, sizeof(*a));
+	a->seq = attempts;
+	cur_phase = -1;
+	phase_start = ktime_get();
+	suspend_profile_enabled = true;
+	spin_unlock_irqrestore(&suspend_profile_lock, flags);
+}
+
+void suspend_profile_phase(enum suspend_profile_phase phase)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_profile_lock, flags);
+	if (suspend_profile_enabled) {
+		end_phase_locked(ktime_get());
+		cur_phase = phase;
+	}
+	spin_unlock_irqrestore(&suspend_profile_lock, flags);
+}
+
+void suspend_profile_end(int error)
+{
+	struct suspend_profile_attempt *a;
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_profile_lock, flags);
+	if (!suspend_profile_enabled)
+		goto out;
+	end_phase_locked(ktime_get());
+	cur_phase = -1;
+	a = cur_attempt();
+	a->error = error;
+	if (error) {
+		aborted_attempts++;
+		if (!a->reason[0])
+			snprintf(a->reason, sizeof(a->reason), "error %d",
+				 error);
+	}
+	attempts++;
+	suspend_profile_enabled = false;
+out:
+	spin_unlock_irqrestore(&suspend_profile_lock, flags);
+}
+
+void suspend_profile_device(struct device *dev, ktime_t calltime, int error)
+{
+	struct suspend_profile_entry *e;
+	unsigned long flags;
+	s64 delta;
+	const char *name;
+
+	if (!suspend_profile_enabled)
+		return;
+	delta = ktime_to_ns(ktime_sub(ktime_get(), calltime));
+	name = dev_driver_string(dev);
+	if (!name[0])
+		name = dev_name(dev);
+
+	spin_lock_irqsave(&suspend_profile_lock, flags);
+	e = find_entry(name);
+	e->calls++;
+	switch (cur_phase) {
+	case SUSPEND_PROFILE_SUSPEND:
+	case SUSPEND_PROFILE_SUSPEND_NOIRQ:
+		e->suspend_ns += delta;
+		break;
+	default:
+		e->resume_ns += delta;
+		break;
+	}
+	if (delta > e->max_ns)
+		e->max_ns = delta;
+	if (error && !cur_attempt()->reason[0]) {
+		e->aborts++;
+		strlcpy(cur_attempt()->reason, name,
+			sizeof(cur_attempt()->reason));
+	}
+	spin_unlock_irqrestore(&suspend_profile_lock, flags);
+}
+
+/*
+ * Record what aborted the current attempt, the first caller wins.  Also
+ * counts aborts that happen before an attempt got started, such as a
+ * wakelock taken just as the suspend work ran.
+ */
+void suspend_profile_abort(const char *fmt, ...)
+{
+	char reason[SUSPEND_PROFILE_NAME_LEN];
+	struct suspend_profile_attempt *a = NULL;
+	unsigned long flags;
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(reason, sizeof(reason), fmt, args);
+	va_end(args);
+
+	spin_lock_irqsave(&suspend_profile_lock, flags);
+	if (suspend_profile_enabled) {
+		a = cur_attempt();
+		if (a->reason[0])
+			goto out;
+		strlcpy(a->reason, reason, sizeof(a->reason));
+	}
+	find_entry(reason)->aborts++;
+out:
+	spin_unlock_irqrestore(&suspend_profile_lock, flags);
+}
+
+static int cmp_entry_cost(const void *a, const void *b)
+{
+	const struct suspend_profile_entry *ea = a, *eb = b;
+	s64 ca = ea->suspend_ns + ea->resume_ns;
+	s64 cb = eb->suspend_ns + eb->resume_ns;
+
+	if (ca != cb)
+		return ca < cb ? 1 : -1;
+	if (ea->aborts != eb->aborts)
+		return ea->aborts < eb->aborts ? 1 : -1;
+	return 0;
+}
+
+static void show_attempt(struct seq_file *s, struct suspend_profile_attempt *a)
+{
+	int i;
+
+	seq_printf(s, "%5lu %5d", a->seq, a->error);
+	for (i = 0; i < SUSPEND_PROFILE_PHASES; i++)
+		seq_printf(s, " %8lld", div_s64(a->phase_ns[i], NSEC_PER_USEC));
+	seq_printf(s, "  %s\n", a->reason[0] ? a->reason : "-");
+}
+
+static int suspend_profile_debug_show(struct seq_file *s, void *data)
+{
+	struct suspend_profile_attempt *recent;
+	struct suspend_profile_entry *table;
+	unsigned long first, seq, total, aborted;
+	unsigned long flags;
+	int i, n;
+
+	recent = kmalloc(sizeof(history), GFP_KERNEL);
+	table = kmalloc(sizeof(entries), GFP_KERNEL);
+	if (!recent || !table) {
+		kfree(recent);
+		kfree(table);
+		return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&suspend_profile_lock, flags);
+	memcpy(recent, history, sizeof(history));
+	memcpy(table, entries, sizeof(entries));
+	n = nr_entries;
+	if (entries[SUSPEND_PROFILE_ENTRIES - 1].name[0])
+		n = SUSPEND_PROFILE_ENTRIES;
+	total = attempts;
+	aborted = aborted_attempts;
+	spin_unlock_irqrestore(&suspend_profile_lock, flags);
+
+	seq_printf(s, "attempts: %lu, aborted: %lu\n\n", total, aborted);
+	seq_printf(s, "  seq error");
+	for (i = 0; i < SUSPEND_PROFILE_PHASES; i++)
+		seq_printf(s, " %8s", suspend_profile_phase_names[i]);
+	seq_printf(s, "  aborted by (phase times in usecs)\n");
+	first = total > SUSPEND_PROFILE_HISTORY ?
+		total - SUSPEND_PROFILE_HISTORY : 0;
+	for (seq = first; seq < total; seq++)
+		show_attempt(s, &recent[seq % SUSPEND_PROFILE_HISTORY]);
+
+	sort(table, n, sizeof(*table), cmp_entry_cost, NULL);
+	seq_printf(s, "\n%-32s %8s %12s %12s %10s %6s\n", "driver", "calls",
+		   "suspend_us", "resume_us", "max_us", "aborts");
+	for (i = 0; i < n; i++)
+		seq_printf(s, "%-32s %8lu %12lld %12lld %10lld %6lu\n",
+			   table[i].name, table[i].calls,
+			   div_s64(table[i].suspend_ns, NSEC_PER_USEC),
+			   div_s64(table[i].resume_ns, NSEC_PER_USEC),
+			   div_s64(table[i].max_ns, NSEC_PER_USEC),
+			   table[i].aborts);
+
+	kfree(recent);
+	kfree(table);
+	return 0;
+}
+
+static int suspend_profile_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_profile_debug_show, NULL);
+}
+
+static const struct file_operations suspend_profile_debug_fops = {
+	.open		= suspend_profile_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init suspend_profile_debug_init(void)
+{
+	struct dentry *d;
+
+	d = debugfs_create_file("suspend_profile", 0444, NULL, NULL,
+		&suspend_profile_debug_fops);
+	if (!d) {
+		pr_err("Failed to create suspend_profile debug file\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+late_initcall(suspend_profile_debug_init);
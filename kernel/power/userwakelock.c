@@ -14,6 +14,7 @@
  */
 
 #include <linux/ctype.h>
+#include <linux/jhash.h>
 #include <linux/module.h>
 #include <linux/wakelock.h>
 #include <linux/slab.h>
@@ -34,16 +35,33 @@ static DEFINE_MUTEX(tree_lock);
 
 struct user_wake_lock {
 	struct rb_node		node;
+	struct hlist_node	hash_node;
 	struct wake_lock	wake_lock;
 	char			name[0];
 };
 struct rb_root user_wake_locks;
 
+/*
+ * The rbtree keeps the locks sorted by name for the show functions, name
+ * lookups from the store functions go through this hash table instead.
+ */
+#define USER_WAKE_LOCK_HASH_BITS	7
+static struct hlist_head user_wake_lock_hash[1 << USER_WAKE_LOCK_HASH_BITS];
+
+static struct hlist_head *user_wake_lock_bucket(const char *name, int len)
+{
+	u32 hash = jhash(name, len, 0);
+
+	return &user_wake_lock_hash[hash & ((1 << USER_WAKE_LOCK_HASH_BITS) - 1)];
+}
+
 static struct user_wake_lock *lookup_wake_lock_name(
 	const char *buf, int allocate, long *timeoutptr)
 {
 	struct rb_node **p = &user_wake_locks.rb_node;
 	struct rb_node *parent = NULL;
+	struct hlist_head *bucket;
+	struct hlist_node *pos;
 	struct user_wake_lock *l;
 	int diff;
 	u64 timeout;
@@ -78,7 +96,21 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	else if (timeoutptr)
 		*timeoutptr = 0;
 
-	/* Lookup wake lock in rbtree */
+	/* Lookup wake lock in hash table */
+	bucket = user_wake_lock_bucket(buf, name_len);
+	hlist_for_each_entry(l, pos, bucket, hash_node)
+		if (!strncmp(buf, l->name, name_len) && !l->name[name_len])
+			return l;
+
+	/* Allocate and add new wakelock to rbtree */
+	if (!allocate) {
+		if (debug_mask & DEBUG_ERROR)
+			pr_info("lookup_wake_lock_name: %.*s not found\n",
+				name_len, buf);
+		return ERR_PTR(-EINVAL);
+	}
+
+	/* Find where it goes in the rbtree */
 	while (*p) {
 		parent = *p;
 		l = rb_entry(parent, struct user_wake_lock, node);
@@ -91,19 +123,10 @@ static struct user_wake_lock *lookup_wake_lock_name(
 
 		if (diff < 0)
 			p = &(*p)->rb_left;
-		else if (diff > 0)
-			p = &(*p)->rb_right;
 		else
-			return l;
+			p = &(*p)->rb_right;
 	}
 
-	/* Allocate and add new wakelock to rbtree */
-	if (!allocate) {
-		if (debug_mask & DEBUG_ERROR)
-			pr_info("lookup_wake_lock_name: %.*s not found\n",
-				name_len, buf);
-		return ERR_PTR(-EINVAL);
-	}
 	l = kzalloc(sizeof(*l) + name_len + 1, GFP_KERNEL);
 	if (l == NULL) {
 		if (debug_mask & DEBUG_FAILURE)
@@ -117,6 +140,7 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	wake_lock_init(&l->wake_lock, WAKE_LOCK_SUSPEND, l->name);
 	rb_link_node(&l->node, parent, p);
 	rb_insert_color(&l->node, &user_wake_locks);
+	hlist_add_head(&l->hash_node, bucket);
 	return l;
 
 bad_arg:
@@ -43,6 +43,19 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+
+/*
+ * Active locks of each type are also kept where has_wake_lock can answer
+ * without walking active_wake_locks: locks with a timeout in a tree
+ * sorted by expiry, with the first and last nodes cached, and locks
+ * without a timeout just counted.
+ */
+static struct {
+	struct rb_root root;
+	struct rb_node *first;
+	struct rb_node *last;
+	int untimed;
+} active_wake_lock_queue[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
@@ -188,12 +201,61 @@ static void update_sleep_wait_stats_locked(int done)
 }
 #endif
 
+/* Caller must acquire the list_lock spinlock */
+static void enqueue_wake_lock(struct wake_lock *lock, int type)
+{
+	struct rb_node **p = &active_wake_lock_queue[type].root.rb_node;
+	struct rb_node *parent = NULL;
+	struct wake_lock *l;
+	bool first = true, last = true;
+
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE)) {
+		active_wake_lock_queue[type].untimed++;
+		return;
+	}
+	while (*p) {
+		parent = *p;
+		l = rb_entry(parent, struct wake_lock, expire_node);
+		if (time_before(lock->expires, l->expires)) {
+			p = &parent->rb_left;
+			last = false;
+		} else {
+			p = &parent->rb_right;
+			first = false;
+		}
+	}
+	rb_link_node(&lock->expire_node, parent, p);
+	rb_insert_color(&lock->expire_node, &active_wake_lock_queue[type].root);
+	if (first)
+		active_wake_lock_queue[type].first = &lock->expire_node;
+	if (last)
+		active_wake_lock_queue[type].last = &lock->expire_node;
+}
+
+/* Caller must acquire the list_lock spinlock, lock->flags must be unchanged */
+static void dequeue_wake_lock(struct wake_lock *lock, int type)
+{
+	struct rb_node *node = &lock->expire_node;
+
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return;
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE)) {
+		active_wake_lock_queue[type].untimed--;
+		return;
+	}
+	if (active_wake_lock_queue[type].first == node)
+		active_wake_lock_queue[type].first = rb_next(node);
+	if (active_wake_lock_queue[type].last == node)
+		active_wake_lock_queue[type].last = rb_prev(node);
+	rb_erase(node, &active_wake_lock_queue[type].root);
+}
 
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	dequeue_wake_lock(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -226,21 +288,24 @@ static void print_active_locks(int type)
 
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	/* only the locks that actually expired are visited */
+	while (active_wake_lock_queue[type].first) {
+		lock = rb_entry(active_wake_lock_queue[type].first,
+				struct wake_lock, expire_node);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (active_wake_lock_queue[type].untimed)
+		return -1;
+	if (!active_wake_lock_queue[type].last)
+		return 0;
+	lock = rb_entry(active_wake_lock_queue[type].last,
+			struct wake_lock, expire_node);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -255,12 +320,35 @@ long has_wake_lock(int type)
 	return ret;
 }
 
+/*
+ * Like has_wake_lock(WAKE_LOCK_SUSPEND), but also tells the suspend
+ * profiler which lock is in the way.  After has_wake_lock_locked has
+ * expired the stale locks, the first active lock is one that blocks
+ * suspend: locks without a timeout are added at the head of the list.
+ */
+static long has_wake_lock_abort(void)
+{
+	struct list_head *active = &active_wake_locks[WAKE_LOCK_SUSPEND];
+	long ret;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	ret = has_wake_lock_locked(WAKE_LOCK_SUSPEND);
+	if (ret && (debug_mask & DEBUG_SUSPEND))
+		print_active_locks(WAKE_LOCK_SUSPEND);
+	if (ret && !list_empty(active))
+		suspend_profile_abort("wakelock:%s", list_first_entry(active,
+					struct wake_lock, link)->name);
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return ret;
+}
+
 static void suspend(struct work_struct *work)
 {
 	int ret;
 	int entry_event_num;
 
-	if (has_wake_lock(WAKE_LOCK_SUSPEND)) {
+	if (has_wake_lock_abort()) {
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: abort suspend\n");
 		return;
@@ -309,7 +397,7 @@ static DEFINE_TIMER(expire_timer, expire_wake_locks, 0, 0);
 
 static int power_suspend_late(struct device *dev)
 {
-	int ret = has_wake_lock(WAKE_LOCK_SUSPEND) ? -EAGAIN : 0;
+	int ret = has_wake_lock_abort() ? -EAGAIN : 0;
 #ifdef CONFIG_WAKELOCK_STAT
 	wait_for_wakeup = 1;
 #endif
@@ -380,6 +468,7 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
+	dequeue_wake_lock(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
 	list_del(&lock->link);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -396,6 +485,7 @@ static void wake_lock_internal(
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
 	BUG_ON(!(lock->flags & WAKE_LOCK_INITIALIZED));
+	dequeue_wake_lock(lock, type);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup) {
 		if (debug_mask & DEBUG_WAKEUP)
@@ -431,6 +521,7 @@ static void wake_lock_internal(
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
 	}
+	enqueue_wake_lock(lock, type);
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -483,6 +574,7 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	dequeue_wake_lock(lock, type);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -537,8 +629,10 @@ static int __init wakelocks_init(void)
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
+	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++) {
 		INIT_LIST_HEAD(&active_wake_locks[i]);
+		active_wake_lock_queue[i].root = RB_ROOT;
+	}
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
@@ -0,0 +1,27 @@
+/*
+ * lz4defs.h -- architecture independent parts of the LZ4 block format
+ *
+ * Each sequence is a token byte, then any extra literal length bytes, the
+ * literals, a little endian 16-bit match offset and any extra match length
+ * bytes. The high nibble of the token holds the literal length and the low
+ * nibble the match length less MINMATCH; a nibble of 15 is continued by
+ * bytes of 255 ended by one below 255. The last sequence is literals only,
+ * and the last LASTLITERALS bytes of input are always literals.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+#define LASTLITERALS	5
+#define MFLIMIT		(8 + MINMATCH)
+#define MAX_DISTANCE	65535
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* after this many misses in a row, start skipping ahead faster */
+#define SKIP_TRIGGER	6
@@ -568,6 +568,40 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+static ATOMIC_NOTIFIER_HEAD(oom_adj_notify_list);
+
+/*
+ * Notifier list called when a new process is created, when the oom_adj of
+ * a process is written and when a process changes its thread group leader,
+ * with OOM_ADJ_NOTIFY_UPDATE, and with OOM_ADJ_NOTIFY_EXIT once a thread
+ * group leader has released its mm on exit. Called in atomic context with
+ * the task passed as data.
+ */
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+void oom_adj_notify(struct task_struct *p)
+{
+	atomic_notifier_call_chain(&oom_adj_notify_list,
+				   OOM_ADJ_NOTIFY_UPDATE, p);
+}
+
+/* called from do_exit() after PF_EXITING is set, before the task is reaped */
+void oom_adj_notify_exit(struct task_struct *p)
+{
+	atomic_notifier_call_chain(&oom_adj_notify_list,
+				   OOM_ADJ_NOTIFY_EXIT, p);
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in
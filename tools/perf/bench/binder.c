@@ -0,0 +1,552 @@
+/*
+ *
+ * binder.c
+ *
+ * transaction: Benchmark for the Android binder IPC driver
+ *
+ * A server process registers itself as the binder context manager and
+ * runs one looper thread per client thread. The client process fires
+ * transactions at handle 0 and measures the time each of them takes to
+ * complete: until BR_REPLY for two-way calls, until
+ * BR_TRANSACTION_COMPLETE for one-way calls.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../../../drivers/staging/android/binder.h"
+
+#define BINDER_BENCH_VM_SIZE	((1 * 1024 * 1024) - (4096 * 2))
+#define BINDER_BENCH_MAX_OBJS	64
+
+static const char *device = "/dev/binder";
+static unsigned int loops = 10000;
+static unsigned int nr_threads = 1;
+static unsigned int payload_size = 128;
+static unsigned int nr_binders;
+static unsigned int nr_fds;
+static bool oneway;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "path",
+		   "Binder device node (default: /dev/binder)"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Transactions per client thread"),
+	OPT_UINTEGER('t', "threads", &nr_threads,
+		     "Number of client/server thread pairs"),
+	OPT_UINTEGER('s', "size", &payload_size,
+		     "Payload size in bytes"),
+	OPT_UINTEGER('b', "binders", &nr_binders,
+		     "Binder objects sent with each transaction"),
+	OPT_UINTEGER('F', "fds", &nr_fds,
+		     "File descriptors sent with each transaction"),
+	OPT_BOOLEAN('o', "oneway", &oneway,
+		    "Send one-way instead of two-way transactions"),
+	OPT_END()
+};
+
+static const char * const bench_binder_transaction_usage[] = {
+	"perf bench binder transaction <options>",
+	NULL
+};
+
+/* commands queued for the next BINDER_WRITE_READ of one thread */
+struct binder_conn {
+	int fd;
+	size_t wlen;
+	char wbuf[1024];
+	char rbuf[256];
+};
+
+struct client_context {
+	pthread_t thread;
+	int fd;
+	unsigned int id;
+	unsigned long long *lat;
+	int err;
+};
+
+static unsigned long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void conn_put(struct binder_conn *conn, const void *data, size_t len)
+{
+	assert(conn->wlen + len <= sizeof(conn->wbuf));
+	memcpy(conn->wbuf + conn->wlen, data, len);
+	conn->wlen += len;
+}
+
+static void conn_put_cmd(struct binder_conn *conn, uint32_t cmd)
+{
+	conn_put(conn, &cmd, sizeof(cmd));
+}
+
+/* flushes the queued commands and reads back whatever the driver has */
+static ssize_t conn_transact(struct binder_conn *conn)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	bwr.write_size = conn->wlen;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long)conn->wbuf;
+	bwr.read_size = sizeof(conn->rbuf);
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long)conn->rbuf;
+
+	do {
+		ret = ioctl(conn->fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	conn->wlen = 0;
+	return bwr.read_consumed;
+}
+
+static int binder_open_dev(void)
+{
+	struct binder_version vers;
+	void *map;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", device,
+			strerror(errno));
+		return -1;
+	}
+	if (ioctl(fd, BINDER_VERSION, &vers) < 0 ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "%s: binder protocol version mismatch\n",
+			device);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, BINDER_BENCH_VM_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", device,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* closes the fds the driver installed for us in a received buffer */
+static void close_received_fds(struct binder_transaction_data *tr)
+{
+	const size_t *offs = tr->data.ptr.offsets;
+	size_t i;
+
+	for (i = 0; i < tr->offsets_size / sizeof(size_t); i++) {
+		const struct flat_binder_object *obj;
+
+		obj = (const void *)((const char *)tr->data.ptr.buffer +
+				     offs[i]);
+		if (obj->type == BINDER_TYPE_FD)
+			close(obj->handle);
+	}
+}
+
+static void *server_thread(void *arg)
+{
+	struct binder_conn conn = { .fd = (long)arg };
+	uint32_t status = 0;
+
+	conn_put_cmd(&conn, BC_ENTER_LOOPER);
+	for (;;) {
+		char *ptr, *end;
+		ssize_t len;
+
+		len = conn_transact(&conn);
+		if (len < 0)
+			break;
+		ptr = conn.rbuf;
+		end = conn.rbuf + len;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_TRANSACTION: {
+				struct binder_transaction_data *tr = (void *)ptr;
+				struct binder_transaction_data reply;
+				void *buf = (void *)tr->data.ptr.buffer;
+
+				ptr += sizeof(*tr);
+				close_received_fds(tr);
+				conn_put_cmd(&conn, BC_FREE_BUFFER);
+				conn_put(&conn, &buf, sizeof(buf));
+				if (tr->flags & TF_ONE_WAY)
+					break;
+				memset(&reply, 0, sizeof(reply));
+				reply.data_size = sizeof(status);
+				reply.data.ptr.buffer = &status;
+				conn_put_cmd(&conn, BC_REPLY);
+				conn_put(&conn, &reply, sizeof(reply));
+				break;
+			}
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+			case BR_RELEASE:
+			case BR_DECREFS:
+				ptr += sizeof(struct binder_ptr_cookie);
+				break;
+			case BR_NOOP:
+			case BR_SPAWN_LOOPER:
+			case BR_TRANSACTION_COMPLETE:
+				break;
+			default:
+				fprintf(stderr, "server: unexpected command %x\n",
+					cmd);
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void run_server(int ready_out)
+{
+	pthread_t *threads;
+	char ok = 0;
+	unsigned int i;
+	int fd;
+
+	fd = binder_open_dev();
+	if (fd < 0)
+		goto fail;
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		fprintf(stderr, "Cannot become the binder context manager: %s"
+			" (is servicemanager running?)\n", strerror(errno));
+		goto fail;
+	}
+	/* we start all the loopers ourselves */
+	i = 0;
+	ioctl(fd, BINDER_SET_MAX_THREADS, &i);
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		goto fail;
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, server_thread,
+				   (void *)(long)fd))
+			goto fail;
+
+	ok = 1;
+	if (write(ready_out, &ok, 1) != 1)
+		exit(1);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	exit(0);
+fail:
+	if (write(ready_out, &ok, 1) != 1)
+		exit(1);
+	exit(1);
+}
+
+static void *client_thread(void *arg)
+{
+	struct client_context *ctx = arg;
+	struct binder_conn conn = { .fd = ctx->fd };
+	struct binder_transaction_data tr;
+	unsigned int nr_objs = nr_binders + nr_fds;
+	size_t offsets[BINDER_BENCH_MAX_OBJS];
+	struct flat_binder_object *objs;
+	char *data;
+	unsigned int i, j, nr_open = nr_binders;
+
+	data = calloc(1, nr_objs * sizeof(*objs) + payload_size);
+	if (!data) {
+		ctx->err = ENOMEM;
+		return NULL;
+	}
+	objs = (void *)data;
+	for (j = 0; j < nr_objs; j++) {
+		offsets[j] = j * sizeof(*objs);
+		if (j < nr_binders) {
+			/* the same nodes every time, as a real proxy would */
+			objs[j].type = BINDER_TYPE_BINDER;
+			objs[j].flags = FLAT_BINDER_FLAG_ACCEPTS_FDS;
+			objs[j].binder = (void *)(long)(((ctx->id + 1) << 16) +
+							j + 1);
+			objs[j].cookie = objs[j].binder;
+		} else {
+			objs[j].type = BINDER_TYPE_FD;
+			objs[j].handle = open("/dev/null", O_RDONLY);
+			if (objs[j].handle < 0) {
+				ctx->err = errno;
+				goto out;
+			}
+			nr_open++;
+		}
+	}
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = 0;
+	tr.code = 1;
+	tr.flags = TF_ACCEPT_FDS | (oneway ? TF_ONE_WAY : 0);
+	tr.data_size = nr_objs * sizeof(*objs) + payload_size;
+	tr.offsets_size = nr_objs * sizeof(size_t);
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+
+	for (i = 0; i < loops; i++) {
+		unsigned long long start = now_nsec();
+		int done = 0;
+
+		conn_put_cmd(&conn, BC_TRANSACTION);
+		conn_put(&conn, &tr, sizeof(tr));
+		while (!done) {
+			char *ptr, *end;
+			ssize_t len;
+
+			len = conn_transact(&conn);
+			if (len < 0) {
+				ctx->err = errno;
+				goto out;
+			}
+			ptr = conn.rbuf;
+			end = conn.rbuf + len;
+			while (ptr < end) {
+				uint32_t cmd = *(uint32_t *)ptr;
+
+				ptr += sizeof(cmd);
+				switch (cmd) {
+				case BR_TRANSACTION_COMPLETE:
+					if (oneway)
+						done = 1;
+					break;
+				case BR_REPLY: {
+					struct binder_transaction_data *rtr;
+					void *buf;
+
+					rtr = (void *)ptr;
+					ptr += sizeof(*rtr);
+					buf = (void *)rtr->data.ptr.buffer;
+					conn_put_cmd(&conn, BC_FREE_BUFFER);
+					conn_put(&conn, &buf, sizeof(buf));
+					done = 1;
+					break;
+				}
+				case BR_INCREFS:
+				case BR_ACQUIRE: {
+					struct binder_ptr_cookie *pc;
+
+					pc = (void *)ptr;
+					ptr += sizeof(*pc);
+					conn_put_cmd(&conn, cmd == BR_INCREFS ?
+						     BC_INCREFS_DONE :
+						     BC_ACQUIRE_DONE);
+					conn_put(&conn, pc, sizeof(*pc));
+					break;
+				}
+				case BR_RELEASE:
+				case BR_DECREFS:
+					ptr += sizeof(struct binder_ptr_cookie);
+					break;
+				case BR_NOOP:
+				case BR_SPAWN_LOOPER:
+					break;
+				case BR_FAILED_REPLY:
+					if (oneway) {
+						/* async space full, try again */
+						sched_yield();
+						conn_put_cmd(&conn,
+							     BC_TRANSACTION);
+						conn_put(&conn, &tr,
+							 sizeof(tr));
+						break;
+					}
+					/* fall through */
+				default:
+					fprintf(stderr,
+						"client: unexpected command %x\n",
+						cmd);
+					ctx->err = EPROTO;
+					goto out;
+				}
+			}
+		}
+		ctx->lat[i] = now_nsec() - start;
+	}
+
+	/* hand back any refcount acks still queued */
+	if (conn.wlen)
+		conn_transact(&conn);
+out:
+	for (j = nr_binders; j < nr_open; j++)
+		close(objs[j].handle);
+	free(data);
+	return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_usec(unsigned long long *lat, size_t nr, int per_mille)
+{
+	size_t idx = (nr * per_mille) / 1000;
+
+	if (idx >= nr)
+		idx = nr - 1;
+	return lat[idx] / 1000.0;
+}
+
+int bench_binder_transaction(int argc, const char **argv,
+			     const char *prefix __used)
+{
+	struct client_context *clients = NULL;
+	unsigned long long start, total_nsec, *lat = NULL;
+	size_t nr_ops;
+	int readyfds[2], wait_stat, fd = -1, status = 1;
+	unsigned int i, nr_started;
+	char ok;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_binder_transaction_usage, 0);
+
+	if (!nr_threads || !loops) {
+		fprintf(stderr, "Need at least one thread and one loop\n");
+		return 1;
+	}
+	if (nr_binders + nr_fds > BINDER_BENCH_MAX_OBJS) {
+		fprintf(stderr, "At most %d objects per transaction\n",
+			BINDER_BENCH_MAX_OBJS);
+		return 1;
+	}
+	if (payload_size > BINDER_BENCH_VM_SIZE / (2 * nr_threads)) {
+		fprintf(stderr, "Payload too large for %d threads\n",
+			nr_threads);
+		return 1;
+	}
+
+	if (pipe(readyfds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!pid)
+		run_server(readyfds[1]);
+
+	if (read(readyfds[0], &ok, 1) != 1 || !ok)
+		goto out_reap;
+
+	fd = binder_open_dev();
+	if (fd < 0)
+		goto out_kill;
+
+	nr_ops = (size_t)loops * nr_threads;
+	lat = calloc(nr_ops, sizeof(*lat));
+	clients = calloc(nr_threads, sizeof(*clients));
+	if (!lat || !clients) {
+		fprintf(stderr, "Out of memory\n");
+		goto out_kill;
+	}
+
+	start = now_nsec();
+	for (i = 0; i < nr_threads; i++) {
+		clients[i].fd = fd;
+		clients[i].id = i;
+		clients[i].lat = lat + (size_t)i * loops;
+		if (pthread_create(&clients[i].thread, NULL, client_thread,
+				   &clients[i])) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	nr_started = i;
+	status = nr_started < nr_threads;
+	/* without a server the clients that did start fail out */
+	if (status)
+		kill(pid, SIGKILL);
+	for (i = 0; i < nr_started; i++) {
+		pthread_join(clients[i].thread, NULL);
+		if (clients[i].err && nr_started == nr_threads) {
+			fprintf(stderr, "client %d failed: %s\n", i,
+				strerror(clients[i].err));
+			status = 1;
+		}
+	}
+	total_nsec = now_nsec() - start;
+	if (status)
+		goto out_kill;
+
+	qsort(lat, nr_ops, sizeof(*lat), cmp_ull);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u %s transactions of %u bytes, %u binders, %u fds"
+		       ", by %u client/server thread pairs\n\n",
+		       loops, oneway ? "one-way" : "two-way", payload_size,
+		       nr_binders, nr_fds, nr_threads);
+		printf(" %14s: %llu.%03llu [sec]\n\n", "Total time",
+		       total_nsec / 1000000000ULL,
+		       (total_nsec / 1000000ULL) % 1000);
+		printf(" %14.0lf ops/sec\n",
+		       (double)nr_ops * 1000000000.0 / (double)total_nsec);
+		printf(" %14.3lf usecs p50\n", percentile_usec(lat, nr_ops, 500));
+		printf(" %14.3lf usecs p99\n", percentile_usec(lat, nr_ops, 990));
+		printf(" %14.3lf usecs p999\n", percentile_usec(lat, nr_ops, 999));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf %.3lf %.3lf %.3lf\n",
+		       (double)nr_ops * 1000000000.0 / (double)total_nsec,
+		       percentile_usec(lat, nr_ops, 500),
+		       percentile_usec(lat, nr_ops, 990),
+		       percentile_usec(lat, nr_ops, 999));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+out_kill:
+	kill(pid, SIGKILL);
+	if (fd >= 0)
+		close(fd);
+	free(clients);
+	free(lat);
+out_reap:
+	waitpid(pid, &wait_stat, 0);
+	return status;
+}
@@ -0,0 +1,7 @@
+#ifndef LINUX_POISON_H
+#define LINUX_POISON_H
+
+#define LIST_POISON1 ((void *) 0x00100100)
+#define LIST_POISON2 ((void *) 0x00200200)
+
+#endif
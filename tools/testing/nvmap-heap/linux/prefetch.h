@@ -0,0 +1,6 @@
+#ifndef LINUX_PREFETCH_H
+#define LINUX_PREFETCH_H
+
+static inline void prefetch(void *a __attribute__((unused))) { }
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Replays carveout allocation traces through the nvmap heap core
+ *
+ * Builds drivers/video/tegra/nvmap/nvmap_heap_core.c against the headers
+ * in linux/ and asm/ and runs an alloc/free trace through it, then prints
+ * the heap statistics that the heap's sysfs attributes show, including
+ * the fragmentation that drives the carveout compactor.
+ *
+ * Trace lines, '#' starts a comment:
+ *	a <id> <len> [<align>]	allocate len bytes as id
+ *	f <id>			free id
+ *	s			print the statistics now
+ *
+ * Lengths and alignments are rounded up to pages and placed bottom-up,
+ * as nvmap_heap_alloc() does with the compactor.  -t places allocations
+ * larger than the given size top-down instead, as the heap does for
+ * allocations above its small_alloc size without the compactor.  Buddy
+ * sub-heaps and compaction itself are not modelled.
+ *
+ * Usage: nvmap_heap_replay [-s heap_size] [-b base] [-t size] [trace]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/kernel.h>
+#include <asm/page.h>
+
+#include "nvmap_heap_core.h"
+
+static struct list_block **ids;
+static unsigned long nr_ids;
+static unsigned long allocs, failed, frees;
+
+static struct list_block *alloc_block(void)
+{
+	return calloc(1, sizeof(struct list_block));
+}
+
+static void free_block(struct list_block *b)
+{
+	free(b);
+}
+
+static void print_stat(struct nvmap_heap_core *core)
+{
+	struct heap_stat stat;
+	unsigned long base;
+
+	memset(&stat, 0, sizeof(stat));
+	base = nvmap_heap_core_stat(core, &stat);
+	stat.fragmentation = nvmap_heap_fragmentation(stat.free,
+						      stat.free_largest);
+
+	printf("allocs %lu failed %lu frees %lu\n", allocs, failed, frees);
+	printf("base %08lx total_size %zu total_count %zu total_max %zu\n",
+	       base, stat.total, stat.count, stat.largest);
+	printf("free_size %zu free_count %zu free_max %zu fragmentation %u\n",
+	       stat.free, stat.free_count, stat.free_largest,
+	       stat.fragmentation);
+}
+
+static int set_id(unsigned long id, struct list_block *b)
+{
+	if (id >= nr_ids) {
+		unsigned long n = max(id + 1, 2 * nr_ids);
+		struct list_block **p = realloc(ids, n * sizeof(*ids));
+
+		if (!p)
+			return -ENOMEM;
+		memset(p + nr_ids, 0, (n - nr_ids) * sizeof(*ids));
+		ids = p;
+		nr_ids = n;
+	}
+	ids[id] = b;
+	return 0;
+}
+
+static int replay(struct nvmap_heap_core *core, FILE *f, size_t top_down)
+{
+	char line[256];
+	unsigned long id, len, align;
+	unsigned int lineno = 0;
+	struct list_block *b;
+	enum direction dir;
+	int n;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (line[0] == 's') {
+			print_stat(core);
+			continue;
+		}
+
+		if (line[0] == 'f' && sscanf(line + 1, "%lu", &id) == 1) {
+			if (id >= nr_ids || !ids[id]) {
+				fprintf(stderr, "%u: %lu is not allocated\n",
+					lineno, id);
+				return -EINVAL;
+			}
+			nvmap_heap_core_free(core, ids[id]);
+			ids[id] = NULL;
+			frees++;
+			continue;
+		}
+
+		align = 0;
+		n = sscanf(line + 1, "%lu %lu %lu", &id, &len, &align);
+		if (line[0] != 'a' || n < 2 || !len ||
+		    (align & (align - 1))) {
+			fprintf(stderr, "%u: bad line: %s", lineno, line);
+			return -EINVAL;
+		}
+		if (id < nr_ids && ids[id]) {
+			fprintf(stderr, "%u: %lu is already allocated\n",
+				lineno, id);
+			return -EINVAL;
+		}
+
+		len = ALIGN(len, PAGE_SIZE);
+		align = ALIGN(max(align, 1ul), PAGE_SIZE);
+		dir = (top_down && len > top_down) ? TOP_DOWN : BOTTOM_UP;
+		allocs++;
+		b = nvmap_heap_core_alloc(core, len, align, dir, 0);
+		if (!b) {
+			failed++;
+			continue;
+		}
+		if (set_id(id, b))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s heap_size] [-b base] [-t size] "
+		"[trace]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct nvmap_heap_core core = {
+		.alloc_block = alloc_block,
+		.free_block = free_block,
+	};
+	unsigned long base = 0x10000000, size = 64 << 20, top_down = 0;
+	struct list_block *l;
+	FILE *f = stdin;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "s:b:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			base = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			top_down = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc - 1 || !size || (base | size) & (PAGE_SIZE - 1))
+		usage(argv[0]);
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	l = alloc_block();
+	if (!l)
+		return 1;
+	nvmap_heap_core_init(&core, l, base, size);
+
+	err = replay(&core, f, top_down);
+	if (err)
+		return 1;
+	print_stat(&core);
+	return 0;
+}
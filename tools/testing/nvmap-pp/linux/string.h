@@ -0,0 +1,6 @@
+#ifndef LINUX_STRING_H
+#define LINUX_STRING_H
+
+#include <string.h>
+
+#endif
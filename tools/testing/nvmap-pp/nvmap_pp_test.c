@@ -0,0 +1,231 @@
+/*
+ * Host test for the nvmap page pool bookkeeping
+ *
+ * Builds drivers/video/tegra/nvmap/nvmap_pp_core.c against the headers in
+ * linux/ and checks the page stack, the refill thresholds and the shrinker
+ * split without Tegra hardware.  The refill and drain loops below follow
+ * the ones in nvmap_pp.c, with a counter standing in for the page
+ * allocator.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <linux/kernel.h>
+
+#include "nvmap_pp_core.h"
+
+struct page {
+	int id;
+};
+
+static struct page page_pool[4096];
+static int next_page;
+static int fail_after = -1;	/* allocations left before failing */
+static int freed_pages;
+
+static struct page *alloc_page(void)
+{
+	if (fail_after == 0 || next_page == ARRAY_SIZE(page_pool))
+		return NULL;
+	if (fail_after > 0)
+		fail_after--;
+	page_pool[next_page].id = next_page;
+	return &page_pool[next_page++];
+}
+
+static struct nvmap_pp_stack *new_stack(int max_pages)
+{
+	struct nvmap_pp_stack *s = calloc(1, sizeof(*s));
+
+	assert(s);
+	s->max_pages = max_pages;
+	s->page_array = calloc(max_pages, sizeof(struct page *));
+	assert(s->page_array);
+	return s;
+}
+
+static void free_stack(struct nvmap_pp_stack *s)
+{
+	free(s->page_array);
+	free(s);
+}
+
+/* nvmap_page_pool_refill() */
+static int refill(struct nvmap_pp_stack *s)
+{
+	struct page *pages[NVMAP_PP_BATCH];
+	int want, got, taken, rounds = 0;
+
+	for (;;) {
+		want = nvmap_pp_refill_count(s);
+		if (!want)
+			break;
+		assert(want <= NVMAP_PP_BATCH);
+
+		for (got = 0; got < want; got++) {
+			pages[got] = alloc_page();
+			if (!pages[got])
+				break;
+		}
+		if (!got)
+			break;
+		rounds++;
+
+		taken = nvmap_pp_push(s, pages, got);
+		freed_pages += got - taken;
+		if (got < want)
+			break;
+	}
+	return rounds;
+}
+
+/* nvmap_page_pool_drain() */
+static int drain(struct nvmap_pp_stack *s, int nr)
+{
+	struct page *pages[NVMAP_PP_BATCH];
+	int freed = 0, got;
+
+	while (freed < nr) {
+		got = nvmap_pp_pop(s, pages, min(nr - freed, NVMAP_PP_BATCH));
+		if (!got)
+			break;
+		freed_pages += got;
+		freed += got;
+	}
+	return freed;
+}
+
+static void test_push_pop(void)
+{
+	struct nvmap_pp_stack *s = new_stack(8);
+	struct page *in[10], *out[10];
+	int i;
+
+	for (i = 0; i < 10; i++)
+		in[i] = &page_pool[i];
+
+	assert(nvmap_pp_pop(s, out, 4) == 0);
+	assert(nvmap_pp_push(s, in, 0) == 0);
+	assert(nvmap_pp_push(s, in, -1) == 0);
+	assert(s->npages == 0);
+
+	/* pushes stop at max_pages, the caller keeps the rest */
+	assert(nvmap_pp_push(s, in, 5) == 5);
+	assert(nvmap_pp_push(s, in + 5, 5) == 3);
+	assert(s->npages == 8);
+	assert(nvmap_pp_push(s, in + 8, 2) == 0);
+
+	/* last in, first out */
+	assert(nvmap_pp_pop(s, out, 3) == 3);
+	assert(out[0] == in[5] && out[1] == in[6] && out[2] == in[7]);
+	assert(s->npages == 5);
+
+	/* pops stop when the stack is empty */
+	assert(nvmap_pp_pop(s, out, -1) == 0);
+	assert(nvmap_pp_pop(s, out, 10) == 5);
+	for (i = 0; i < 5; i++)
+		assert(out[i] == in[i]);
+	assert(s->npages == 0);
+
+	free_stack(s);
+}
+
+static void test_refill_thresholds(void)
+{
+	struct nvmap_pp_stack *s = new_stack(1024);
+	struct page *pages[1024];
+
+	/* empty: refill to max/4 in full batches */
+	assert(nvmap_pp_need_refill(s));
+	assert(nvmap_pp_refill_count(s) == NVMAP_PP_BATCH);
+	next_page = 0;
+	fail_after = -1;
+	assert(refill(s) == 256 / NVMAP_PP_BATCH);
+	assert(s->npages == 256);
+	assert(!nvmap_pp_need_refill(s));
+	assert(nvmap_pp_refill_count(s) == 0);
+
+	/* no refill at exactly max/8, one page below triggers it */
+	assert(nvmap_pp_pop(s, pages, 128) == 128);
+	assert(!nvmap_pp_need_refill(s));
+	assert(nvmap_pp_pop(s, pages, 1) == 1);
+	assert(nvmap_pp_need_refill(s));
+
+	/* the last round is cut short to land on max/4 */
+	assert(nvmap_pp_pop(s, pages, 7) == 7);
+	assert(s->npages == 120);
+	assert(refill(s) == 5);
+	assert(s->npages == 256);
+
+	/* above max/4, e.g. after frees, nothing is allocated */
+	assert(nvmap_pp_push(s, pages, 100) == 100);
+	assert(nvmap_pp_refill_count(s) == 0);
+	assert(refill(s) == 0);
+
+	/* allocation failure stops the refill with what was allocated */
+	assert(nvmap_pp_pop(s, pages, 356) == 356);
+	fail_after = 40;
+	assert(refill(s) == 2);
+	assert(s->npages == 40);
+	fail_after = -1;
+
+	/* a pool too small for a threshold never asks for pages */
+	free_stack(s);
+	s = new_stack(3);
+	assert(!nvmap_pp_need_refill(s));
+	assert(nvmap_pp_refill_count(s) == 0);
+
+	free_stack(s);
+}
+
+static void test_shrink(void)
+{
+	int npages[3] = { 100, 0, 50 };
+	int plan[3];
+	struct nvmap_pp_stack *s[3];
+	struct page *pages[100] = { NULL };
+	int i, left;
+
+	/* a count query drains nothing */
+	assert(nvmap_pp_shrink_plan(npages, plan, 3, 0) == 150);
+	assert(plan[0] == 0 && plan[1] == 0 && plan[2] == 0);
+
+	/* pools are emptied in order */
+	assert(nvmap_pp_shrink_plan(npages, plan, 3, 60) == 90);
+	assert(plan[0] == 60 && plan[1] == 0 && plan[2] == 0);
+	assert(nvmap_pp_shrink_plan(npages, plan, 3, 120) == 30);
+	assert(plan[0] == 100 && plan[1] == 0 && plan[2] == 20);
+
+	/* asking for more than there is empties everything */
+	assert(nvmap_pp_shrink_plan(npages, plan, 3, 1000) == 0);
+	assert(plan[0] == 100 && plan[1] == 0 && plan[2] == 50);
+
+	/* and the drain loop gives back exactly the plan, in batches */
+	for (i = 0; i < 3; i++) {
+		s[i] = new_stack(128);
+		assert(nvmap_pp_push(s[i], pages, npages[i]) == npages[i]);
+	}
+	left = nvmap_pp_shrink_plan(npages, plan, 3, 120);
+	freed_pages = 0;
+	for (i = 0; i < 3; i++)
+		assert(drain(s[i], plan[i]) == plan[i]);
+	assert(freed_pages == 120);
+	assert(s[0]->npages + s[1]->npages + s[2]->npages == left);
+	for (i = 0; i < 3; i++)
+		free_stack(s[i]);
+}
+
+int main(void)
+{
+	test_push_pop();
+	test_refill_thresholds();
+	test_shrink();
+	printf("nvmap-pp: all tests passed\n");
+	return 0;
+}